@@ -0,0 +1,27 @@
+#ifndef __CONSOLE_H__
+#define __CONSOLE_H__
+
+#include "main.h"
+#include <stdint.h>
+
+// Console ring size in bytes (power of two)
+#define CONSOLE_BUF_SIZE          4096
+#define CONSOLE_FLUSH_TIMEOUT_MS  1000
+
+// Console counters, for sizing CONSOLE_BUF_SIZE
+typedef struct {
+    uint32_t written;     // bytes queued
+    uint32_t sent;        // bytes transmitted
+    uint32_t dropped;     // bytes lost, ring full
+    uint32_t overflows;   // writes cut short
+    uint32_t high_water;  // most bytes waiting
+} ConsoleStats;
+
+// Non-blocking console: _write copies into a ring and returns, the UART
+// drains it by DMA in the background
+void console_init(UART_HandleTypeDef *huart);
+int console_write(const void *data, int len);
+HAL_StatusTypeDef console_flush(uint32_t timeout_ms);
+void console_get_stats(ConsoleStats *stats);
+
+#endif // __CONSOLE_H__
@@ -2,7 +2,50 @@
 #define __SD_BENCHMARK_H__
 
 #include <stdint.h>
+#include "ff.h"
+
+typedef struct {
+    uint32_t seq_file_size;   // bytes per sequential case, also the random span
+    uint32_t random_ops;      // operations per random / mixed case
+    uint32_t mixed_read_pct;  // share of reads in the mixed case
+    uint32_t files;           // files created then deleted
+} SdBenchConfig;
 
 void sd_benchmark(void);
 
+// sd_benchmark.c: plain f_write / f_read, return the elapsed ms
+uint32_t sd_benchmark_write(const char* filename, uint32_t size_bytes);
+uint32_t sd_benchmark_read(const char* filename, uint32_t size_bytes);
+
+// sd_benchmark_suite.c
+void sd_benchmark_suite(const SdBenchConfig* cfg);
+
+// sd_benchmark_driver.c: diskio write cache, pre-erase, wait hook, scratch buffer, trace
+uint32_t sd_benchmark_small_write(const char* filename, uint32_t size_bytes, UINT record_size);
+void sd_benchmark_pre_erase(const char* filename, uint32_t size_bytes);
+void sd_benchmark_unaligned(const char* filename, uint32_t size_bytes);
+void sd_benchmark_cpu_free(const char* filename, uint32_t size_bytes);
+void sd_benchmark_trace(const char* filename);
+
+// sd_benchmark_fatfs.c: FatFs extensions against the original code paths
+void sd_benchmark_fatcache(uint32_t files);
+void sd_benchmark_alloc(uint32_t holes);
+void sd_benchmark_boot(void);
+void sd_benchmark_seek(void);
+void sd_benchmark_dirindex(void);
+void sd_benchmark_create(uint32_t files);
+
+// sd_benchmark_log.c: logging paths
+uint32_t sd_benchmark_stream(const char* filename, uint32_t size_bytes);
+void sd_benchmark_log(const char* filename, uint32_t appends);
+void sd_benchmark_record(const char* filename, uint32_t size_bytes);
+void sd_benchmark_queue(const char* filename, uint32_t size_bytes);
+void sd_benchmark_pack(const char* filename);
+
+// sd_benchmark_text.c: text and CSV files
+void sd_benchmark_csv(const char* filename, uint32_t size_bytes);
+void sd_benchmark_csv_write(const char* filename, uint32_t rows);
+void sd_benchmark_tslog(const char* filename, const char* csv_name, uint32_t records);
+void sd_benchmark_text(const char* filename, uint32_t size_bytes);
+
 #endif // __SD_BENCHMARK_H__
@@ -0,0 +1,32 @@
+#ifndef __SD_BENCHMARK_UTIL_H__
+#define __SD_BENCHMARK_UTIL_H__
+
+#include <stdint.h>
+
+// Sizes shared by the sd_benchmark_*.c files
+#define BUF_SIZE             65536             // 64 KB, divided by 512
+#define RECORD_SIZE          48                // typical text log line
+#define STREAM_BUF_SIZE      8192              // per ping-pong buffer
+#define LOG_BUF_SIZE         4096
+#define BENCH_SCRATCH_SIZE   (BUF_SIZE + 32)   // largest case: unaligned, record
+
+// DWT cycle counter, restarted by bench_timer_init
+void bench_timer_init(void);
+uint32_t bench_us_since(uint32_t start);
+
+// Fixed sequence of pseudo random numbers, restarted by bench_rand_seed
+void bench_rand_seed(void);
+uint32_t bench_rand(void);
+
+// Latency histogram of the current case, printed by bench_report as
+// BENCH,test,size,ops,bytes,time_us,kbps,iops,p50_us,p99_us,max_us
+void bench_lat_reset(void);
+void bench_lat_add(uint32_t us);
+void bench_report(const char* test, uint32_t size, uint32_t bytes, uint32_t extra_us);
+
+// Static 32-byte aligned area for the buffers of the running benchmark,
+// NULL if size is above BENCH_SCRATCH_SIZE. A benchmark that calls another
+// one (sd_benchmark_write) must be done with it first.
+void* bench_scratch(uint32_t size);
+
+#endif // __SD_BENCHMARK_UTIL_H__
@@ -0,0 +1,62 @@
+#ifndef __SD_CSV_H__
+#define __SD_CSV_H__
+
+#include "fatfs.h"
+#include <stdint.h>
+
+// Fields handed to the record callback, more are counted but not passed
+#define SD_CSV_MAX_FIELDS    16
+
+// One field: a slice of the read buffer, not NUL-terminated, valid only
+// during the callback. Quotes are removed and "" is unescaped in place.
+typedef struct {
+    const char *ptr;
+    uint32_t len;
+} SdCsvField;
+
+// Called once per record, return non-zero to stop reading
+typedef int (*SdCsvRecordFn)(const SdCsvField *fields, uint32_t nfields, void *ctx);
+
+// Block CSV reader: the file is read in buf_size chunks (4-32 KB, a
+// multiple of 512) and scanned for delimiters a word at a time.
+// A record may span chunks but must fit in buf_size - 512 bytes.
+int sd_csv_read(const char *filename, uint8_t *buf, uint32_t buf_size,
+                SdCsvRecordFn fn, void *ctx, uint32_t *records);
+// Same on a file the caller opened, from its current position
+int sd_csv_read_file(FIL *file, uint8_t *buf, uint32_t buf_size,
+                     SdCsvRecordFn fn, void *ctx, uint32_t *records);
+
+// Field helpers
+int32_t sd_csv_to_int(const SdCsvField *field);
+uint32_t sd_csv_copy(const SdCsvField *field, char *dst, uint32_t dst_size);
+
+// Row writer: fields are formatted straight into buf (a multiple of 512,
+// 4-byte aligned) without printf, and only whole sectors are written
+// until sd_csv_writer_close. Errors stick: once a call fails the others
+// return the same FRESULT.
+typedef struct SdCsvWriter {
+    FIL file;
+    uint8_t *buf;
+    uint32_t buf_size;
+    uint32_t fill;          // bytes held in buf
+    uint32_t nfields;       // fields in the row being built
+    FRESULT res;
+    uint32_t rows;
+    uint32_t bytes;         // bytes written to the file
+} SdCsvWriter;
+
+int sd_csv_writer_open(SdCsvWriter *w, const char *filename, uint8_t *buf, uint32_t buf_size);
+int sd_csv_writer_close(SdCsvWriter *w);
+
+// One field each, in row order. Strings holding ',', '"' or a line break
+// are quoted. Fixed point prints v / 10^decimals (0-6). Floats are
+// rounded to decimals (0-6) digits, and printed as <digits>e<exp> from
+// 4e9 on.
+int sd_csv_put_str(SdCsvWriter *w, const char *str);
+int sd_csv_put_int(SdCsvWriter *w, int32_t v);
+int sd_csv_put_uint(SdCsvWriter *w, uint32_t v);
+int sd_csv_put_fixed(SdCsvWriter *w, int32_t v, uint8_t decimals);
+int sd_csv_put_float(SdCsvWriter *w, float v, uint8_t decimals);
+int sd_csv_end_row(SdCsvWriter *w);
+
+#endif // __SD_CSV_H__
@@ -16,6 +16,23 @@ int sd_read_file(const char *filename, char *buffer, UINT bufsize, UINT *bytes_r
 int sd_delete_file(const char *filename);
 int sd_rename_file(const char *oldname, const char *newname);
 
+// Append-optimized log file: stays open, appends are batched in buf
+// and written in sector-aligned pieces, f_sync every sync_ms (0 = never)
+typedef struct SdLog {
+	FIL file;
+	FSIZE_t tail;        // file size, next append position
+	uint8_t *buf;        // batch buffer, NULL = every append goes to f_write
+	uint32_t buf_size;
+	uint32_t fill;       // bytes waiting in buf
+	uint32_t sync_ms;
+	uint32_t last_sync;  // HAL_GetTick() of the last f_sync
+} SdLog;
+
+int sd_log_open(SdLog *log, const char *filename, uint8_t *buf, uint32_t buf_size, uint32_t sync_ms);
+int sd_log_append(SdLog *log, const void *data, uint32_t len);
+int sd_log_flush(SdLog *log);
+int sd_log_close(SdLog *log);
+
 
 // Directory handling
 FRESULT sd_create_directory(const char *path);
@@ -23,7 +40,10 @@ void sd_list_directory_recursive(const char *path, int depth);
 void sd_list_files(void);
 
 // Space information
+#define SD_FREE_SCAN_STEP 64	// FAT sectors counted per sd_scan_free call
+
 int sd_get_space_kb(void);
+int sd_scan_free(UINT nsect);
 
 //csv File operations
 // CSV Record structure
@@ -36,4 +56,7 @@ typedef struct CsvRecord {
 // CSV reader (caller defines record array)
 int sd_read_csv(const char *filename, CsvRecord *records, int max_records, int *record_count);
 
+// CSV writer
+int sd_write_csv(const char *filename, const CsvRecord *records, int record_count);
+
 #endif // __SD_FUNCTIONS_H__
@@ -0,0 +1,41 @@
+#ifndef __SD_QUEUE_H__
+#define __SD_QUEUE_H__
+
+#include "fatfs.h"
+#include <stdint.h>
+
+// Largest record payload
+#define SD_QUEUE_MAX_RECORD  0xFFFF
+
+// Record queue: any number of ISRs and the main loop push records into one
+// ring without locks (LDREX/STREX reservation), a single writer context
+// drains them to the file in sector-aligned chunks with f_write
+// File format: per record a 2-byte little-endian length, then the payload
+typedef struct SdQueue {
+    FIL file;
+    uint8_t *ring;
+    uint32_t size;                      // power of two
+    volatile uint32_t head;             // bytes reserved by producers
+    volatile uint32_t tail;             // bytes released by the writer
+    uint8_t *chunk;
+    uint32_t chunk_size;                // multiple of 512
+    uint32_t chunk_fill;
+    uint32_t rec_done;                  // bytes of the current record in the chunk
+    volatile uint32_t dropped;          // records refused, ring full
+    volatile uint32_t dropped_bytes;
+    volatile uint32_t high_water;       // most ring bytes in use
+    uint32_t records;                   // records written
+    uint32_t bytes;                     // payload bytes written
+} SdQueue;
+
+// Queue control, writer context
+int sd_queue_open(SdQueue *q, const char *filename, uint8_t *ring, uint32_t ring_size,
+                  uint8_t *chunk, uint32_t chunk_size);
+int sd_queue_service(SdQueue *q);
+int sd_queue_flush(SdQueue *q);
+int sd_queue_close(SdQueue *q);
+
+// Producer side, safe from any ISR priority
+int sd_queue_push(SdQueue *q, const void *data, uint32_t len);
+
+#endif // __SD_QUEUE_H__
@@ -0,0 +1,55 @@
+#ifndef __SD_STREAM_H__
+#define __SD_STREAM_H__
+
+#include "fatfs.h"
+#include "sd_pack.h"
+#include <stdint.h>
+
+// Maximum number of ping-pong buffers per stream
+#define SD_STREAM_MAX_BUFS   4
+
+// Streaming writer: the producer (main loop or ISR) fills one buffer while
+// the writer context drains the previous ones to the card with f_write
+typedef struct SdStream {
+    FIL file;
+    uint8_t *buf[SD_STREAM_MAX_BUFS];
+    uint32_t used[SD_STREAM_MAX_BUFS];  // bytes held by each full buffer
+    uint32_t buf_size;                  // multiple of 512
+    uint8_t nbufs;
+    uint32_t fill;                      // bytes in the buffer being filled
+    volatile uint32_t filled;           // buffers handed to the writer (producer side)
+    volatile uint32_t drained;          // buffers written to the card (writer side)
+    uint32_t bytes_written;
+    uint32_t overruns;                  // acquire/write calls refused, all buffers full
+    uint32_t max_pending;               // high-watermark of full buffers
+    SdPack *pack;                       // NULL = buffers written as they are
+    uint8_t *out;                       // packed frames waiting for whole sectors
+    uint32_t out_size;
+    uint32_t out_fill;
+    uint32_t tail_fill;                 // bytes staged in tail
+    uint8_t tail[512] __attribute__((aligned(32)));  // partial sector of an unpacked buffer
+} SdStream;
+
+// Staging size for sd_stream_set_pack: one worst-case frame plus the
+// partial sector kept from the previous one
+#define SD_STREAM_PACK_OUT_SIZE(buf_size)  ((SD_PACK_BOUND(buf_size) + 511U + 511U) & ~511U)
+
+// Stream control
+int sd_stream_open(SdStream *s, const char *filename, uint8_t *pool, uint32_t buf_size, uint8_t nbufs);
+int sd_stream_flush(SdStream *s);
+int sd_stream_close(SdStream *s);
+
+// Optional compression: every buffer is packed into one frame by the
+// writer side, frames are staged in out and written in whole sectors.
+// Call after sd_stream_open, before any data.
+int sd_stream_set_pack(SdStream *s, SdPack *pack, uint8_t *out, uint32_t out_size);
+
+// Producer side
+uint8_t *sd_stream_acquire(SdStream *s, uint32_t len);
+void sd_stream_commit(SdStream *s, uint32_t len);
+uint32_t sd_stream_write(SdStream *s, const void *data, uint32_t len);
+
+// Writer side, call from the main loop
+int sd_stream_service(SdStream *s);
+
+#endif // __SD_STREAM_H__
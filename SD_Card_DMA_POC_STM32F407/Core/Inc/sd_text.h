@@ -0,0 +1,48 @@
+#ifndef __SD_TEXT_H__
+#define __SD_TEXT_H__
+
+#include "fatfs.h"
+#include <stdint.h>
+
+// Longest sd_text_printf output, longer output is cut
+#define SD_TEXT_PRINTF_MAX   256
+
+// Buffered text file: reads and writes go through a caller buffer (a
+// multiple of 512) in whole sectors instead of f_gets / f_putc doing one
+// f_read per character or flushing a 64-byte putbuff. Line ends are
+// found and converted over the whole buffer at once. A stream is opened
+// either for reading or for writing.
+typedef struct SdText {
+    FIL file;
+    uint8_t *buf;
+    uint32_t buf_size;
+    uint32_t off;           // read: start of the next line
+    uint32_t fill;          // bytes held in buf
+    uint8_t writing;
+    uint8_t eof;            // read: the last block is in buf
+    FRESULT res;            // first error, later calls fail with it
+    uint32_t lines;         // lines read, or line ends written
+    uint32_t bytes;         // bytes read from / written to the file
+} SdText;
+
+// Stream control, mode is FA_READ or FA_WRITE with FA_CREATE_ALWAYS /
+// FA_OPEN_APPEND
+int sd_text_open(SdText *t, const char *filename, BYTE mode, uint8_t *buf, uint32_t buf_size);
+int sd_text_flush(SdText *t);
+int sd_text_close(SdText *t);
+
+// Reading: next line without its "\n" / "\r\n", NUL-terminated in place
+// in buf and valid until the next call. NULL at end of file or on error
+// (t->res). A line must fit in buf_size - 512 bytes. Unlike f_gets with
+// _USE_STRFUNC 2, a "\r" inside the line is kept, only the one ending
+// it is removed.
+const char *sd_text_readline(SdText *t, uint32_t *len);
+
+// Writing: every "\n" is written as "\r\n", so the file matches f_putc /
+// f_printf with _USE_STRFUNC 2 byte for byte ("\r\n" in the data becomes
+// "\r\r\n" there too). Return the bytes taken from the caller, or -1.
+int sd_text_write(SdText *t, const char *data, uint32_t len);
+int sd_text_puts(SdText *t, const char *str);
+int sd_text_printf(SdText *t, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+#endif // __SD_TEXT_H__
@@ -0,0 +1,130 @@
+#include "console.h"
+#include <string.h>
+
+static uint8_t console_buf[CONSOLE_BUF_SIZE] __attribute__((aligned(32)));
+static UART_HandleTypeDef *console_uart;
+static volatile uint32_t console_head;      // bytes ever queued
+static volatile uint32_t console_tail;      // bytes ever transmitted
+static volatile uint32_t console_tx_len;    // bytes in the running DMA, 0 = idle
+static ConsoleStats console_stats;
+
+/***************************************************************
+ * Start a DMA transfer of the waiting bytes up to the end of
+ * the ring, unless one is already running
+ * Called from the main loop and from the UART interrupt
+ ***************************************************************/
+
+static void console_kick(void) {
+    uint32_t primask = __get_PRIMASK();
+
+    __disable_irq();
+    if (console_uart != NULL && console_tx_len == 0 && console_head != console_tail) {
+        uint32_t pos = console_tail & (CONSOLE_BUF_SIZE - 1);
+        uint32_t len = console_head - console_tail;
+
+        if (len > CONSOLE_BUF_SIZE - pos) len = CONSOLE_BUF_SIZE - pos;
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+        // the DMA reads memory, not the D-cache
+        SCB_CleanDCache_by_Addr((uint32_t*)((uint32_t)(console_buf + pos) & ~0x1FU), len + (pos & 0x1FU));
+#endif
+        console_tx_len = len;
+        if (HAL_UART_Transmit_DMA(console_uart, console_buf + pos, (uint16_t)len) != HAL_OK) {
+            console_tx_len = 0;   // retried on the next write
+        }
+    }
+    __set_PRIMASK(primask);
+}
+
+/***************************************************************
+ * Start sending through huart
+ * Text printed before this call was kept in the ring and goes
+ * out now
+ ***************************************************************/
+
+void console_init(UART_HandleTypeDef *huart) {
+    console_uart = huart;
+    console_kick();
+}
+
+/***************************************************************
+ * Queue len bytes and return at once
+ * Call from the main loop only (printf is not reentrant)
+ * What does not fit in the ring is dropped and counted, so a
+ * slow UART never stalls the caller
+ * Returns len so printf does not retry
+ ***************************************************************/
+
+int console_write(const void *data, int len) {
+    const uint8_t *src = data;
+    uint32_t n, pos, first, used;
+
+    if (len <= 0) return 0;
+
+    n = CONSOLE_BUF_SIZE - (console_head - console_tail);
+    if ((uint32_t)len < n) n = len;
+    if (n < (uint32_t)len) {
+        console_stats.dropped += len - n;
+        console_stats.overflows++;
+    }
+
+    pos = console_head & (CONSOLE_BUF_SIZE - 1);
+    first = (n < CONSOLE_BUF_SIZE - pos) ? n : CONSOLE_BUF_SIZE - pos;
+    memcpy(console_buf + pos, src, first);
+    memcpy(console_buf, src + first, n - first);
+    __DMB(); // bytes in the ring before the DMA may see them
+    console_head += n;
+
+    console_stats.written += n;
+    used = console_head - console_tail;
+    if (used > console_stats.high_water) console_stats.high_water = used;
+
+    console_kick();
+    return len;
+}
+
+/***************************************************************
+ * Wait until every queued byte is transmitted
+ * Use before a reset or low-power entry, or between outputs
+ * larger than the ring (trace dumps)
+ ***************************************************************/
+
+HAL_StatusTypeDef console_flush(uint32_t timeout_ms) {
+    uint32_t start = HAL_GetTick();
+
+    while (console_head != console_tail) {
+        if (console_uart == NULL || (HAL_GetTick() - start) >= timeout_ms) return HAL_TIMEOUT;
+        console_kick(); // retries a transfer the UART refused
+    }
+    return HAL_OK;
+}
+
+void console_get_stats(ConsoleStats *stats) {
+    *stats = console_stats;
+    stats->sent = console_tail;
+}
+
+/***************************************************************
+ * End of a DMA transfer, runs in the UART interrupt
+ ***************************************************************/
+
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart) {
+    if (huart != console_uart) return;
+
+    console_tail += console_tx_len;
+    console_tx_len = 0;
+    console_kick();
+}
+
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart) {
+    if (huart != console_uart) return;
+
+    // the transfer may have stopped half way or still be running:
+    // abort it and skip its bytes rather than stall
+    HAL_UART_AbortTransmit(huart);
+    if (console_tx_len != 0) {
+        console_stats.dropped += console_tx_len;
+        console_tail += console_tx_len;
+        console_tx_len = 0;
+    }
+    console_kick();
+}
@@ -25,6 +25,8 @@
 #include <stdio.h>
 #include "sd_functions.h"
 #include "sd_benchmark.h"
+#include "sd_dlog.h"
+#include "console.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -51,6 +53,7 @@ SD_HandleTypeDef hsd;
 DMA_HandleTypeDef hdma_sdio;
 
 UART_HandleTypeDef huart2;
+DMA_HandleTypeDef hdma_usart2_tx;
 
 /* USER CODE BEGIN PV */
 
@@ -67,11 +70,11 @@ static void MX_USART2_UART_Init(void);
 /* USER CODE BEGIN PFP */
 
 /*
- *	Function that print data via UART
+ *	Function that print data via UART, queued and sent by DMA
  */
 int _write(int fd, unsigned char *buf, int len) {
   if (fd == 1 || fd == 2) {
-    HAL_UART_Transmit(&huart2, buf, len, 999);  // Print to the UART
+    console_write(buf, len);  // Print to the UART
   }
   return len;
 }
@@ -119,10 +122,18 @@ int main(void)
   MX_FATFS_Init();
   MX_USART2_UART_Init();
   /* USER CODE BEGIN 2 */
+  console_init(&huart2);
 
   /* !ONLY test speed for read / write. for some project use sd_function */
   sd_benchmark();
 
+  /* Keep the card mounted; when FSInfo could not be trusted the free
+     space is counted a few FAT sectors at a time in the idle loop */
+  int free_pending = (sd_mount() == FR_OK);
+  /* the mount status and errors only go to the deferred log: print them
+     for tools/sd_dlog_decode.py */
+  sd_dlog_dump();
+
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -132,6 +143,10 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
+    /* each call checks the card status: stop once the count is known or failed */
+    if (free_pending && sd_scan_free(SD_FREE_SCAN_STEP) != 0) free_pending = 0;
+    /* small writes left in the driver cache reach the card after SD_WRITE_CACHE_FLUSH_MS */
+    SD_WriteCache_Poll();
   }
   /* USER CODE END 3 */
 }
@@ -324,9 +339,13 @@ static void MX_DMA_Init(void)
 {
 
   /* DMA controller clock enable */
+  __HAL_RCC_DMA1_CLK_ENABLE();
   __HAL_RCC_DMA2_CLK_ENABLE();
 
   /* DMA interrupt init */
+  /* DMA1_Stream6_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream6_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream6_IRQn);
   /* DMA2_Stream3_IRQn interrupt configuration */
   HAL_NVIC_SetPriority(DMA2_Stream3_IRQn, 0, 0);
   HAL_NVIC_EnableIRQ(DMA2_Stream3_IRQn);
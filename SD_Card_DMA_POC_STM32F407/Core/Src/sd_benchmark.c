@@ -1,12 +1,25 @@
 #include "sd_benchmark.h"
+#include "sd_benchmark_util.h"
 #include "fatfs.h"
 #include <stdio.h>
 #include <string.h>
 #include "main.h"
 #include "sd_functions.h"
+#if !defined(SD_HOST_IMAGE)
+#include "console.h"
+#endif
+#include "sd_dlog.h"
 
 #define TEST_SIZE      (8 * 1024 * 1024) // 8 MB
-#define BUF_SIZE       65536             // 64 KB, divided by 512
+#define SMALL_TEST_SIZE (1 * 1024 * 1024) // 1 MB
+#define LOG_APPENDS          500
+#define FATCACHE_FILES       200
+#define ALLOC_HOLES          64
+#define CREATE_FILES         10000
+#define CSV_FILE_SIZE        (1 * 1024 * 1024)
+#define CSV_WRITE_ROWS       20000
+#define TSLOG_RECORDS        100000
+#define TEXT_FILE_SIZE       (512 * 1024)
 
 /***************************************************************
  * This function write data into file using DMA
@@ -16,11 +29,12 @@ uint32_t sd_benchmark_write(const char* filename, uint32_t size_bytes) {
     FIL file;
     UINT written;
 
-    // align buffer
-    uint8_t buffer[BUF_SIZE] __attribute__((aligned(4)));
+    // 32-byte aligned scratch = one cache line for zero-copy DMA on the H7
+    uint8_t *buffer = bench_scratch(BUF_SIZE);
+    if (buffer == NULL) return 0;
 
     // set dummy data we can set SPI data if we need it
-    memset(buffer, 0xAA, sizeof(buffer));
+    memset(buffer, 0xAA, BUF_SIZE);
 
     FRESULT res = f_open(&file, filename, FA_OPEN_ALWAYS | FA_WRITE);
     if (res != FR_OK) {
@@ -43,13 +57,6 @@ uint32_t sd_benchmark_write(const char* filename, uint32_t size_bytes) {
         // break the buffer into particles
         UINT to_write = (remaining > BUF_SIZE) ? BUF_SIZE : remaining;
 
-        // Move pointer to end using f_lseek
-        res = f_lseek(&file, f_size(&file));
-        if (res != FR_OK) {
-            f_close(&file);
-            return res;
-        }
-
         // write data with DMA
         res = f_write(&file, buffer, to_write, &written);
         if (res != FR_OK || written != to_write) {
@@ -63,7 +70,7 @@ uint32_t sd_benchmark_write(const char* filename, uint32_t size_bytes) {
 
     // end time of write operation
     uint32_t elapsed = HAL_GetTick() - start;
-    printf("Write %lu bytes in %lu ms\r\n", size_bytes, elapsed);
+    printf("Write %lu bytes in %lu ms\r\n", (unsigned long)size_bytes, (unsigned long)elapsed);
     return elapsed;
 }
 
@@ -74,7 +81,8 @@ uint32_t sd_benchmark_write(const char* filename, uint32_t size_bytes) {
 uint32_t sd_benchmark_read(const char* filename, uint32_t size_bytes) {
     FIL file;
     UINT read;
-    uint8_t buffer[BUF_SIZE];
+    uint8_t *buffer = bench_scratch(BUF_SIZE);
+    if (buffer == NULL) return 0;
 
     FRESULT res = f_open(&file, filename, FA_READ);
     if (res != FR_OK) {
@@ -88,7 +96,7 @@ uint32_t sd_benchmark_read(const char* filename, uint32_t size_bytes) {
 
     while (remaining > 0) {
         // break the buffer into particles
-        UINT to_read = (remaining > sizeof(buffer)) ? sizeof(buffer) : remaining;
+        UINT to_read = (remaining > BUF_SIZE) ? BUF_SIZE : remaining;
 
         // read data with DMA
         res = f_read(&file, buffer, to_read, &read);
@@ -103,7 +111,7 @@ uint32_t sd_benchmark_read(const char* filename, uint32_t size_bytes) {
 
     // end time
     uint32_t elapsed = HAL_GetTick() - start;
-    printf("Read %lu bytes in %lu ms\r\n", size_bytes, elapsed);
+    printf("Read %lu bytes in %lu ms\r\n", (unsigned long)size_bytes, (unsigned long)elapsed);
     return elapsed;
 }
 
@@ -116,14 +124,60 @@ void sd_benchmark(void) {
     if (sd_mount() == FR_OK) {
         printf("Starting Benchmark Test\r\n");
 
-        uint32_t w = sd_benchmark_write("bench_11bin", TEST_SIZE);
-        //uint32_t r = sd_benchmark_read("bench_11.bin", TEST_SIZE);
-        uint32_t speed = (((TEST_SIZE * 8) / 1024) / w);
+        sd_benchmark_suite(NULL);
+
+        uint32_t s = sd_benchmark_small_write("bench_small.txt", SMALL_TEST_SIZE, RECORD_SIZE);
+        if (s > 0) printf("Small record write speed: %lu KB/s\r\n", (unsigned long)((SMALL_TEST_SIZE / 1024 * 1000) / s));
+
+        sd_benchmark_pre_erase("bench_erase.bin", TEST_SIZE);
+
+        uint32_t st = sd_benchmark_stream("bench_stream.bin", TEST_SIZE);
+        if (st > 0) printf("Stream write speed: %lu KB/s\r\n", (unsigned long)((TEST_SIZE / 1024 * 1000) / st));
+
+        sd_benchmark_cpu_free("bench_cpu.bin", TEST_SIZE);
+
+        sd_benchmark_unaligned("bench_unaligned.bin", TEST_SIZE);
+
+        sd_benchmark_log("bench_log.txt", LOG_APPENDS);
+
+        sd_benchmark_trace("bench_trace.bin");
+
+        sd_benchmark_fatcache(FATCACHE_FILES);
+
+        sd_benchmark_alloc(ALLOC_HOLES);
+
+        sd_benchmark_boot();
+
+        sd_benchmark_record("bench_record.bin", TEST_SIZE);
+
+        sd_benchmark_seek();
+
+        sd_benchmark_dirindex();
+
+        sd_benchmark_create(CREATE_FILES);
+
+        sd_benchmark_queue("bench_queue.bin", TEST_SIZE);
+
+        sd_benchmark_csv("bench_csv.csv", CSV_FILE_SIZE);
+
+        sd_benchmark_csv_write("bench_csvw.csv", CSV_WRITE_ROWS);
+
+        sd_benchmark_text("bench_text.txt", TEXT_FILE_SIZE);
+
+        sd_benchmark_tslog("bench_ts.tsl", "bench_ts.csv", TSLOG_RECORDS);
 
-        if (w > 0) printf("Write speed: %lu KB/s\r\n", (TEST_SIZE / 1024 * 1000) / w);
-        //if (r > 0) printf("Read  speed: %lu KB/s\r\n", (TEST_SIZE / 1024 * 1000) / r);
-        printf("speed: %lu Mbps/s\r\n", speed);
+        sd_benchmark_pack("bench_pack.bin");
 
         sd_unmount();
     }
+    sd_dlog_dump();
+
+#if !defined(SD_HOST_IMAGE)
+    ConsoleStats con;
+    console_flush(CONSOLE_FLUSH_TIMEOUT_MS);
+    console_get_stats(&con);
+    printf("BENCH_INFO,console,written,%lu,sent,%lu,dropped,%lu,overflows,%lu,high_water,%lu,ring,%u\r\n",
+           (unsigned long)con.written, (unsigned long)con.sent, (unsigned long)con.dropped,
+           (unsigned long)con.overflows, (unsigned long)con.high_water, CONSOLE_BUF_SIZE);
+#endif
 }
@@ -0,0 +1,483 @@
+#include "sd_csv.h"
+#include <string.h>
+
+// SWAR: a byte of w equal to c shows up as 0x80 in CSV_MATCH(w, c), the
+// lowest one is exact (little-endian), bits above it may be false hits
+#define CSV_ONES             0x01010101U
+#define CSV_HIGHS            0x80808080U
+#define CSV_ZERO(v)          (((v) - CSV_ONES) & ~(v) & CSV_HIGHS)
+#define CSV_MATCH(w, c)      CSV_ZERO((w) ^ (CSV_ONES * (uint8_t)(c)))
+
+static inline uint32_t csv_load(const char *p) {
+    uint32_t w;
+    memcpy(&w, p, 4);   // single unaligned LDR on Cortex-M4/M7
+    return w;
+}
+
+/***************************************************************
+ * First ',' or '\n' in [p, end), end when there is none
+ ***************************************************************/
+
+static char *csv_scan_delim(char *p, char *end) {
+    while (p + 4 <= end) {
+        uint32_t w = csv_load(p);
+        uint32_t m = CSV_MATCH(w, ',') | CSV_MATCH(w, '\n');
+        if (m) return p + (__builtin_ctz(m) >> 3);
+        p += 4;
+    }
+    while (p < end && *p != ',' && *p != '\n') p++;
+    return p;
+}
+
+/***************************************************************
+ * First '"' in [p, end), end when there is none
+ ***************************************************************/
+
+static char *csv_scan_quote(char *p, char *end) {
+    while (p + 4 <= end) {
+        uint32_t m = CSV_MATCH(csv_load(p), '"');
+        if (m) return p + (__builtin_ctz(m) >> 3);
+        p += 4;
+    }
+    while (p < end && *p != '"') p++;
+    return p;
+}
+
+/***************************************************************
+ * Remove the quote doubling of an escaped field, in place
+ ***************************************************************/
+
+static void csv_unescape(SdCsvField *field) {
+    char *dst = (char *)field->ptr;
+    const char *src = field->ptr;
+    const char *end = field->ptr + field->len;
+
+    while (src < end) {
+        *dst++ = *src;
+        src += (src[0] == '"' && src + 1 < end && src[1] == '"') ? 2 : 1;
+    }
+    field->len = dst - field->ptr;
+}
+
+/***************************************************************
+ * Split one record starting at p into fields
+ * Returns the start of the next record, or NULL when the record
+ * runs past end and more data is coming (nothing is modified,
+ * the record is parsed again after the next read)
+ * Fields holding "" are flagged in *escaped
+ ***************************************************************/
+
+static char *csv_record(char *p, char *end, int eof, SdCsvField *fields, uint32_t *nfields, uint32_t *escaped) {
+    uint32_t n = 0;
+
+    *escaped = 0;
+    for (;;) {
+        char *start, *stop;
+        uint8_t esc = 0, quoted = 0;
+
+        if (p < end && *p == '"') {
+            quoted = 1;
+            start = p + 1;
+            stop = start;
+            for (;;) {
+                stop = csv_scan_quote(stop, end);
+                if (stop + 1 >= end && !eof) return NULL;   // closing quote or "" not complete yet
+                if (stop + 1 < end && stop[1] == '"') {
+                    esc = 1;
+                    stop += 2;
+                    continue;
+                }
+                break;
+            }
+            // anything between the closing quote and the delimiter is dropped
+            p = csv_scan_delim(stop < end ? stop + 1 : end, end);
+        } else {
+            start = p;
+            p = csv_scan_delim(p, end);
+            stop = p;
+        }
+        if (p >= end && !eof) return NULL;
+
+        if (!quoted && stop > start && stop[-1] == '\r') stop--;
+        if (n < SD_CSV_MAX_FIELDS) {
+            fields[n].ptr = start;
+            fields[n].len = stop - start;
+            if (esc) *escaped |= 1U << n;
+        }
+        n++;
+
+        if (p >= end) break;             // last record without a line end
+        if (*p++ == '\n') break;
+    }
+    *nfields = n;
+    return p;
+}
+
+/***************************************************************
+ * Read an open CSV file from its current position and call fn
+ * for every record
+ * The file is read in chunks straight into buf (sector aligned
+ * file offsets and 4-byte aligned destination, so FatFs reads
+ * whole sectors by DMA into place); the incomplete record at
+ * the end of a chunk is moved to the front before the next read
+ * Empty lines are skipped
+ * records (may be NULL) receives the number of records passed
+ ***************************************************************/
+
+int sd_csv_read_file(FIL *file, uint8_t *buf, uint32_t buf_size,
+                     SdCsvRecordFn fn, void *ctx, uint32_t *records) {
+    UINT br;
+    SdCsvField fields[SD_CSV_MAX_FIELDS];
+    uint32_t off = 0, fill = 0, count = 0, nfields, escaped;
+    int eof = 0, stop = 0;
+    FRESULT res = FR_OK;
+
+    if (records) *records = 0;
+    if (buf_size < 1024 || (buf_size % 512) != 0 || ((uintptr_t)buf & 0x3)) return FR_INVALID_PARAMETER;
+
+    while (!stop && !eof) {
+        // keep the partial record so that the read lands 4-byte aligned
+        uint32_t keep = fill - off;
+        uint32_t pad = (4 - (keep & 3)) & 3;
+        uint32_t room;
+
+        memmove(buf + pad, buf + off, keep);
+        off = pad;
+        fill = pad + keep;
+        room = (buf_size - fill) & ~511U;
+        if (room == 0) {
+            res = FR_DENIED;    // record longer than the buffer
+            break;
+        }
+
+        res = f_read(file, buf + fill, room, &br);
+        if (res != FR_OK) break;
+        fill += br;
+        if (br < room) eof = 1;
+
+        char *p = (char *)buf + off;
+        char *end = (char *)buf + fill;
+        while (p < end) {
+            char *next = csv_record(p, end, eof, fields, &nfields, &escaped);
+            if (next == NULL) break;
+            p = next;
+
+            if (nfields == 1 && fields[0].len == 0) continue;
+            if (nfields > SD_CSV_MAX_FIELDS) nfields = SD_CSV_MAX_FIELDS;
+            for (uint32_t i = 0; escaped != 0; i++, escaped >>= 1) {
+                if (escaped & 1) csv_unescape(&fields[i]);
+            }
+            count++;
+            if (fn(fields, nfields, ctx) != 0) {
+                stop = 1;
+                break;
+            }
+        }
+        off = p - (char *)buf;
+    }
+
+    if (records) *records = count;
+    return res;
+}
+
+/***************************************************************
+ * Open filename and read it with sd_csv_read_file
+ ***************************************************************/
+
+int sd_csv_read(const char *filename, uint8_t *buf, uint32_t buf_size,
+                SdCsvRecordFn fn, void *ctx, uint32_t *records) {
+    FIL file;
+
+    if (records) *records = 0;
+    FRESULT res = f_open(&file, filename, FA_READ);
+    if (res != FR_OK) return res;
+
+    res = sd_csv_read_file(&file, buf, buf_size, fn, ctx, records);
+    f_close(&file);
+    return res;
+}
+
+/***************************************************************
+ * Field helpers: decimal value (leading spaces and sign allowed,
+ * stops at the first non digit) and NUL-terminated copy
+ * (truncated to dst_size - 1, returns the length copied)
+ ***************************************************************/
+
+int32_t sd_csv_to_int(const SdCsvField *field) {
+    const char *p = field->ptr;
+    const char *end = field->ptr + field->len;
+    uint32_t v = 0;
+    int neg = 0;
+
+    while (p < end && *p == ' ') p++;
+    if (p < end && (*p == '-' || *p == '+')) neg = (*p++ == '-');
+    while (p < end && (uint8_t)(*p - '0') < 10) {
+        v = v * 10 + (uint8_t)(*p++ - '0');
+    }
+    return neg ? -(int32_t)v : (int32_t)v;
+}
+
+uint32_t sd_csv_copy(const SdCsvField *field, char *dst, uint32_t dst_size) {
+    uint32_t n = (field->len < dst_size - 1) ? field->len : dst_size - 1;
+
+    memcpy(dst, field->ptr, n);
+    dst[n] = '\0';
+    return n;
+}
+
+/***************************************************************
+ * Row writer
+ ***************************************************************/
+
+#define CSV_NUM_MAX          24     // longest number field, with ','
+
+static const char csv_digits[201] =
+    "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+    "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+static const uint32_t csv_pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+
+// Exponent form of floats from 4e9 up to FLT_MAX (3.4e38)
+static const float csv_exp10[] = {
+    1e0f,  1e1f,  1e2f,  1e3f,  1e4f,  1e5f,  1e6f,  1e7f,  1e8f,  1e9f,
+    1e10f, 1e11f, 1e12f, 1e13f, 1e14f, 1e15f, 1e16f, 1e17f, 1e18f, 1e19f,
+    1e20f, 1e21f, 1e22f, 1e23f, 1e24f, 1e25f, 1e26f, 1e27f, 1e28f, 1e29f,
+    1e30f
+};
+
+int sd_csv_writer_open(SdCsvWriter *w, const char *filename, uint8_t *buf, uint32_t buf_size) {
+    if (buf_size < 1024 || (buf_size % 512) != 0 || ((uintptr_t)buf & 0x3)) return FR_INVALID_PARAMETER;
+
+    memset(w, 0, sizeof(*w));
+    w->buf = buf;
+    w->buf_size = buf_size;
+    w->res = f_open(&w->file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    return w->res;
+}
+
+/***************************************************************
+ * Make room for len more bytes (len <= buf_size - 512)
+ * Writes the whole sectors held in buf and moves the last
+ * partial sector to the front, so the file only ever sees
+ * sector-aligned writes of whole sectors
+ ***************************************************************/
+
+static int csv_reserve(SdCsvWriter *w, uint32_t len) {
+    uint32_t whole;
+    UINT bw;
+
+    if (w->res != FR_OK) return w->res;
+    if (w->fill + len <= w->buf_size) return FR_OK;
+
+    whole = w->fill & ~511U;
+    w->res = f_write(&w->file, w->buf, whole, &bw);
+    if (w->res == FR_OK && bw < whole) w->res = FR_DENIED;     // volume full
+    if (w->res != FR_OK) return w->res;
+    w->bytes += bw;
+
+    w->fill -= whole;
+    memcpy(w->buf, w->buf + whole, w->fill);
+    return FR_OK;
+}
+
+// Digits of v, written backwards two at a time; returns the count
+static uint32_t csv_utoa(char *dst, uint32_t v) {
+    char tmp[10];
+    char *p = tmp + sizeof(tmp);
+    uint32_t n;
+
+    while (v >= 100) {
+        uint32_t q = v / 100;
+        p -= 2;
+        memcpy(p, &csv_digits[(v - q * 100) * 2], 2);
+        v = q;
+    }
+    if (v >= 10) {
+        p -= 2;
+        memcpy(p, &csv_digits[v * 2], 2);
+    } else {
+        *--p = (char)('0' + v);
+    }
+    n = tmp + sizeof(tmp) - p;
+    memcpy(dst, p, n);
+    return n;
+}
+
+// Field separator into the reserved room
+static inline char *csv_field(SdCsvWriter *w) {
+    char *p = (char *)w->buf + w->fill;
+
+    if (w->nfields++ > 0) *p++ = ',';
+    return p;
+}
+
+// Integer part, '.' and frac zero-padded to decimals digits
+static char *csv_fixed(char *p, uint32_t ipart, uint32_t frac, uint8_t decimals) {
+    p += csv_utoa(p, ipart);
+    if (decimals > 0) {
+        char *q = p + decimals;
+
+        *p = '.';
+        for (char *d = q; d > p; d--) {
+            *d = (char)('0' + frac % 10);
+            frac /= 10;
+        }
+        p = q + 1;
+    }
+    return p;
+}
+
+int sd_csv_put_uint(SdCsvWriter *w, uint32_t v) {
+    char *p;
+
+    if (csv_reserve(w, CSV_NUM_MAX) != FR_OK) return w->res;
+    p = csv_field(w);
+    p += csv_utoa(p, v);
+    w->fill = (uint8_t *)p - w->buf;
+    return FR_OK;
+}
+
+int sd_csv_put_int(SdCsvWriter *w, int32_t v) {
+    char *p;
+
+    if (csv_reserve(w, CSV_NUM_MAX) != FR_OK) return w->res;
+    p = csv_field(w);
+    if (v < 0) *p++ = '-';
+    p += csv_utoa(p, v < 0 ? 0U - (uint32_t)v : (uint32_t)v);
+    w->fill = (uint8_t *)p - w->buf;
+    return FR_OK;
+}
+
+int sd_csv_put_fixed(SdCsvWriter *w, int32_t v, uint8_t decimals) {
+    uint32_t u = v < 0 ? 0U - (uint32_t)v : (uint32_t)v;
+    char *p;
+
+    if (decimals > 6) return FR_INVALID_PARAMETER;
+    if (csv_reserve(w, CSV_NUM_MAX) != FR_OK) return w->res;
+    p = csv_field(w);
+    if (v < 0) *p++ = '-';
+    p = csv_fixed(p, u / csv_pow10[decimals], u % csv_pow10[decimals], decimals);
+    w->fill = (uint8_t *)p - w->buf;
+    return FR_OK;
+}
+
+int sd_csv_put_float(SdCsvWriter *w, float v, uint8_t decimals) {
+    float a = (v < 0.0f) ? -v : v;
+    char *p;
+
+    if (decimals > 6) return FR_INVALID_PARAMETER;
+    if (csv_reserve(w, CSV_NUM_MAX) != FR_OK) return w->res;
+    p = csv_field(w);
+
+    if (v != v || a > 3.4028235e38f) {
+        if (v != v) {
+            memcpy(p, "nan", 3);
+        } else {
+            if (v < 0.0f) *p++ = '-';
+            memcpy(p, "inf", 3);
+        }
+        w->fill = (uint8_t *)p + 3 - w->buf;
+        return FR_OK;
+    }
+
+    // single precision FPU: integer and fraction apart (a - ipart is
+    // exact), so only the fraction is scaled and rounded
+    if (a < 4.0e9f) {
+        uint32_t ipart = (uint32_t)a;
+        uint32_t frac = (uint32_t)((a - (float)ipart) * (float)csv_pow10[decimals] + 0.5f);
+
+        if (frac >= csv_pow10[decimals]) {
+            ipart++;
+            frac -= csv_pow10[decimals];
+        }
+        if (v < 0.0f && (ipart | frac) != 0) *p++ = '-';
+        p = csv_fixed(p, ipart, frac, decimals);
+    } else {
+        // float holds 7-8 significant digits: print 9 and an exponent
+        uint32_t e = 1;
+
+        if (v < 0.0f) *p++ = '-';
+        while (a >= 1.0e9f * csv_exp10[e]) e++;
+        p += csv_utoa(p, (uint32_t)(a / csv_exp10[e] + 0.5f));   // one rounding
+        *p++ = 'e';
+        p += csv_utoa(p, e);
+    }
+    w->fill = (uint8_t *)p - w->buf;
+    return FR_OK;
+}
+
+/***************************************************************
+ * String field, quoted (with "" for ") only when it holds a
+ * delimiter, a quote or a line break
+ ***************************************************************/
+
+int sd_csv_put_str(SdCsvWriter *w, const char *str) {
+    uint32_t len = strlen(str);
+    uint32_t max = w->buf_size - 512;
+    const char *q = NULL;
+
+    for (const char *s = str; *s != '\0'; s++) {
+        if (*s == ',' || *s == '"' || *s == '\n' || *s == '\r') {
+            q = s;
+            break;
+        }
+    }
+
+    if (csv_reserve(w, 1) != FR_OK) return w->res;
+    if (w->nfields++ > 0) w->buf[w->fill++] = ',';
+
+    if (q == NULL) {
+        // plain: copy in pieces the buffer can take
+        while (len > 0) {
+            uint32_t n = len < max ? len : max;
+            if (csv_reserve(w, n) != FR_OK) return w->res;
+            memcpy(w->buf + w->fill, str, n);
+            w->fill += n;
+            str += n;
+            len -= n;
+        }
+        return FR_OK;
+    }
+
+    if (csv_reserve(w, 1) != FR_OK) return w->res;
+    w->buf[w->fill++] = '"';
+    for (; *str != '\0'; str++) {
+        if (csv_reserve(w, 2) != FR_OK) return w->res;
+        if (*str == '"') w->buf[w->fill++] = '"';
+        w->buf[w->fill++] = *str;
+    }
+    if (csv_reserve(w, 1) != FR_OK) return w->res;
+    w->buf[w->fill++] = '"';
+    return FR_OK;
+}
+
+int sd_csv_end_row(SdCsvWriter *w) {
+    if (csv_reserve(w, 2) != FR_OK) return w->res;
+    w->buf[w->fill++] = '\r';
+    w->buf[w->fill++] = '\n';
+    w->nfields = 0;
+    w->rows++;
+    return FR_OK;
+}
+
+/***************************************************************
+ * Write the rest of buf (the one partial sector write) and
+ * close the file
+ ***************************************************************/
+
+int sd_csv_writer_close(SdCsvWriter *w) {
+    FRESULT res = w->res;
+    UINT bw;
+
+    if (res == FR_OK && w->fill > 0) {
+        res = f_write(&w->file, w->buf, w->fill, &bw);
+        if (res == FR_OK && bw < w->fill) res = FR_DENIED;
+        if (res == FR_OK) w->bytes += bw;
+        w->fill = 0;
+    }
+    FRESULT res_close = f_close(&w->file);
+
+    w->res = (res != FR_OK) ? res : res_close;
+    return w->res;
+}
@@ -0,0 +1,157 @@
+#include "sd_dlog.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#if defined(SD_HOST_IMAGE)
+#include "sd_diskio.h"
+#else
+#include "main.h"
+#include "console.h"
+#endif
+
+#if SD_DLOG_LEVEL > 0
+
+#define SD_DLOG_FORMAT(id, fmt)  fmt,
+static const char *const formats[SD_MSG_COUNT] = {
+    NULL,
+    SD_DLOG_MESSAGES(SD_DLOG_FORMAT)
+};
+#undef SD_DLOG_FORMAT
+
+static SdDlogRecord ring[SD_DLOG_DEPTH];
+static volatile uint32_t head;      // records ever claimed, slot = head % depth
+static uint32_t dumped;             // records already printed
+
+static inline uint32_t sd_dlog_now(void) {
+#if defined(SD_HOST_IMAGE)
+    return (uint32_t)(SD_Host_GetTimeUs() / 1000);
+#else
+    return HAL_GetTick();
+#endif
+}
+
+/***************************************************************
+ * Record one message, lock-free like sd_trace: the slot is
+ * claimed with LDREX/STREX so an ISR can log too. The oldest
+ * records are overwritten.
+ * The format string is only scanned for its conversions to
+ * know which arguments are strings, nothing is formatted
+ ***************************************************************/
+
+void sd_dlog(uint8_t level, uint16_t id, ...) {
+    uint32_t idx, v;
+    SdDlogRecord *rec;
+    const char *f;
+    uint8_t *p, *end;
+    va_list ap;
+
+    if (id == SD_MSG_NONE || id >= SD_MSG_COUNT) return;
+
+#if defined(SD_HOST_IMAGE)
+    idx = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+#else
+    do {
+        idx = __LDREXW(&head);
+    } while (__STREXW(idx + 1, &head));
+#endif
+
+    rec = &ring[idx & (SD_DLOG_DEPTH - 1)];
+    rec->tick = sd_dlog_now();
+    rec->id = id;
+    rec->level = level;
+    rec->truncated = 0;
+    p = rec->data;
+    end = rec->data + sizeof(rec->data);
+
+    va_start(ap, id);
+    for (f = formats[id]; (f = strchr(f, '%')) != NULL; ) {
+        uint8_t is_long = 0;
+
+        f++;
+        if (*f == '%') {
+            f++;
+            continue;
+        }
+        while (*f != '\0' && strchr("-+ #0123456789.hlz", *f) != NULL) {
+            if (*f == 'l') is_long = 1;
+            f++;
+        }
+        if (*f == '\0') break;
+
+        if (*f == 's') {
+            const char *s = va_arg(ap, const char *);
+            uint32_t len = strlen(s);
+
+            if (p + len + 1 > end) {
+                len = (p < end) ? end - p - 1 : 0;
+                rec->truncated = 1;
+            }
+            if (p < end) {
+                memcpy(p, s, len);
+                p[len] = '\0';
+                p += (len + 1 + 3) & ~3U;
+            }
+        } else {
+            v = is_long ? (uint32_t)va_arg(ap, unsigned long) : (uint32_t)va_arg(ap, unsigned int);
+            if (p + 4 <= end) {
+                memcpy(p, &v, 4);
+                p += 4;
+            } else {
+                rec->truncated = 1;
+            }
+        }
+        f++;
+    }
+    va_end(ap);
+}
+
+#endif
+
+void sd_dlog_reset(void) {
+#if SD_DLOG_LEVEL > 0
+    head = 0;
+    dumped = 0;
+    memset(ring, 0, sizeof(ring));
+#endif
+}
+
+/***************************************************************
+ * Print the records logged since the last dump for
+ * tools/sd_dlog_decode.py:
+ * DLOG_BEGIN,records,lost
+ * DLOG,tick,id,level,truncated,data   (hex, oldest first,
+ *                                      data as 10 words)
+ * DLOG_END
+ ***************************************************************/
+
+void sd_dlog_dump(void) {
+#if SD_DLOG_LEVEL > 0
+    uint32_t end = head;
+    uint32_t n = end - dumped;
+    uint32_t lost = 0;
+
+    if (n > SD_DLOG_DEPTH) {
+        lost = n - SD_DLOG_DEPTH;
+        n = SD_DLOG_DEPTH;
+    }
+
+    printf("DLOG_BEGIN,%lu,%lu\r\n", (unsigned long)n, (unsigned long)lost);
+    for (uint32_t i = 0; i < n; i++) {
+        const SdDlogRecord *rec = &ring[(end - n + i) & (SD_DLOG_DEPTH - 1)];
+        uint32_t w[sizeof(rec->data) / 4];
+
+        memcpy(w, rec->data, sizeof(w));
+        printf("DLOG,%08lx,%u,%u,%u,%08lx%08lx%08lx%08lx%08lx%08lx%08lx%08lx%08lx%08lx\r\n",
+               (unsigned long)rec->tick, rec->id, rec->level, rec->truncated,
+               (unsigned long)w[0], (unsigned long)w[1], (unsigned long)w[2], (unsigned long)w[3],
+               (unsigned long)w[4], (unsigned long)w[5], (unsigned long)w[6], (unsigned long)w[7],
+               (unsigned long)w[8], (unsigned long)w[9]);
+#if !defined(SD_HOST_IMAGE)
+        // the dump is larger than the console ring: let it drain
+        if ((i & 15) == 15) console_flush(CONSOLE_FLUSH_TIMEOUT_MS);
+#endif
+    }
+    printf("DLOG_END\r\n");
+    dumped = end;
+#endif
+}
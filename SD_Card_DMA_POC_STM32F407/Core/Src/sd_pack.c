@@ -0,0 +1,243 @@
+#include "sd_pack.h"
+#include <string.h>
+#if !defined(SD_HOST_IMAGE)
+#include "main.h"
+#endif
+
+#define LZ4_MIN_MATCH        4
+#define LZ4_LAST_LITERALS    5      // the block ends with at least 5 literals
+#define LZ4_MF_LIMIT         12     // no match starts in the last 12 bytes
+#define LZ4_SKIP_TRIGGER     6      // misses before the search step grows
+
+static inline uint32_t pack_load(const uint8_t *p) {
+    uint32_t w;
+    memcpy(&w, p, 4);   // single unaligned LDR on Cortex-M4/M7
+    return w;
+}
+
+static inline uint32_t pack_hash(uint32_t seq) {
+    return (seq * 2654435761U) >> (32 - SD_PACK_HASH_LOG);
+}
+
+static inline uint32_t pack_now(void) {
+#if defined(SD_HOST_IMAGE)
+    return 0;
+#else
+    return DWT->CYCCNT;
+#endif
+}
+
+void sd_pack_init(SdPack *p, uint8_t delta) {
+    memset(p, 0, sizeof(*p));
+    p->delta = delta;
+}
+
+/***************************************************************
+ * LZ4 length field continuation: 255 per byte, then the rest
+ ***************************************************************/
+
+static uint8_t *pack_length(uint8_t *op, uint32_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+/***************************************************************
+ * Compress src into LZ4 sequences at dst
+ * Greedy single-probe search: one hash table lookup per
+ * position, matches extended a word at a time, the search step
+ * grows over data that does not match (as in LZ4 fast)
+ * Returns the packed size, 0 when it does not fit in cap
+ ***************************************************************/
+
+static uint32_t pack_lz4(SdPack *p, const uint8_t *src, uint32_t len, uint8_t *dst, uint32_t cap) {
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + len;
+    const uint8_t *mflimit = end - LZ4_MF_LIMIT;
+    const uint8_t *matchlimit = end - LZ4_LAST_LITERALS;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + cap;
+    uint32_t lit;
+
+    memset(p->table, 0, sizeof(p->table));
+
+    if (len > LZ4_MF_LIMIT) {
+        uint32_t misses = 1U << LZ4_SKIP_TRIGGER;
+
+        ip++;
+        while (ip < mflimit) {
+            uint32_t seq = pack_load(ip);
+            uint32_t h = pack_hash(seq);
+            const uint8_t *ref = src + p->table[h];
+            const uint8_t *mp, *mr;
+            uint8_t *token;
+            uint32_t mlen;
+
+            p->table[h] = (uint16_t)(ip - src);
+            if (ref >= ip || pack_load(ref) != seq) {
+                ip += misses++ >> LZ4_SKIP_TRIGGER;
+                continue;
+            }
+            misses = 1U << LZ4_SKIP_TRIGGER;
+
+            // extend backwards into the pending literals, then forwards
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+            mp = ip + LZ4_MIN_MATCH;
+            mr = ref + LZ4_MIN_MATCH;
+            while (mp + 4 <= matchlimit) {
+                uint32_t diff = pack_load(mp) ^ pack_load(mr);
+                if (diff) {
+                    mp += __builtin_ctz(diff) >> 3;
+                    goto extended;
+                }
+                mp += 4;
+                mr += 4;
+            }
+            while (mp < matchlimit && *mp == *mr) {
+                mp++;
+                mr++;
+            }
+extended:
+            lit = ip - anchor;
+            mlen = mp - ip - LZ4_MIN_MATCH;
+            if (op + 1 + lit / 255 + 1 + lit + 2 + mlen / 255 + 1 > oend) return 0;
+
+            token = op++;
+            *token = (uint8_t)(((lit < 15) ? lit : 15) << 4);
+            if (lit >= 15) op = pack_length(op, lit - 15);
+            memcpy(op, anchor, lit);
+            op += lit;
+
+            *op++ = (uint8_t)(ip - ref);
+            *op++ = (uint8_t)((ip - ref) >> 8);
+            *token |= (uint8_t)((mlen < 15) ? mlen : 15);
+            if (mlen >= 15) op = pack_length(op, mlen - 15);
+
+            ip = anchor = mp;
+            if (ip < mflimit) p->table[pack_hash(pack_load(ip - 2))] = (uint16_t)(ip - 2 - src);
+        }
+    }
+
+    // last literals
+    lit = end - anchor;
+    if (op + 1 + lit / 255 + 1 + lit > oend) return 0;
+    *op++ = (uint8_t)(((lit < 15) ? lit : 15) << 4);
+    if (lit >= 15) op = pack_length(op, lit - 15);
+    memcpy(op, anchor, lit);
+    op += lit;
+    return op - dst;
+}
+
+/***************************************************************
+ * Pack one block into a frame, see sd_pack.h
+ * The delta filter runs backwards in place so the bytes it
+ * reads are still the raw ones
+ ***************************************************************/
+
+uint32_t sd_pack_block(SdPack *p, uint8_t *src, uint32_t len, uint8_t *dst, uint32_t dst_size) {
+    SdPackHeader hdr = { SD_PACK_MAGIC, len, 0, SD_PACK_LZ4, p->delta, 0 };
+    uint32_t start = pack_now();
+    uint32_t room, n = 0;
+
+    if (len == 0 || len > SD_PACK_MAX_BLOCK || dst_size < sizeof(hdr)) return 0;
+    room = dst_size - sizeof(hdr);
+
+    if (p->delta > 0) {
+        for (uint32_t i = len - 1; i >= p->delta; i--) src[i] -= src[i - p->delta];
+    }
+
+    // worth packing only if it saves something
+    if (len > 1) n = pack_lz4(p, src, len, dst + sizeof(hdr), (room < len - 1) ? room : len - 1);
+    if (n == 0) {
+        if (room < len) return 0;
+        memcpy(dst + sizeof(hdr), src, len);
+        n = len;
+        hdr.method = SD_PACK_STORED;
+        p->stored++;
+    }
+    hdr.packed_size = n;
+    memcpy(dst, &hdr, sizeof(hdr));
+
+    p->blocks++;
+    p->raw_bytes += len;
+    p->packed_bytes += sizeof(hdr) + n;
+    p->cycles += pack_now() - start;
+    return sizeof(hdr) + n;
+}
+
+/***************************************************************
+ * Unpack one frame, every length checked against both buffers
+ ***************************************************************/
+
+uint32_t sd_unpack_block(const uint8_t *frame, uint32_t frame_len, uint8_t *dst, uint32_t dst_size) {
+    SdPackHeader hdr;
+    const uint8_t *ip, *iend;
+    uint8_t *op = dst;
+    uint8_t *oend;
+
+    if (frame_len < sizeof(hdr)) return 0;
+    memcpy(&hdr, frame, sizeof(hdr));
+    if (hdr.magic != SD_PACK_MAGIC || hdr.packed_size > frame_len - sizeof(hdr)
+            || hdr.raw_size > dst_size || hdr.raw_size > SD_PACK_MAX_BLOCK) return 0;
+    ip = frame + sizeof(hdr);
+    iend = ip + hdr.packed_size;
+    oend = dst + hdr.raw_size;
+
+    if (hdr.method == SD_PACK_STORED) {
+        if (hdr.packed_size != hdr.raw_size) return 0;
+        memcpy(dst, ip, hdr.raw_size);
+        op = oend;
+    } else if (hdr.method == SD_PACK_LZ4) {
+        while (ip < iend) {
+            uint32_t token = *ip++;
+            uint32_t lit = token >> 4;
+            uint32_t mlen = token & 15;
+            uint32_t off;
+
+            if (lit == 15) {
+                uint32_t b;
+                do {
+                    if (ip >= iend) return 0;
+                    b = *ip++;
+                    lit += b;
+                } while (b == 255);
+            }
+            if (lit > (uint32_t)(iend - ip) || lit > (uint32_t)(oend - op)) return 0;
+            memcpy(op, ip, lit);
+            op += lit;
+            ip += lit;
+            if (ip == iend) break;      // last sequence: literals only
+
+            if (iend - ip < 2) return 0;
+            off = ip[0] | (ip[1] << 8);
+            ip += 2;
+            if (off == 0 || off > (uint32_t)(op - dst)) return 0;
+            if (mlen == 15) {
+                uint32_t b;
+                do {
+                    if (ip >= iend) return 0;
+                    b = *ip++;
+                    mlen += b;
+                } while (b == 255);
+            }
+            mlen += LZ4_MIN_MATCH;
+            if (mlen > (uint32_t)(oend - op)) return 0;
+            for (const uint8_t *ref = op - off; mlen > 0; mlen--) *op++ = *ref++;   // may overlap
+        }
+    } else {
+        return 0;
+    }
+    if (op != oend) return 0;
+
+    if (hdr.delta > 0) {
+        for (uint32_t i = hdr.delta; i < hdr.raw_size; i++) dst[i] += dst[i - hdr.delta];
+    }
+    return hdr.raw_size;
+}
@@ -0,0 +1,222 @@
+#include "sd_queue.h"
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+
+// Record header, one word in front of every payload
+#define SD_QUEUE_LEN_MASK    0x0000FFFFU   // payload bytes
+#define SD_QUEUE_PAD         0x40000000U   // filler up to the end of the ring
+#define SD_QUEUE_COMMIT      0x80000000U   // payload complete
+
+#define SD_QUEUE_ALIGN(n)    (((n) + 3U) & ~3U)
+
+// Record length in front of every payload in the file
+#define SD_QUEUE_LEN_SIZE    2U
+
+/***************************************************************
+ * Atomic add and maximum on a counter shared by producers
+ * An interrupt between LDREX and STREX clears the monitor, the
+ * STREX fails and the loop retries with the new value
+ ***************************************************************/
+
+static void sd_queue_add(volatile uint32_t *p, uint32_t v) {
+    do {
+        uint32_t old = __LDREXW(p);
+        if (__STREXW(old + v, p) == 0) return;
+    } while (1);
+}
+
+static void sd_queue_max(volatile uint32_t *p, uint32_t v) {
+    do {
+        if (__LDREXW(p) >= v) {
+            __CLREX();
+            return;
+        }
+    } while (__STREXW(v, p) != 0);
+}
+
+/***************************************************************
+ * Write the chunk to the file
+ * Sectors are written whole: a partial last sector stays at the
+ * start of the chunk and the file position goes back to it, so
+ * the next f_write is sector aligned again
+ ***************************************************************/
+
+static int sd_queue_write_chunk(SdQueue *q) {
+    UINT bw;
+    uint32_t keep = q->chunk_fill % 512;
+
+    FRESULT res = f_write(&q->file, q->chunk, q->chunk_fill, &bw);
+    if (res != FR_OK || bw != q->chunk_fill) {
+        printf("f_write error\r\n");
+        return (res != FR_OK) ? res : FR_DENIED;
+    }
+
+    if (keep > 0) {
+        res = f_lseek(&q->file, f_tell(&q->file) - keep);
+        if (res != FR_OK) return res;
+        memmove(q->chunk, q->chunk + q->chunk_fill - keep, keep);
+    }
+    q->chunk_fill = keep;
+    return FR_OK;
+}
+
+/***************************************************************
+ * Open a record queue on a new file
+ * ring_size must be a power of two, chunk_size a multiple of 512
+ * and both buffers 4-byte aligned
+ ***************************************************************/
+
+int sd_queue_open(SdQueue *q, const char *filename, uint8_t *ring, uint32_t ring_size,
+                  uint8_t *chunk, uint32_t chunk_size) {
+    if (ring_size < 16 || (ring_size & (ring_size - 1)) || ((uintptr_t)ring & 0x3)) return FR_INVALID_PARAMETER;
+    if (chunk_size == 0 || (chunk_size % 512) != 0 || ((uintptr_t)chunk & 0x3)) return FR_INVALID_PARAMETER;
+
+    memset(q, 0, sizeof(*q));
+    memset(ring, 0, ring_size);   // every header starts uncommitted
+    q->ring = ring;
+    q->size = ring_size;
+    q->chunk = chunk;
+    q->chunk_size = chunk_size;
+
+    FRESULT res = f_open(&q->file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        printf("f_open failed: %d\r\n", res);
+        return res;
+    }
+    return FR_OK;
+}
+
+/***************************************************************
+ * Queue one record of len bytes
+ * Constant time, no lock: the space is reserved by moving head
+ * with LDREX/STREX, then the payload is copied and committed
+ * Safe from any number of ISRs and the main loop at once
+ * Returns 1 when queued, 0 when dropped because the ring is full
+ ***************************************************************/
+
+int sd_queue_push(SdQueue *q, const void *data, uint32_t len) {
+    uint32_t need = 4 + SD_QUEUE_ALIGN(len);
+    uint32_t head, pos, pad, used;
+
+    if (len == 0 || len > SD_QUEUE_MAX_RECORD || need > q->size) return 0;
+
+    do {
+        head = __LDREXW(&q->head);
+        pos = head & (q->size - 1);
+        pad = (pos + need > q->size) ? q->size - pos : 0;   // record never wraps
+        used = head + pad + need - q->tail;
+        if (used > q->size) {
+            __CLREX();
+            sd_queue_add(&q->dropped, 1);
+            sd_queue_add(&q->dropped_bytes, len);
+            return 0;
+        }
+    } while (__STREXW(head + pad + need, &q->head) != 0);
+
+    sd_queue_max(&q->high_water, used);
+
+    if (pad > 0) {
+        *(volatile uint32_t *)(q->ring + pos) = SD_QUEUE_COMMIT | SD_QUEUE_PAD | (pad - 4);
+        pos = 0;
+    }
+    memcpy(q->ring + pos + 4, data, len);
+    __DMB(); // payload visible before the header commits it
+    *(volatile uint32_t *)(q->ring + pos) = SD_QUEUE_COMMIT | len;
+    return 1;
+}
+
+/***************************************************************
+ * Writer side: move committed records into the chunk and write
+ * every full chunk to the card
+ * Each record goes to the file as a 2-byte little-endian length
+ * and its payload, so records of any size can be split again
+ * Stops at the first record a producer is still copying
+ * After a failed write the record stays in the ring and the
+ * bytes already in the chunk stay counted in rec_done: the next
+ * call writes the chunk again and goes on, nothing is doubled
+ ***************************************************************/
+
+int sd_queue_service(SdQueue *q) {
+    FRESULT res = FR_OK;
+    uint32_t tail = q->tail;
+
+    while (tail != q->head) {
+        uint32_t pos = tail & (q->size - 1);
+        uint32_t hdr = *(volatile uint32_t *)(q->ring + pos);
+        if (!(hdr & SD_QUEUE_COMMIT)) break;
+        __DMB(); // header read before the payload
+
+        uint32_t len = hdr & SD_QUEUE_LEN_MASK;
+        uint32_t rlen = 4 + SD_QUEUE_ALIGN(len);
+
+        if (!(hdr & SD_QUEUE_PAD)) {
+            const uint8_t *src = q->ring + pos + 4;
+            uint32_t total = SD_QUEUE_LEN_SIZE + len;
+
+            while (q->rec_done < total) {
+                if (q->chunk_fill == q->chunk_size) {
+                    res = sd_queue_write_chunk(q);
+                    if (res != FR_OK) return res;
+                }
+                if (q->rec_done < SD_QUEUE_LEN_SIZE) {
+                    q->chunk[q->chunk_fill++] = (uint8_t)(len >> (8 * q->rec_done));
+                    q->rec_done++;
+                    continue;
+                }
+                uint32_t room = q->chunk_size - q->chunk_fill;
+                uint32_t n = (total - q->rec_done < room) ? total - q->rec_done : room;
+
+                memcpy(q->chunk + q->chunk_fill, src + q->rec_done - SD_QUEUE_LEN_SIZE, n);
+                q->chunk_fill += n;
+                q->rec_done += n;
+            }
+            if (q->chunk_fill == q->chunk_size) {
+                res = sd_queue_write_chunk(q);
+                if (res != FR_OK) return res;
+            }
+            q->rec_done = 0;
+            q->records++;
+            q->bytes += len;
+        }
+
+        // a later header may land anywhere in these bytes
+        memset(q->ring + pos, 0, rlen);
+        __DMB(); // cleared before the space is released
+        tail += rlen;
+        q->tail = tail;
+    }
+    return res;
+}
+
+/***************************************************************
+ * Write everything queued so far, the partial chunk too, and
+ * sync the file
+ ***************************************************************/
+
+int sd_queue_flush(SdQueue *q) {
+    FRESULT res = sd_queue_service(q);
+    if (res != FR_OK) return res;
+
+    if (q->chunk_fill > 0) {
+        res = sd_queue_write_chunk(q);
+        if (res != FR_OK) return res;
+    }
+    return f_sync(&q->file);
+}
+
+/***************************************************************
+ * Flush and close the queue
+ * Prints the amount written, the drop count and the ring
+ * high-watermark used to size the ring
+ ***************************************************************/
+
+int sd_queue_close(SdQueue *q) {
+    FRESULT res = sd_queue_flush(q);
+    FRESULT res_close = f_close(&q->file);
+
+    printf("Queue closed: %lu records, %lu bytes, %lu dropped (%lu bytes), max %lu/%lu ring bytes\r\n",
+           (unsigned long)q->records, (unsigned long)q->bytes, (unsigned long)q->dropped,
+           (unsigned long)q->dropped_bytes, (unsigned long)q->high_water, (unsigned long)q->size);
+    return (res != FR_OK) ? res : res_close;
+}
@@ -0,0 +1,281 @@
+#include "sd_stream.h"
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+
+/***************************************************************
+ * Hand the buffer being filled over to the writer
+ * Returns 0 when every buffer is waiting for the card
+ ***************************************************************/
+
+static int sd_stream_handover(SdStream *s) {
+    uint32_t pending;
+
+    if (s->fill > 0) {
+        s->used[s->filled % s->nbufs] = s->fill;
+        __DMB(); // buffer content and size visible before the count
+        s->filled++;
+        s->fill = 0;
+
+        pending = s->filled - s->drained;
+        if (pending > s->max_pending) s->max_pending = pending;
+    }
+    return (s->filled - s->drained) < s->nbufs;
+}
+
+/***************************************************************
+ * Open a streaming writer on a new file
+ * pool must hold nbufs * buf_size bytes, 4-byte aligned,
+ * buf_size a multiple of 512 so every f_write is sector aligned
+ * and goes straight from the buffer to the card by DMA
+ ***************************************************************/
+
+int sd_stream_open(SdStream *s, const char *filename, uint8_t *pool, uint32_t buf_size, uint8_t nbufs) {
+    if (nbufs < 2 || nbufs > SD_STREAM_MAX_BUFS) return FR_INVALID_PARAMETER;
+    if (buf_size == 0 || (buf_size % 512) != 0 || ((uintptr_t)pool & 0x3)) return FR_INVALID_PARAMETER;
+
+    memset(s, 0, sizeof(*s));
+    for (uint8_t i = 0; i < nbufs; i++) {
+        s->buf[i] = pool + i * buf_size;
+    }
+    s->buf_size = buf_size;
+    s->nbufs = nbufs;
+
+    FRESULT res = f_open(&s->file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        printf("f_open failed: %d\r\n", res);
+        return res;
+    }
+    return FR_OK;
+}
+
+/***************************************************************
+ * Reserve len contiguous bytes in the buffer being filled
+ * Safe to call from one ISR or the main loop (single producer)
+ * Returns NULL and counts an overrun when all buffers are full
+ * A record that does not fit closes the current buffer early
+ ***************************************************************/
+
+uint8_t *sd_stream_acquire(SdStream *s, uint32_t len) {
+    if (len == 0 || len > s->buf_size) return NULL;
+
+    if ((s->filled - s->drained) >= s->nbufs) {
+        s->overruns++;
+        return NULL;
+    }
+
+    if (s->fill + len > s->buf_size && !sd_stream_handover(s)) {
+        s->overruns++;
+        return NULL;
+    }
+
+    return s->buf[s->filled % s->nbufs] + s->fill;
+}
+
+/***************************************************************
+ * Publish len bytes written through sd_stream_acquire
+ * A full buffer is handed to the writer right away
+ ***************************************************************/
+
+void sd_stream_commit(SdStream *s, uint32_t len) {
+    s->fill += len;
+    if (s->fill >= s->buf_size) {
+        sd_stream_handover(s);
+    }
+}
+
+/***************************************************************
+ * Copy data into the stream, spanning buffers as needed so the
+ * file stays sector aligned
+ * Returns the number of bytes accepted (less than len on overrun)
+ ***************************************************************/
+
+uint32_t sd_stream_write(SdStream *s, const void *data, uint32_t len) {
+    const uint8_t *src = data;
+    uint32_t done = 0;
+
+    while (done < len) {
+        if ((s->filled - s->drained) >= s->nbufs) {
+            s->overruns++;
+            break;
+        }
+
+        uint32_t room = s->buf_size - s->fill;
+        uint32_t chunk = (len - done < room) ? len - done : room;
+
+        memcpy(s->buf[s->filled % s->nbufs] + s->fill, src + done, chunk);
+        done += chunk;
+        sd_stream_commit(s, chunk);
+    }
+    return done;
+}
+
+/***************************************************************
+ * Attach a packer, see sd_stream.h
+ * out must hold SD_STREAM_PACK_OUT_SIZE(buf_size) bytes,
+ * 4-byte aligned
+ ***************************************************************/
+
+int sd_stream_set_pack(SdStream *s, SdPack *pack, uint8_t *out, uint32_t out_size) {
+    if (s->filled != 0 || s->fill != 0) return FR_DENIED;
+    if (s->buf_size > SD_PACK_MAX_BLOCK || out_size < SD_STREAM_PACK_OUT_SIZE(s->buf_size)
+            || ((uintptr_t)out & 0x3)) return FR_INVALID_PARAMETER;
+
+    s->pack = pack;
+    s->out = out;
+    s->out_size = out_size;
+    s->out_fill = 0;
+    return FR_OK;
+}
+
+/***************************************************************
+ * Pack one buffer behind the staged frames and write the whole
+ * sectors; the partial last sector stays staged. With tail set
+ * it is written too and the file pointer moved back over it,
+ * so the next write covers that sector again in full
+ ***************************************************************/
+
+static int sd_stream_pack(SdStream *s, uint8_t *data, uint32_t len, uint8_t tail) {
+    uint32_t n, whole;
+    FRESULT res = FR_OK;
+    UINT bw;
+
+    if (len > 0) {
+        n = sd_pack_block(s->pack, data, len, s->out + s->out_fill, s->out_size - s->out_fill);
+        if (n == 0) return FR_INT_ERR;
+        s->out_fill += n;
+    }
+
+    whole = tail ? s->out_fill : (s->out_fill & ~511U);
+    if (whole == 0) return FR_OK;
+
+    res = f_write(&s->file, s->out, whole, &bw);
+    if (res == FR_OK && bw != whole) res = FR_DENIED;
+    if (res != FR_OK) return res;
+
+    if (tail) {
+        whole = s->out_fill & ~511U;
+        if (whole < s->out_fill) res = f_lseek(&s->file, f_tell(&s->file) - (s->out_fill - whole));
+    }
+    s->bytes_written += whole;
+    s->out_fill -= whole;
+    memmove(s->out, s->out + whole, s->out_fill);
+    return res;
+}
+
+/***************************************************************
+ * Write one unpacked buffer behind the staged partial sector:
+ * the sector is completed first, the whole sectors go from the
+ * buffer to the card and the rest is staged again. With tail
+ * set the staged sector is written and the file pointer moved
+ * back over it, as in sd_stream_pack
+ ***************************************************************/
+
+static int sd_stream_put(SdStream *s, const uint8_t *data, uint32_t len, uint8_t tail) {
+    uint32_t n, whole;
+    FRESULT res;
+    UINT bw;
+
+    if (s->tail_fill > 0 && len > 0) {
+        n = (len < 512 - s->tail_fill) ? len : 512 - s->tail_fill;
+        memcpy(s->tail + s->tail_fill, data, n);
+        s->tail_fill += n;
+        data += n;
+        len -= n;
+        if (s->tail_fill == 512) {
+            res = f_write(&s->file, s->tail, 512, &bw);
+            if (res == FR_OK && bw != 512) res = FR_DENIED;
+            if (res != FR_OK) return res;
+            s->bytes_written += 512;
+            s->tail_fill = 0;
+        }
+    }
+
+    whole = len & ~511U;
+    if (whole > 0) {
+        res = f_write(&s->file, data, whole, &bw);
+        if (res == FR_OK && bw != whole) res = FR_DENIED;
+        if (res != FR_OK) return res;
+        s->bytes_written += whole;
+    }
+    if (len > whole) {
+        memcpy(s->tail, data + whole, len - whole);
+        s->tail_fill = len - whole;
+    }
+
+    if (tail && s->tail_fill > 0) {
+        res = f_write(&s->file, s->tail, s->tail_fill, &bw);
+        if (res == FR_OK && bw != s->tail_fill) res = FR_DENIED;
+        if (res != FR_OK) return res;
+        return f_lseek(&s->file, f_tell(&s->file) - s->tail_fill);
+    }
+    return FR_OK;
+}
+
+/***************************************************************
+ * Writer side: write every full buffer to the card
+ * While f_write waits for the DMA, producers keep filling the
+ * next buffer
+ ***************************************************************/
+
+int sd_stream_service(SdStream *s) {
+    FRESULT res = FR_OK;
+
+    while (s->drained != s->filled) {
+        uint32_t idx = s->drained % s->nbufs;
+
+        if (s->pack != NULL) {
+            res = sd_stream_pack(s, s->buf[idx], s->used[idx], 0);
+            if (res != FR_OK) {
+                printf("sd_stream_pack error: %d\r\n", res);
+                return res;
+            }
+        } else {
+            // a buffer handed over early ends off a sector boundary
+            res = sd_stream_put(s, s->buf[idx], s->used[idx], 0);
+            if (res != FR_OK) {
+                printf("f_write error: %d\r\n", res);
+                return res;
+            }
+        }
+
+        __DMB(); // done with the buffer before releasing it
+        s->drained++;
+    }
+    return res;
+}
+
+/***************************************************************
+ * Write the partially filled buffer too and sync the file
+ * The partial last sector stays staged and the file pointer
+ * sits at its start, so writing goes on sector aligned
+ * Call from the writer context with producers paused
+ ***************************************************************/
+
+int sd_stream_flush(SdStream *s) {
+    sd_stream_handover(s);
+
+    FRESULT res = sd_stream_service(s);
+    if (res == FR_OK) res = (s->pack != NULL) ? sd_stream_pack(s, NULL, 0, 1) : sd_stream_put(s, NULL, 0, 1);
+    if (res != FR_OK) return res;
+
+    return f_sync(&s->file);
+}
+
+/***************************************************************
+ * Flush and close the stream
+ * Prints the amount written and the overrun count
+ ***************************************************************/
+
+int sd_stream_close(SdStream *s) {
+    FRESULT res = sd_stream_flush(s);
+    FRESULT res_close = f_close(&s->file);
+
+    if (res == FR_OK) s->bytes_written += s->out_fill + s->tail_fill;   // staged tail, already in the file
+    s->out_fill = 0;
+    s->tail_fill = 0;
+
+    printf("Stream closed: %lu bytes, %lu overruns, max %lu/%u buffers pending\r\n",
+           (unsigned long)s->bytes_written, (unsigned long)s->overruns, (unsigned long)s->max_pending, s->nbufs);
+    return (res != FR_OK) ? res : res_close;
+}
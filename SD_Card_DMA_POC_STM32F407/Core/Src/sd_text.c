@@ -0,0 +1,187 @@
+#include "sd_text.h"
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+/***************************************************************
+ * Open a text stream on buf
+ * buf must be 4-byte aligned and buf_size a multiple of 512,
+ * so full buffers are read and written as whole sectors by DMA
+ ***************************************************************/
+
+int sd_text_open(SdText *t, const char *filename, BYTE mode, uint8_t *buf, uint32_t buf_size) {
+    if (buf_size < 1024 || (buf_size % 512) != 0 || ((uintptr_t)buf & 0x3)) return FR_INVALID_PARAMETER;
+    if ((mode & FA_READ) && (mode & FA_WRITE)) return FR_INVALID_PARAMETER;
+
+    memset(t, 0, sizeof(*t));
+    t->buf = buf;
+    t->buf_size = buf_size;
+    t->writing = (mode & FA_WRITE) != 0;
+
+    t->res = f_open(&t->file, filename, mode);
+    return t->res;
+}
+
+/***************************************************************
+ * Read the next block behind the unread part of buf
+ * The unread part is moved to the front, padded so that the
+ * read lands 4-byte aligned, and the read is rounded to 512
+ ***************************************************************/
+
+static int sd_text_fill(SdText *t) {
+    uint32_t keep = t->fill - t->off;
+    uint32_t pad = (4 - (keep & 3)) & 3;
+    uint32_t room;
+    UINT br;
+
+    memmove(t->buf + pad, t->buf + t->off, keep);
+    t->off = pad;
+    t->fill = pad + keep;
+    room = (t->buf_size - t->fill) & ~511U;
+    if (room == 0) {
+        t->res = FR_DENIED;     // line longer than the buffer
+        return t->res;
+    }
+
+    t->res = f_read(&t->file, t->buf + t->fill, room, &br);
+    if (t->res != FR_OK) return t->res;
+    t->fill += br;
+    t->bytes += br;
+    if (br < room) t->eof = 1;  // leaves room for the NUL of a last line without "\n"
+    return FR_OK;
+}
+
+/***************************************************************
+ * Return the next line, see sd_text.h
+ * The line end is searched with memchr over everything buffered
+ ***************************************************************/
+
+const char *sd_text_readline(SdText *t, uint32_t *len) {
+    if (t->writing || t->res != FR_OK) return NULL;
+
+    for (;;) {
+        char *p = (char *)t->buf + t->off;
+        char *end = (char *)t->buf + t->fill;
+        char *nl = memchr(p, '\n', end - p);
+
+        if (nl != NULL || (t->eof && p < end)) {
+            char *stop = nl ? nl : end;
+
+            if (stop > p && stop[-1] == '\r') stop--;
+            *stop = '\0';
+            t->off = nl ? (uint32_t)(nl + 1 - (char *)t->buf) : t->fill;
+            t->lines++;
+            if (len) *len = stop - p;
+            return p;
+        }
+        if (t->eof) return NULL;
+        if (sd_text_fill(t) != FR_OK) return NULL;
+    }
+}
+
+/***************************************************************
+ * Copy len bytes into buf, writing it out each time it is full
+ ***************************************************************/
+
+static int sd_text_put(SdText *t, const char *data, uint32_t len) {
+    UINT bw;
+
+    while (len > 0) {
+        uint32_t n = t->buf_size - t->fill;
+
+        if (n > len) n = len;
+        memcpy(t->buf + t->fill, data, n);
+        t->fill += n;
+        data += n;
+        len -= n;
+
+        if (t->fill == t->buf_size) {
+            t->res = f_write(&t->file, t->buf, t->fill, &bw);
+            if (t->res == FR_OK && bw < t->fill) t->res = FR_DENIED;   // volume full
+            if (t->res != FR_OK) return -1;
+            t->bytes += bw;
+            t->fill = 0;
+        }
+    }
+    return 0;
+}
+
+/***************************************************************
+ * Write text, see sd_text.h
+ * The runs between line ends are copied with memcpy, only the
+ * "\n" found by memchr are looked at one by one
+ ***************************************************************/
+
+int sd_text_write(SdText *t, const char *data, uint32_t len) {
+    const char *p = data;
+    const char *end = data + len;
+
+    if (!t->writing || t->res != FR_OK) return -1;
+
+    while (p < end) {
+        const char *nl = memchr(p, '\n', end - p);
+        const char *stop = nl ? nl : end;
+
+        if (stop > p && sd_text_put(t, p, stop - p) != 0) return -1;
+        if (nl == NULL) break;
+
+        if (sd_text_put(t, "\r\n", 2) != 0) return -1;
+        t->lines++;
+        p = nl + 1;
+    }
+    return len;
+}
+
+int sd_text_puts(SdText *t, const char *str) {
+    return sd_text_write(t, str, strlen(str));
+}
+
+/***************************************************************
+ * Formatted write, at most SD_TEXT_PRINTF_MAX - 1 characters
+ * Formats on the stack and hands the result to sd_text_write,
+ * so buffer writes stay whole-buffer
+ ***************************************************************/
+
+int sd_text_printf(SdText *t, const char *fmt, ...) {
+    char line[SD_TEXT_PRINTF_MAX];
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+    if (n < 0) return -1;
+    if (n >= (int)sizeof(line)) n = sizeof(line) - 1;
+
+    return sd_text_write(t, line, n);
+}
+
+/***************************************************************
+ * Write out what is buffered and sync the file
+ * The partial buffer moves later writes off sector boundaries,
+ * flush only at points where the data must be on the card
+ ***************************************************************/
+
+int sd_text_flush(SdText *t) {
+    UINT bw;
+
+    if (!t->writing) return t->res;
+    if (t->res != FR_OK) return t->res;
+
+    if (t->fill > 0) {
+        t->res = f_write(&t->file, t->buf, t->fill, &bw);
+        if (t->res == FR_OK && bw < t->fill) t->res = FR_DENIED;
+        if (t->res != FR_OK) return t->res;
+        t->bytes += bw;
+        t->fill = 0;
+    }
+    t->res = f_sync(&t->file);
+    return t->res;
+}
+
+int sd_text_close(SdText *t) {
+    FRESULT res = sd_text_flush(t);
+    FRESULT res_close = f_close(&t->file);
+
+    return (res != FR_OK) ? res : res_close;
+}
@@ -52,6 +52,11 @@
 #define SD_NOT_PRESENT           ((uint8_t)0x00)
 #define SD_DATATIMEOUT           ((uint32_t)100000000)
 
+/**
+  * @brief  ACMD23 (SET_WR_BLK_ERASE_COUNT), not provided by the LL SDMMC driver
+  */
+#define SD_CMD_SD_APP_SET_WR_BLK_ERASE_COUNT   ((uint8_t)23U)
+
 #ifdef OLD_API
 /* kept to avoid issue when migrating old projects. */
 /* USER CODE BEGIN 0 */
@@ -68,6 +73,8 @@ uint8_t BSP_SD_ReadBlocks(uint32_t *pData, uint32_t ReadAddr, uint32_t NumOfBloc
 uint8_t BSP_SD_WriteBlocks(uint32_t *pData, uint32_t WriteAddr, uint32_t NumOfBlocks, uint32_t Timeout);
 uint8_t BSP_SD_ReadBlocks_DMA(uint32_t *pData, uint32_t ReadAddr, uint32_t NumOfBlocks);
 uint8_t BSP_SD_WriteBlocks_DMA(uint32_t *pData, uint32_t WriteAddr, uint32_t NumOfBlocks);
+uint8_t BSP_SD_SetWriteBlockEraseCount(uint32_t NumOfBlocks);
+uint8_t BSP_SD_Abort(void);
 uint8_t BSP_SD_Erase(uint32_t StartAddr, uint32_t EndAddr);
 void BSP_SD_IRQHandler(void);
 void BSP_SD_DMA_Tx_IRQHandler(void);
@@ -79,6 +86,7 @@ uint8_t BSP_SD_IsDetected(void);
 /* These functions can be modified in case the current settings (e.g. DMA stream)
    need to be changed for specific application needs */
 void    BSP_SD_AbortCallback(void);
+void    BSP_SD_ErrorCallback(void);
 void    BSP_SD_WriteCpltCallback(void);
 void    BSP_SD_ReadCpltCallback(void);
 /* USER CODE END BSP_H_CODE */
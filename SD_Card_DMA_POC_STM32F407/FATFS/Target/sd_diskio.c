@@ -27,8 +27,15 @@
 /* Includes ------------------------------------------------------------------*/
 #include "ff_gen_drv.h"
 #include "sd_diskio.h"
+#include "sd_trace_points.h"
 
 #include <string.h>
+#if defined(SD_HOST_IMAGE)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 /* Private typedef -----------------------------------------------------------*/
 /* Private define ------------------------------------------------------------*/
@@ -42,6 +49,12 @@
 
 #define SD_DEFAULT_BLOCK_SIZE 512
 
+#if defined(SD_HOST_IMAGE)
+#define SD_GET_TICK()   ((uint32_t)(SD_Host_GetTimeUs() / 1000u))
+#else
+#define SD_GET_TICK()   HAL_GetTick()
+#endif
+
 /*
  * Depending on the use case, the SD card initialization could be done at the
  * application level: if it is the case define the flag below to disable
@@ -59,32 +72,108 @@
  * Notice: This is applicable only for cortex M7 based platform.
  */
 /* USER CODE BEGIN enableSDDmaCacheMaintenance */
-/* #define ENABLE_SD_DMA_CACHE_MAINTENANCE  1 */
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+#define ENABLE_SD_DMA_CACHE_MAINTENANCE  1
+#endif
 /* USER CODE END enableSDDmaCacheMaintenance */
 
 /*
 * Some DMA requires 4-Byte aligned address buffer to correctly read/write data,
 * in FatFs some accesses aren't thus we need a 4-byte aligned scratch buffer to correctly
 * transfer data
+* The scratch buffer holds SD_SCRATCH_SECTORS sectors so an unaligned request still
+* goes out as one multi-block command per chunk instead of one command per sector.
+* With cache maintenance, a read into a cacheable buffer goes zero-copy only when the
+* buffer is 32-byte aligned: invalidating a shared cache line would drop the CPU data
+* next to it. Other buffers use the scratch buffer, which is never cached.
 */
 /* USER CODE BEGIN enableScratchBuffer */
-/* #define ENABLE_SCRATCH_BUFFER */
+#define ENABLE_SCRATCH_BUFFER
+#define SD_SCRATCH_SECTORS       16    /* 8 KB */
 /* USER CODE END enableScratchBuffer */
 
-/* Private variables ---------------------------------------------------------*/
-#if defined(ENABLE_SCRATCH_BUFFER)
-#if defined (ENABLE_SD_DMA_CACHE_MAINTENANCE)
-ALIGN_32BYTES(static uint8_t scratch[BLOCKSIZE]); // 32-Byte aligned for cache maintenance
+/*
+* Small FatFs writes (one sector at a time while a file grows, FAT and directory
+* updates) are collected in a write-back cache and sent as one multi-block write
+* (CMD25) once the run is no longer contiguous, the cache is full, CTRL_SYNC is
+* received (f_sync/f_close) or the oldest data is older than SD_WRITE_CACHE_FLUSH_MS.
+* Writes larger than the cache bypass it.
+*/
+/* USER CODE BEGIN enableWriteCache */
+#define ENABLE_SD_WRITE_CACHE
+#ifndef SD_WRITE_CACHE_SECTORS
+#if defined(STM32F4)
+#define SD_WRITE_CACHE_SECTORS   16    /* 8 KB, the F407 has 128 KB of RAM for everything */
 #else
-__ALIGN_BEGIN static uint8_t scratch[BLOCKSIZE] __ALIGN_END;
+#define SD_WRITE_CACHE_SECTORS   64    /* 32 KB */
 #endif
 #endif
+#define SD_WRITE_CACHE_FLUSH_MS  100
+/* USER CODE END enableWriteCache */
+
+/*
+* Send ACMD23 (SET_WR_BLK_ERASE_COUNT) before each multi-block write so the card
+* can pre-erase the blocks it is about to receive. It can be switched at run time
+* with SD_SetPreErase() to compare both modes.
+*/
+/* USER CODE BEGIN enablePreErase */
+#define ENABLE_SD_PRE_ERASE
+/* USER CODE END enablePreErase */
+
+/*
+* Instead of spinning while the DMA runs, the driver calls a wait hook that
+* sleeps (WFI) until the Rx/Tx complete interrupt by default, or runs application
+* work set with SD_SetWaitHook(). After a write, the card programming phase is no
+* longer waited for in place: the next command (or CTRL_SYNC) checks the card state,
+* so the CPU goes back to the caller as soon as the data has left the DMA.
+* SD_ReadAsync()/SD_WriteAsync() start a transfer and return at once, the
+* completion callback runs from the SD interrupt.
+*/
+/* USER CODE BEGIN enableAsyncWait */
+#define ENABLE_SD_ASYNC_WAIT
+/* USER CODE END enableAsyncWait */
+
+/* Private variables ---------------------------------------------------------*/
+#if defined(ENABLE_SCRATCH_BUFFER) && !defined(SD_HOST_IMAGE)
+static uint8_t scratch[SD_SCRATCH_SECTORS * BLOCKSIZE] SD_DMA_BUFFER; // non-cacheable when the MPU region exists
+#endif
 /* Disk status */
 static volatile DSTATUS Stat = STA_NOINIT;
 
-static volatile  UINT  WriteStatus = 0, ReadStatus = 0;
+#if !defined(SD_HOST_IMAGE)
+static volatile  UINT  WriteStatus = 0, ReadStatus = 0;  /* 1 = done, 2 = failed */
+#if defined(ENABLE_SD_ASYNC_WAIT)
+static SD_WaitHookTypeDef WaitHook = SD_WaitSleep;
+static volatile uint8_t CardBusy = 0;        /* card still programming our last write */
+#endif
+static SD_DoneCallbackTypeDef AsyncCallback = NULL;
+static void *AsyncContext = NULL;
+#endif
+static volatile uint8_t AsyncPending = 0;
+#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
+static BYTE *AsyncReadBuff = NULL;
+static UINT AsyncReadCount = 0;
+#endif
+#if defined(ENABLE_SD_WRITE_CACHE)
+/* cacheable on purpose: filled by memcpy, cleaned once per flush */
+static uint8_t WriteCache[SD_WRITE_CACHE_SECTORS * SD_DEFAULT_BLOCK_SIZE] __attribute__((aligned(32)));
+static DWORD WriteCacheSector = 0;    /* first sector held in the cache */
+static UINT WriteCacheCount = 0;      /* number of valid sectors, 0 = empty */
+static uint32_t WriteCacheTick = 0;   /* time the cache became dirty */
+static SD_WriteCacheStatsTypeDef WriteCacheStats;
+#endif
+#if defined(ENABLE_SD_PRE_ERASE)
+static uint8_t PreErase = 1;
+#endif
 /* Private function prototypes -----------------------------------------------*/
+#if !defined(SD_HOST_IMAGE)
 static DSTATUS SD_CheckStatus(BYTE lun);
+static void SD_AsyncComplete(DRESULT res);
+#endif
+static DRESULT SD_ReadSectors(BYTE lun, BYTE *buff, DWORD sector, UINT count);
+#if _USE_WRITE == 1
+static DRESULT SD_WriteSectors(BYTE lun, const BYTE *buff, DWORD sector, UINT count);
+#endif /* _USE_WRITE == 1 */
 DSTATUS SD_initialize (BYTE);
 DSTATUS SD_status (BYTE);
 DRESULT SD_read (BYTE, BYTE*, DWORD, UINT);
@@ -114,17 +203,109 @@ const Diskio_drvTypeDef  SD_Driver =
 /* USER CODE END beforeFunctionSection */
 
 /* Private functions ---------------------------------------------------------*/
+#if !defined(SD_HOST_IMAGE)
+
+#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
+/* bounds of the non-cacheable .sd_dma_buffer section, from the linker script */
+extern uint8_t _sd_dma_buffer_start[];
+extern uint8_t _sd_dma_buffer_end[];
+
+/* No maintenance with the D-cache off or for buffers of the non-cacheable region */
+static int SD_IsCacheable(const void *buff)
+{
+  const uint8_t *p = (const uint8_t *)buff;
+
+  if ((SCB->CCR & SCB_CCR_DC_Msk) == 0U)
+  {
+    return 0;
+  }
+  return (p < _sd_dma_buffer_start) || (p >= _sd_dma_buffer_end);
+}
+
+/*
+ * The SCB_xxxDCache_by_Addr() functions require a 32-Byte aligned address,
+ * adjust the address and the size accordingly.
+ */
+static void SD_CacheClean(const void *buff, uint32_t len)
+{
+  uint32_t alignedAddr = (uint32_t)buff & ~0x1FU;
+
+  if (SD_IsCacheable(buff))
+  {
+    SCB_CleanDCache_by_Addr((uint32_t*)alignedAddr, len + ((uint32_t)buff - alignedAddr));
+  }
+}
+
+static void SD_CacheInvalidate(void *buff, uint32_t len)
+{
+  uint32_t alignedAddr = (uint32_t)buff & ~0x1FU;
+
+  if (SD_IsCacheable(buff))
+  {
+    SCB_InvalidateDCache_by_Addr((uint32_t*)alignedAddr, len + ((uint32_t)buff - alignedAddr));
+  }
+}
+
+/* DMA into a cacheable buffer only when its cache lines are not shared */
+#define SD_DMA_ALIGN_MASK(buff)  (SD_IsCacheable(buff) ? 0x1FU : 0x3U)
+#else
+#define SD_DMA_ALIGN_MASK(buff)  0x3U
+#endif
+
+/**
+  * @brief  Default wait hook: sleeps until the next interrupt while the DMA runs,
+  *         keeps polling the card otherwise. A completion landing between the flag
+  *         test and WFI is caught by the next SysTick.
+  * @param  wait: What the driver waits for
+  * @retval None
+  */
+void SD_WaitSleep(SD_WaitTypeDef wait)
+{
+  if (wait == SD_WAIT_TRANSFER)
+  {
+    __WFI();
+  }
+}
+
+static void SD_Wait(SD_WaitTypeDef wait)
+{
+#if defined(ENABLE_SD_ASYNC_WAIT)
+  if (WaitHook != NULL)
+  {
+    WaitHook(wait);
+  }
+#endif
+}
 
 static int SD_CheckStatusWithTimeout(uint32_t timeout)
 {
   uint32_t timer = HAL_GetTick();
+
+  /* an asynchronous transfer owns the bus until its callback ran */
+  while (AsyncPending)
+  {
+    if (HAL_GetTick() - timer >= timeout)
+    {
+      return -1;
+    }
+    SD_Wait(SD_WAIT_TRANSFER);
+  }
+
   /* block until SDIO IP is ready again or a timeout occur */
   while(HAL_GetTick() - timer < timeout)
   {
     if (BSP_SD_GetCardState() == SD_TRANSFER_OK)
     {
+#if defined(ENABLE_SD_ASYNC_WAIT)
+      if (CardBusy)
+      {
+        SD_TRACE(SD_TRACE_CARD_READY, 0, 0);
+      }
+      CardBusy = 0;
+#endif
       return 0;
     }
+    SD_Wait(SD_WAIT_CARD_BUSY);
   }
 
   return -1;
@@ -134,6 +315,15 @@ static DSTATUS SD_CheckStatus(BYTE lun)
 {
   Stat = STA_NOINIT;
 
+#if defined(ENABLE_SD_ASYNC_WAIT)
+  /* still programming a write we issued: the card is there, do not wait for it */
+  if (CardBusy || AsyncPending)
+  {
+    Stat &= ~STA_NOINIT;
+    return Stat;
+  }
+#endif
+
   if(BSP_SD_GetCardState() == MSD_OK)
   {
     Stat &= ~STA_NOINIT;
@@ -186,15 +376,12 @@ DSTATUS SD_status(BYTE lun)
   * @retval DRESULT: Operation result
   */
 
-DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+static DRESULT SD_ReadSectors(BYTE lun, BYTE *buff, DWORD sector, UINT count)
 {
   DRESULT res = RES_ERROR;
   uint32_t timeout;
 #if defined(ENABLE_SCRATCH_BUFFER)
-  uint8_t ret;
-#endif
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-  uint32_t alignedAddr;
+  UINT chunk;
 #endif
 
   /*
@@ -207,9 +394,14 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
   }
 
 #if defined(ENABLE_SCRATCH_BUFFER)
-  if (!((uint32_t)buff & 0x3))
+  if (!((uint32_t)buff & SD_DMA_ALIGN_MASK(buff)))
   {
 #endif
+#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
+    /* drop dirty lines now so no eviction lands on the DMA data */
+    SD_CacheInvalidate(buff, count*BLOCKSIZE);
+#endif
+    SD_TRACE(SD_TRACE_DMA_READ, sector, count);
     if(BSP_SD_ReadBlocks_DMA((uint32_t*)buff,
                              (uint32_t) (sector),
                              count) == MSD_OK)
@@ -219,10 +411,12 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
       timeout = HAL_GetTick();
       while((ReadStatus == 0) && ((HAL_GetTick() - timeout) < SD_TIMEOUT))
       {
+        SD_Wait(SD_WAIT_TRANSFER);
       }
-      /* in case of a timeout return error */
-      if (ReadStatus == 0)
+      /* in case of a timeout or a transfer error return error */
+      if (ReadStatus != 1)
       {
+        ReadStatus = 0;
         res = RES_ERROR;
       }
       else
@@ -234,17 +428,15 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
         {
           if (BSP_SD_GetCardState() == SD_TRANSFER_OK)
           {
+            SD_TRACE(SD_TRACE_CARD_READY, 0, 0);
             res = RES_OK;
 #if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-            /*
-            the SCB_InvalidateDCache_by_Addr() requires a 32-Byte aligned address,
-            adjust the address and the D-Cache size to invalidate accordingly.
-            */
-            alignedAddr = (uint32_t)buff & ~0x1F;
-            SCB_InvalidateDCache_by_Addr((uint32_t*)alignedAddr, count*BLOCKSIZE + ((uint32_t)buff - alignedAddr));
+            /* and again for lines speculatively fetched during the transfer */
+            SD_CacheInvalidate(buff, count*BLOCKSIZE);
 #endif
             break;
           }
+          SD_Wait(SD_WAIT_CARD_BUSY);
         }
       }
     }
@@ -252,43 +444,20 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
   }
     else
     {
-      /* Slow path, fetch each sector a part and memcpy to destination buffer */
-      int i;
-
-      for (i = 0; i < count; i++) {
-        ret = BSP_SD_ReadBlocks_DMA((uint32_t*)scratch, (uint32_t)sector++, 1);
-        if (ret == MSD_OK) {
-          /* wait until the read is successful or a timeout occurs */
-
-          timeout = HAL_GetTick();
-          while((ReadStatus == 0) && ((HAL_GetTick() - timeout) < SD_TIMEOUT))
-          {
-          }
-          if (ReadStatus == 0)
-          {
-            res = RES_ERROR;
-            break;
-          }
-          ReadStatus = 0;
-
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-          /*
-          *
-          * invalidate the scratch buffer before the next read to get the actual data instead of the cached one
-          */
-          SCB_InvalidateDCache_by_Addr((uint32_t*)scratch, BLOCKSIZE);
-#endif
-          memcpy(buff, scratch, BLOCKSIZE);
-          buff += BLOCKSIZE;
-        }
-        else
+      /* Slow path, read chunks of up to SD_SCRATCH_SECTORS into the scratch buffer and memcpy to destination */
+      res = RES_OK;
+      while ((count > 0) && (res == RES_OK))
+      {
+        chunk = (count < SD_SCRATCH_SECTORS) ? count : SD_SCRATCH_SECTORS;
+        res = SD_ReadSectors(lun, scratch, sector, chunk);
+        if (res == RES_OK)
         {
-          break;
+          memcpy(buff, scratch, chunk * BLOCKSIZE);
+          buff += chunk * BLOCKSIZE;
+          sector += chunk;
+          count -= chunk;
         }
       }
-
-      if ((i == count) && (ret == MSD_OK))
-        res = RES_OK;
     }
 #endif
 
@@ -308,19 +477,15 @@ DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
   */
 #if _USE_WRITE == 1
 
-DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
+static DRESULT SD_WriteSectors(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
 {
   DRESULT res = RES_ERROR;
   uint32_t timeout;
 #if defined(ENABLE_SCRATCH_BUFFER)
-  uint8_t ret;
-  int i;
+  UINT chunk;
 #endif
 
    WriteStatus = 0;
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-  uint32_t alignedAddr;
-#endif
 
   if (SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0)
   {
@@ -332,15 +497,19 @@ DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
   {
 #endif
 #if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
+    /* the DMA only reads: cleaning shared lines is harmless, 4-byte alignment is enough */
+    SD_CacheClean(buff, count*BLOCKSIZE);
+#endif
 
-    /*
-    the SCB_CleanDCache_by_Addr() requires a 32-Byte aligned address
-    adjust the address and the D-Cache size to clean accordingly.
-    */
-    alignedAddr = (uint32_t)buff &  ~0x1F;
-    SCB_CleanDCache_by_Addr((uint32_t*)alignedAddr, count*BLOCKSIZE + ((uint32_t)buff - alignedAddr));
+#if defined(ENABLE_SD_PRE_ERASE)
+    /* Pre-erase hint only: the write goes ahead if the card rejects it */
+    if (PreErase && count > 1)
+    {
+      (void)BSP_SD_SetWriteBlockEraseCount(count);
+    }
 #endif
 
+    SD_TRACE(SD_TRACE_DMA_WRITE, sector, count);
     if(BSP_SD_WriteBlocks_DMA((uint32_t*)buff,
                               (uint32_t)(sector),
                               count) == MSD_OK)
@@ -350,66 +519,51 @@ DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
       timeout = HAL_GetTick();
       while((WriteStatus == 0) && ((HAL_GetTick() - timeout) < SD_TIMEOUT))
       {
+        SD_Wait(SD_WAIT_TRANSFER);
       }
-      /* in case of a timeout return error */
-      if (WriteStatus == 0)
+      /* in case of a timeout or a transfer error return error */
+      if (WriteStatus != 1)
       {
+        WriteStatus = 0;
         res = RES_ERROR;
       }
       else
       {
         WriteStatus = 0;
+#if defined(ENABLE_SD_ASYNC_WAIT)
+        /* the card programs the data while we return, next command waits for it */
+        CardBusy = 1;
+        res = RES_OK;
+#else
         timeout = HAL_GetTick();
 
         while((HAL_GetTick() - timeout) < SD_TIMEOUT)
         {
           if (BSP_SD_GetCardState() == SD_TRANSFER_OK)
           {
+            SD_TRACE(SD_TRACE_CARD_READY, 0, 0);
             res = RES_OK;
             break;
           }
         }
+#endif
       }
     }
 #if defined(ENABLE_SCRATCH_BUFFER)
   }
     else
     {
-      /* Slow path, fetch each sector a part and memcpy to destination buffer */
-#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
-      /*
-      * invalidate the scratch buffer before the next write to get the actual data instead of the cached one
-      */
-      SCB_InvalidateDCache_by_Addr((uint32_t*)scratch, BLOCKSIZE);
-#endif
-
-      for (i = 0; i < count; i++)
+      /* Slow path, copy chunks of up to SD_SCRATCH_SECTORS to the scratch buffer and write each with one command */
+      res = RES_OK;
+      while ((count > 0) && (res == RES_OK))
       {
-        WriteStatus = 0;
-
-        memcpy((void *)scratch, (void *)buff, BLOCKSIZE);
-        buff += BLOCKSIZE;
-
-        ret = BSP_SD_WriteBlocks_DMA((uint32_t*)scratch, (uint32_t)sector++, 1);
-        if (ret == MSD_OK) {
-          /* wait for a message from the queue or a timeout */
-          timeout = HAL_GetTick();
-          while((WriteStatus == 0) && ((HAL_GetTick() - timeout) < SD_TIMEOUT))
-          {
-          }
-          if (WriteStatus == 0)
-          {
-            break;
-          }
-
-        }
-        else
-        {
-          break;
-        }
+        chunk = (count < SD_SCRATCH_SECTORS) ? count : SD_SCRATCH_SECTORS;
+        memcpy((void *)scratch, (void *)buff, chunk * BLOCKSIZE);
+        res = SD_WriteSectors(lun, scratch, sector, chunk);
+        buff += chunk * BLOCKSIZE;
+        sector += chunk;
+        count -= chunk;
       }
-      if ((i == count) && (ret == MSD_OK))
-        res = RES_OK;
     }
 #endif
   return res;
@@ -438,7 +592,11 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
   {
   /* Make sure that no pending write process */
   case CTRL_SYNC :
-    res = RES_OK;
+    res = SD_WriteCache_Flush();
+    if (res == RES_OK && SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0)
+    {
+      res = RES_ERROR;
+    }
     break;
 
   /* Get number of sectors on the disk (DWORD) */
@@ -474,6 +632,110 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
 /* can be used to modify previous code / undefine following code / add new code */
 /* USER CODE END afterIoctlSection */
 
+/* Runs in the SD interrupt when an asynchronous transfer ended */
+static void SD_AsyncComplete(DRESULT res)
+{
+  SD_DoneCallbackTypeDef cb = AsyncCallback;
+
+#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
+  if (AsyncReadBuff != NULL)
+  {
+    SD_CacheInvalidate(AsyncReadBuff, AsyncReadCount*BLOCKSIZE);
+    AsyncReadBuff = NULL;
+  }
+#endif
+  AsyncPending = 0;
+  if (cb != NULL)
+  {
+    cb(res, AsyncContext);
+  }
+}
+
+/**
+  * @brief  Starts reading sectors and returns before the data arrived
+  * @param  *buff: 4-byte aligned destination (32-byte when cacheable), must stay valid until the callback
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to read
+  * @param  cb: Called from the SD interrupt when the transfer ended (may be NULL)
+  * @param  ctx: Passed to cb
+  * @retval DRESULT: RES_OK if the transfer was started
+  */
+DRESULT SD_ReadAsync(BYTE *buff, DWORD sector, UINT count, SD_DoneCallbackTypeDef cb, void *ctx)
+{
+  if ((uint32_t)buff & SD_DMA_ALIGN_MASK(buff)) return RES_PARERR;
+  if (SD_WriteCache_Flush() != RES_OK) return RES_ERROR;
+  if (SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0) return RES_NOTRDY;
+
+  AsyncCallback = cb;
+  AsyncContext = ctx;
+#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
+  SD_CacheInvalidate(buff, count*BLOCKSIZE);
+  AsyncReadBuff = buff;
+  AsyncReadCount = count;
+#endif
+  AsyncPending = 1;
+  SD_TRACE(SD_TRACE_DMA_READ, sector, count);
+  if (BSP_SD_ReadBlocks_DMA((uint32_t*)buff, (uint32_t)sector, count) != MSD_OK)
+  {
+    AsyncPending = 0;
+    return RES_ERROR;
+  }
+  return RES_OK;
+}
+
+/**
+  * @brief  Starts writing sectors and returns before the data left the buffer
+  * @param  *buff: 4-byte aligned source, must stay untouched until the callback
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to write
+  * @param  cb: Called from the SD interrupt when the transfer ended (may be NULL)
+  * @param  ctx: Passed to cb
+  * @retval DRESULT: RES_OK if the transfer was started
+  */
+DRESULT SD_WriteAsync(const BYTE *buff, DWORD sector, UINT count, SD_DoneCallbackTypeDef cb, void *ctx)
+{
+  if ((uint32_t)buff & 0x3) return RES_PARERR;
+  if (SD_WriteCache_Flush() != RES_OK) return RES_ERROR;
+  if (SD_CheckStatusWithTimeout(SD_TIMEOUT) < 0) return RES_NOTRDY;
+
+#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
+  SD_CacheClean(buff, count*BLOCKSIZE);
+#endif
+#if defined(ENABLE_SD_PRE_ERASE)
+  if (PreErase && count > 1)
+  {
+    (void)BSP_SD_SetWriteBlockEraseCount(count);
+  }
+#endif
+
+  AsyncCallback = cb;
+  AsyncContext = ctx;
+  AsyncPending = 1;
+#if defined(ENABLE_SD_ASYNC_WAIT)
+  CardBusy = 1;
+#endif
+  SD_TRACE(SD_TRACE_DMA_WRITE, sector, count);
+  if (BSP_SD_WriteBlocks_DMA((uint32_t*)buff, (uint32_t)sector, count) != MSD_OK)
+  {
+    AsyncPending = 0;
+    return RES_ERROR;
+  }
+  return RES_OK;
+}
+
+/**
+  * @brief  Sets the function called while the driver waits for the card
+  * @param  hook: SD_WaitSleep (default), application work that returns quickly,
+  *         or NULL to busy-wait as the original driver did
+  * @retval None
+  */
+void SD_SetWaitHook(SD_WaitHookTypeDef hook)
+{
+#if defined(ENABLE_SD_ASYNC_WAIT)
+  WaitHook = hook;
+#endif
+}
+
 /* USER CODE BEGIN callbackSection */
 /* can be used to modify / following code or add new code */
 /* USER CODE END callbackSection */
@@ -484,7 +746,12 @@ DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
   */
 void BSP_SD_WriteCpltCallback(void)
 {
-
+  SD_TRACE(SD_TRACE_TX_CPLT, 0, 0);
+  if (AsyncPending)
+  {
+    SD_AsyncComplete(RES_OK);
+    return;
+  }
   WriteStatus = 1;
 }
 
@@ -495,25 +762,513 @@ void BSP_SD_WriteCpltCallback(void)
   */
 void BSP_SD_ReadCpltCallback(void)
 {
+  SD_TRACE(SD_TRACE_RX_CPLT, 0, 0);
+  if (AsyncPending)
+  {
+    SD_AsyncComplete(RES_OK);
+    return;
+  }
   ReadStatus = 1;
 }
 
 /* USER CODE BEGIN ErrorAbortCallbacks */
-/*
-==============================================================================================
-  depending on the SD_HAL_Driver version, either the HAL_SD_ErrorCallback() or HAL_SD_AbortCallback()
-  or both could be defined, activate the callbacks below when suitable and needed
-==============================================================================================
-void BSP_SD_AbortCallback(void)
+/**
+  * @brief Transfer error callback (DMA, CRC, data timeout)
+  * @retval None
+  */
+void BSP_SD_ErrorCallback(void)
 {
+#if defined(ENABLE_SD_ASYNC_WAIT)
+  /* no data reached the card, nothing left to program */
+  CardBusy = 0;
+#endif
+  if (AsyncPending)
+  {
+    SD_AsyncComplete(RES_ERROR);
+    return;
+  }
+  /* fail whichever blocking transfer is waiting, instead of its SD_TIMEOUT */
+  ReadStatus = 2;
+  WriteStatus = 2;
 }
 
-void BSP_SD_ErrorCallback(void)
+/**
+  * @brief Abort callback, the running transfer ended without its data
+  * @retval None
+  */
+void BSP_SD_AbortCallback(void)
 {
+  BSP_SD_ErrorCallback();
 }
-*/
 /* USER CODE END ErrorAbortCallbacks */
 
+#else /* SD_HOST_IMAGE */
+
+/*
+ * Host backend: same Diskio_drvTypeDef entry points, serviced from a disk image
+ * mapped into memory. The timing model only advances a simulated clock so runs
+ * are deterministic and independent of the CI machine.
+ */
+
+/* Approximate figures for the boards of this repo, 4-bit bus, class 10 card */
+const SD_HostProfileTypeDef SD_HostProfile_H723_SDMMC1 =
+{
+  "H723 SDMMC1", 60, 22000, 18000, 250
+};
+
+const SD_HostProfileTypeDef SD_HostProfile_F407_SDIO =
+{
+  "F407 SDIO", 100, 10000, 8000, 300
+};
+
+static uint8_t *HostImage = NULL;
+static DWORD HostSectors = 0;
+static size_t HostImageSize = 0;
+static int HostFd = -1;
+static const SD_HostProfileTypeDef *HostProfile = &SD_HostProfile_H723_SDMMC1;
+static uint64_t HostTimeUs = 0;
+static SD_HostStatsTypeDef HostStats;
+
+static void SD_Host_Charge(UINT count, uint32_t kbps, uint32_t busy_us)
+{
+  HostTimeUs += HostProfile->cmd_latency_us + busy_us;
+  if (kbps != 0)
+  {
+    HostTimeUs += ((uint64_t)count * SD_DEFAULT_BLOCK_SIZE * 1000000u) / ((uint64_t)kbps * 1024u);
+  }
+}
+
+/**
+  * @brief  Maps a disk image file as the SD card
+  * @param  path: Image file (its size must be a multiple of 512 bytes)
+  * @param  profile: Timing model, NULL keeps the current one
+  * @retval 0 on success, -1 otherwise
+  */
+int SD_Host_Open(const char *path, const SD_HostProfileTypeDef *profile)
+{
+  struct stat st;
+
+  SD_Host_Close();
+
+  HostFd = open(path, O_RDWR);
+  if (HostFd < 0)
+  {
+    return -1;
+  }
+
+  if (fstat(HostFd, &st) < 0 || st.st_size < SD_DEFAULT_BLOCK_SIZE)
+  {
+    SD_Host_Close();
+    return -1;
+  }
+
+  HostImage = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, HostFd, 0);
+  if (HostImage == MAP_FAILED)
+  {
+    HostImage = NULL;
+    SD_Host_Close();
+    return -1;
+  }
+
+  HostImageSize = (size_t)st.st_size;
+  HostSectors = (DWORD)(HostImageSize / SD_DEFAULT_BLOCK_SIZE);
+  if (profile != NULL)
+  {
+    HostProfile = profile;
+  }
+  HostTimeUs = 0;
+  SD_Host_ResetStats();
+
+  return 0;
+}
+
+/**
+  * @brief  Flushes and unmaps the disk image
+  * @retval None
+  */
+void SD_Host_Close(void)
+{
+  if (HostImage != NULL)
+  {
+    msync(HostImage, HostImageSize, MS_SYNC);
+    munmap(HostImage, HostImageSize);
+    HostImage = NULL;
+  }
+  if (HostFd >= 0)
+  {
+    close(HostFd);
+    HostFd = -1;
+  }
+  HostImageSize = 0;
+  HostSectors = 0;
+  Stat = STA_NOINIT;
+}
+
+/**
+  * @brief  Simulated time spent in the SD driver since SD_Host_Open()
+  * @retval Time in microseconds
+  */
+uint64_t SD_Host_GetTimeUs(void)
+{
+  return HostTimeUs;
+}
+
+void SD_Host_GetStats(SD_HostStatsTypeDef *stats)
+{
+  *stats = HostStats;
+}
+
+void SD_Host_ResetStats(void)
+{
+  memset(&HostStats, 0, sizeof(HostStats));
+}
+
+DSTATUS SD_initialize(BYTE lun)
+{
+  (void)lun;
+  Stat = (HostImage != NULL) ? 0 : STA_NOINIT;
+  return Stat;
+}
+
+DSTATUS SD_status(BYTE lun)
+{
+  (void)lun;
+  return (HostImage != NULL) ? 0 : STA_NOINIT;
+}
+
+static DRESULT SD_ReadSectors(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+{
+  (void)lun;
+  if (HostImage == NULL) return RES_NOTRDY;
+  if (sector >= HostSectors || count > HostSectors - sector) return RES_PARERR;
+
+  memcpy(buff, HostImage + (size_t)sector * SD_DEFAULT_BLOCK_SIZE, (size_t)count * SD_DEFAULT_BLOCK_SIZE);
+  SD_TRACE(SD_TRACE_DMA_READ, sector, count);
+  SD_Host_Charge(count, HostProfile->read_kbps, 0);
+  SD_TRACE(SD_TRACE_RX_CPLT, 0, 0);
+  HostStats.read_cmds++;
+  HostStats.read_sectors += count;
+
+  return RES_OK;
+}
+
+#if _USE_WRITE == 1
+static DRESULT SD_WriteSectors(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
+{
+  (void)lun;
+  if (HostImage == NULL) return RES_NOTRDY;
+  if (sector >= HostSectors || count > HostSectors - sector) return RES_PARERR;
+
+  memcpy(HostImage + (size_t)sector * SD_DEFAULT_BLOCK_SIZE, buff, (size_t)count * SD_DEFAULT_BLOCK_SIZE);
+  SD_TRACE(SD_TRACE_DMA_WRITE, sector, count);
+  SD_Host_Charge(count, HostProfile->write_kbps, 0);
+  SD_TRACE(SD_TRACE_TX_CPLT, 0, 0);
+  HostTimeUs += HostProfile->busy_us;
+  SD_TRACE(SD_TRACE_CARD_READY, 0, 0);
+  HostStats.write_cmds++;
+  HostStats.write_sectors += count;
+
+  return RES_OK;
+}
+#endif /* _USE_WRITE == 1 */
+
+#if _USE_IOCTL == 1
+DRESULT SD_ioctl(BYTE lun, BYTE cmd, void *buff)
+{
+  DRESULT res = RES_ERROR;
+
+  (void)lun;
+  if (Stat & STA_NOINIT) return RES_NOTRDY;
+
+  switch (cmd)
+  {
+  case CTRL_SYNC :
+    res = SD_WriteCache_Flush();
+    break;
+
+  case GET_SECTOR_COUNT :
+    *(DWORD*)buff = HostSectors;
+    res = RES_OK;
+    break;
+
+  case GET_SECTOR_SIZE :
+    *(WORD*)buff = SD_DEFAULT_BLOCK_SIZE;
+    res = RES_OK;
+    break;
+
+  case GET_BLOCK_SIZE :
+    *(DWORD*)buff = 1;
+    res = RES_OK;
+    break;
+
+  default:
+    res = RES_PARERR;
+  }
+
+  return res;
+}
+#endif /* _USE_IOCTL == 1 */
+
+/* The image is memory: transfers complete before returning */
+DRESULT SD_ReadAsync(BYTE *buff, DWORD sector, UINT count, SD_DoneCallbackTypeDef cb, void *ctx)
+{
+  DRESULT res;
+
+  if (SD_WriteCache_Flush() != RES_OK) return RES_ERROR;
+  res = SD_ReadSectors(0, buff, sector, count);
+  if (res == RES_OK && cb != NULL)
+  {
+    cb(res, ctx);
+  }
+  return res;
+}
+
+DRESULT SD_WriteAsync(const BYTE *buff, DWORD sector, UINT count, SD_DoneCallbackTypeDef cb, void *ctx)
+{
+  DRESULT res;
+
+  if (SD_WriteCache_Flush() != RES_OK) return RES_ERROR;
+  res = SD_WriteSectors(0, buff, sector, count);
+  if (res == RES_OK && cb != NULL)
+  {
+    cb(res, ctx);
+  }
+  return res;
+}
+
+void SD_SetWaitHook(SD_WaitHookTypeDef hook)
+{
+  (void)hook;
+}
+
+void SD_WaitSleep(SD_WaitTypeDef wait)
+{
+  (void)wait;
+}
+
+#endif /* SD_HOST_IMAGE */
+
+/**
+  * @brief  Tells whether an SD_ReadAsync()/SD_WriteAsync() transfer is running
+  * @retval 1 if running, 0 otherwise
+  */
+uint8_t SD_AsyncBusy(void)
+{
+  return AsyncPending;
+}
+
+/**
+  * @brief  Stops the running SD_ReadAsync()/SD_WriteAsync() transfer, its callback is not called.
+  *         Use after a timeout, before the buffer of the transfer is reused.
+  * @retval DRESULT: RES_OK if no transfer runs any more
+  */
+DRESULT SD_AsyncAbort(void)
+{
+  DRESULT res = RES_OK;
+
+#if !defined(SD_HOST_IMAGE)
+  if (!AsyncPending) return RES_OK;
+  AsyncCallback = NULL;    /* a completion racing with the abort is dropped */
+  __DMB();
+  if (BSP_SD_Abort() != MSD_OK) res = RES_ERROR;
+#if (ENABLE_SD_DMA_CACHE_MAINTENANCE == 1)
+  AsyncReadBuff = NULL;
+#endif
+#endif
+  AsyncPending = 0;
+  return res;
+}
+
+/* Write-back cache ----------------------------------------------------------*/
+/**
+  * @brief  Reads Sector(s), served from the write cache when it holds them
+  * @param  lun : not used
+  * @param  *buff: Data buffer to store read data
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to read (1..128)
+  * @retval DRESULT: Operation result
+  */
+DRESULT SD_read(BYTE lun, BYTE *buff, DWORD sector, UINT count)
+{
+#if defined(ENABLE_SD_WRITE_CACHE)
+  if (WriteCacheCount != 0)
+  {
+    DWORD cache_end = WriteCacheSector + WriteCacheCount;
+
+    if (sector >= WriteCacheSector && sector + count <= cache_end)
+    {
+      memcpy(buff, &WriteCache[(sector - WriteCacheSector) * SD_DEFAULT_BLOCK_SIZE],
+             count * SD_DEFAULT_BLOCK_SIZE);
+      return RES_OK;
+    }
+
+    /* Partial overlap: let the card hold the latest data first */
+    if (sector < cache_end && sector + count > WriteCacheSector)
+    {
+      if (SD_WriteCache_Flush() != RES_OK)
+      {
+        return RES_ERROR;
+      }
+    }
+  }
+#endif
+
+  return SD_ReadSectors(lun, buff, sector, count);
+}
+
+#if _USE_WRITE == 1
+/**
+  * @brief  Writes Sector(s) through the write-back cache
+  * @param  lun : not used
+  * @param  *buff: Data to be written
+  * @param  sector: Sector address (LBA)
+  * @param  count: Number of sectors to write (1..128)
+  * @retval DRESULT: Operation result
+  */
+DRESULT SD_write(BYTE lun, const BYTE *buff, DWORD sector, UINT count)
+{
+#if defined(ENABLE_SD_WRITE_CACHE)
+  DRESULT res;
+
+  if (WriteCacheCount != 0)
+  {
+    DWORD cache_end = WriteCacheSector + WriteCacheCount;
+
+    /* Extends or rewrites the cached run: merge in place */
+    if (sector >= WriteCacheSector && sector <= cache_end &&
+        sector + count - WriteCacheSector <= SD_WRITE_CACHE_SECTORS)
+    {
+      memcpy(&WriteCache[(sector - WriteCacheSector) * SD_DEFAULT_BLOCK_SIZE], buff,
+             count * SD_DEFAULT_BLOCK_SIZE);
+      if (sector + count > cache_end)
+      {
+        WriteCacheCount = sector + count - WriteCacheSector;
+      }
+      WriteCacheStats.cached_sectors += count;
+
+      if (WriteCacheCount == SD_WRITE_CACHE_SECTORS ||
+          (SD_GET_TICK() - WriteCacheTick) >= SD_WRITE_CACHE_FLUSH_MS)
+      {
+        return SD_WriteCache_Flush();
+      }
+      return RES_OK;
+    }
+
+    res = SD_WriteCache_Flush();
+    if (res != RES_OK)
+    {
+      return res;
+    }
+  }
+
+  /* Large requests are already multi-block: no need to copy them */
+  if (count >= SD_WRITE_CACHE_SECTORS)
+  {
+    WriteCacheStats.bypass_writes++;
+    return SD_WriteSectors(lun, buff, sector, count);
+  }
+
+  memcpy(WriteCache, buff, count * SD_DEFAULT_BLOCK_SIZE);
+  WriteCacheSector = sector;
+  WriteCacheCount = count;
+  WriteCacheTick = SD_GET_TICK();
+  WriteCacheStats.cached_sectors += count;
+  return RES_OK;
+#else
+  return SD_WriteSectors(lun, buff, sector, count);
+#endif
+}
+#endif /* _USE_WRITE == 1 */
+
+/**
+  * @brief  Writes the cached run to the card as a single multi-block write.
+  *         On error the run stays cached, so the next flush or CTRL_SYNC tries
+  *         again and fails too instead of losing sectors FatFs thinks written.
+  * @retval DRESULT: Operation result
+  */
+DRESULT SD_WriteCache_Flush(void)
+{
+#if defined(ENABLE_SD_WRITE_CACHE)
+  DRESULT res;
+
+  if (WriteCacheCount == 0)
+  {
+    return RES_OK;
+  }
+
+  res = SD_WriteSectors(0, WriteCache, WriteCacheSector, WriteCacheCount);
+  WriteCacheStats.flushes++;
+  WriteCacheStats.flushed_sectors += WriteCacheCount;
+  if (res != RES_OK)
+  {
+    WriteCacheStats.errors++;
+    return res;
+  }
+  WriteCacheCount = 0;
+
+  return RES_OK;
+#else
+  return RES_OK;
+#endif
+}
+
+/**
+  * @brief  Flushes the write cache once its content is older than
+  *         SD_WRITE_CACHE_FLUSH_MS. Call it from the application loop when the
+  *         card may stay idle for a while after a burst of small writes.
+  * @retval DRESULT: Operation result
+  */
+DRESULT SD_WriteCache_Poll(void)
+{
+#if defined(ENABLE_SD_WRITE_CACHE)
+  if (WriteCacheCount != 0 && (SD_GET_TICK() - WriteCacheTick) >= SD_WRITE_CACHE_FLUSH_MS)
+  {
+    return SD_WriteCache_Flush();
+  }
+#endif
+  return RES_OK;
+}
+
+/**
+  * @brief  Enables or disables the ACMD23 pre-erase hint for multi-block writes
+  * @param  enable: 0 to disable, any other value to enable
+  * @retval None
+  */
+void SD_SetPreErase(uint8_t enable)
+{
+#if defined(ENABLE_SD_PRE_ERASE)
+  PreErase = (enable != 0);
+#endif
+}
+
+void SD_WriteCache_GetStats(SD_WriteCacheStatsTypeDef *stats)
+{
+#if defined(ENABLE_SD_WRITE_CACHE)
+  *stats = WriteCacheStats;
+#else
+  memset(stats, 0, sizeof(*stats));
+#endif
+}
+
+void SD_WriteCache_ResetStats(void)
+{
+#if defined(ENABLE_SD_WRITE_CACHE)
+  memset(&WriteCacheStats, 0, sizeof(WriteCacheStats));
+#endif
+}
+
 /* USER CODE BEGIN lastSection */
 /* can be used to modify / undefine previous code or add new code */
+#if SD_TRACE_ENABLE
+/**
+  * @brief  Default trace point sink when the sd_trace ring (Core) is not linked in
+  * @retval None
+  */
+__attribute__((weak)) void sd_trace(uint16_t event, uint32_t arg, uint32_t count)
+{
+  (void)event;
+  (void)arg;
+  (void)count;
+}
+#endif
 /* USER CODE END lastSection */
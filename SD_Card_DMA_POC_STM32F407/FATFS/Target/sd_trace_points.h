@@ -0,0 +1,37 @@
+#ifndef __SD_TRACE_POINTS_H__
+#define __SD_TRACE_POINTS_H__
+
+#include <stdint.h>
+
+// Trace points of FatFs and sd_diskio. The ring behind them is in
+// Core (sd_trace.h); without it, the weak sd_trace in sd_diskio.c drops
+// every event.
+
+// Set to 0 to compile every trace point out
+#ifndef SD_TRACE_ENABLE
+#define SD_TRACE_ENABLE      1
+#endif
+
+// Trace points, keep in sync with tools/sd_trace_decode.py
+typedef enum {
+    SD_TRACE_F_READ = 1,      // arg = file offset, count = bytes asked
+    SD_TRACE_F_READ_END,      // arg = bytes read
+    SD_TRACE_F_WRITE,         // arg = file offset, count = bytes asked
+    SD_TRACE_F_WRITE_END,     // arg = bytes written
+    SD_TRACE_MOVE_WINDOW,     // arg = sector loaded into fs->win
+    SD_TRACE_SYNC_WINDOW,     // arg = dirty sector written back
+    SD_TRACE_DMA_READ,        // arg = sector, count = sectors, BSP_SD_ReadBlocks_DMA issued
+    SD_TRACE_DMA_WRITE,       // arg = sector, count = sectors, BSP_SD_WriteBlocks_DMA issued
+    SD_TRACE_RX_CPLT,         // read DMA complete (interrupt)
+    SD_TRACE_TX_CPLT,         // write DMA complete (interrupt)
+    SD_TRACE_CARD_READY,      // card back in TRANSFER state after busy wait
+} SdTraceEvent;
+
+#if SD_TRACE_ENABLE
+void sd_trace(uint16_t event, uint32_t arg, uint32_t count);
+#define SD_TRACE(event, arg, count)  sd_trace((event), (uint32_t)(arg), (uint32_t)(count))
+#else
+#define SD_TRACE(event, arg, count)  ((void)0)
+#endif
+
+#endif // __SD_TRACE_POINTS_H__
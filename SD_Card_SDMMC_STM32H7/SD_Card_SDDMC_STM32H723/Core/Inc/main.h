@@ -36,7 +36,7 @@ extern "C" {
 
 /* Exported types ------------------------------------------------------------*/
 /* USER CODE BEGIN ET */
-
+typedef void (*SysTick_HookTypeDef)(void);
 /* USER CODE END ET */
 
 /* Exported constants --------------------------------------------------------*/
@@ -53,7 +53,7 @@ extern "C" {
 void Error_Handler(void);
 
 /* USER CODE BEGIN EFP */
-
+void SysTick_SetHook(SysTick_HookTypeDef hook);
 /* USER CODE END EFP */
 
 /* Private defines -----------------------------------------------------------*/
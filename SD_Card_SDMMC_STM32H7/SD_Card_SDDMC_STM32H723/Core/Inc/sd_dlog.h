@@ -0,0 +1,95 @@
+#ifndef __SD_DLOG_H__
+#define __SD_DLOG_H__
+
+#include <stdint.h>
+
+// Deferred log: a call stores the message ID and the raw arguments in a
+// ring, no formatting on the device. sd_dlog_dump() prints the ring in hex
+// and tools/sd_dlog_decode.py turns it back into text.
+
+// Levels
+#define SD_DLOG_LEVEL_ERROR  1
+#define SD_DLOG_LEVEL_WARN   2
+#define SD_DLOG_LEVEL_INFO   3
+#define SD_DLOG_LEVEL_DEBUG  4
+
+// Messages above this level are compiled out, 0 = no logging at all
+#ifndef SD_DLOG_LEVEL
+#define SD_DLOG_LEVEL        SD_DLOG_LEVEL_INFO
+#endif
+
+// Ring size in records (power of two), 48 bytes each
+#define SD_DLOG_DEPTH        64
+
+// Message table, the decoder reads it from this file: append new messages
+// at the end so logs captured from older firmware still decode.
+// %s arguments are copied into the record, every other conversion takes
+// one 32-bit word.
+#define SD_DLOG_MESSAGES(X) \
+    X(SD_MSG_MOUNT_TRY,     "Attempting mount at %s...") \
+    X(SD_MSG_MOUNT_OK,      "SD card mounted successfully at %s") \
+    X(SD_MSG_MOUNT_TIME,    "Mount time: %lu ms") \
+    X(SD_MSG_CARD_TYPE,     "Card Type: %s") \
+    X(SD_MSG_CARD_VERSION,  "Card Version: %s") \
+    X(SD_MSG_CARD_CLASS,    "Card Class: %lu") \
+    X(SD_MSG_MOUNT_FAIL,    "Mount failed with code: %d") \
+    X(SD_MSG_UNMOUNT,       "SD card unmounted: %s") \
+    X(SD_MSG_WRITE,         "Write %u bytes to %s") \
+    X(SD_MSG_APPEND,        "Appended %u bytes to %s") \
+    X(SD_MSG_OPEN_FAIL,     "f_open failed with code: %d") \
+    X(SD_MSG_READ_FAIL,     "f_read failed with code: %d") \
+    X(SD_MSG_CLOSE_FAIL,    "f_close failed with code: %d") \
+    X(SD_MSG_READ,          "Read %u bytes from %s") \
+    X(SD_MSG_CSV_OPEN_FAIL, "Failed to open CSV: %s (%d)") \
+    X(SD_MSG_DELETE,        "Delete %s: %s") \
+    X(SD_MSG_RENAME,        "Rename %s to %s: %s") \
+    X(SD_MSG_MKDIR,         "Create directory %s: %s") \
+    X(SD_MSG_CSV_READ_FAIL, "CSV read failed: %s (%d)")
+
+#define SD_DLOG_ENUM(id, fmt)  id,
+typedef enum {
+    SD_MSG_NONE = 0,
+    SD_DLOG_MESSAGES(SD_DLOG_ENUM)
+    SD_MSG_COUNT
+} SdDlogMsg;
+#undef SD_DLOG_ENUM
+
+// One record
+typedef struct {
+    uint32_t tick;            // HAL_GetTick()
+    uint16_t id;              // SdDlogMsg
+    uint8_t level;
+    uint8_t truncated;        // arguments did not all fit in data
+    uint8_t data[40];         // arguments in format order, words 4-byte aligned
+} SdDlogRecord;
+
+#if SD_DLOG_LEVEL > 0
+void sd_dlog(uint8_t level, uint16_t id, ...);
+#endif
+
+#if SD_DLOG_LEVEL >= SD_DLOG_LEVEL_ERROR
+#define SD_DLOG_ERROR(id, ...)  sd_dlog(SD_DLOG_LEVEL_ERROR, (id), ##__VA_ARGS__)
+#else
+#define SD_DLOG_ERROR(id, ...)  ((void)0)
+#endif
+#if SD_DLOG_LEVEL >= SD_DLOG_LEVEL_WARN
+#define SD_DLOG_WARN(id, ...)   sd_dlog(SD_DLOG_LEVEL_WARN, (id), ##__VA_ARGS__)
+#else
+#define SD_DLOG_WARN(id, ...)   ((void)0)
+#endif
+#if SD_DLOG_LEVEL >= SD_DLOG_LEVEL_INFO
+#define SD_DLOG_INFO(id, ...)   sd_dlog(SD_DLOG_LEVEL_INFO, (id), ##__VA_ARGS__)
+#else
+#define SD_DLOG_INFO(id, ...)   ((void)0)
+#endif
+#if SD_DLOG_LEVEL >= SD_DLOG_LEVEL_DEBUG
+#define SD_DLOG_DEBUG(id, ...)  sd_dlog(SD_DLOG_LEVEL_DEBUG, (id), ##__VA_ARGS__)
+#else
+#define SD_DLOG_DEBUG(id, ...)  ((void)0)
+#endif
+
+// Control, from the application
+void sd_dlog_reset(void);
+void sd_dlog_dump(void);
+
+#endif // __SD_DLOG_H__
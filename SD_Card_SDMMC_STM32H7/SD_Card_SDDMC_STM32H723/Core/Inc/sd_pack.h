@@ -0,0 +1,60 @@
+#ifndef __SD_PACK_H__
+#define __SD_PACK_H__
+
+#include <stdint.h>
+
+// Block compression for the write path: every block becomes one frame
+// that decodes on its own (SdPackHeader, then the data). The codec is the
+// LZ4 block format with a 16-bit position hash table, optionally after a
+// byte delta filter for fixed-size sensor records. A block that does not
+// shrink is stored. tools/sd_pack_decode.py unpacks a file on the host.
+
+#define SD_PACK_MAGIC        0x4B504453U   // "SDPK"
+
+#define SD_PACK_STORED       0
+#define SD_PACK_LZ4          1
+
+// Largest block, positions in the hash table are 16-bit
+#define SD_PACK_MAX_BLOCK    65536
+
+// Hash table entries (power of two), 2 bytes each
+#define SD_PACK_HASH_LOG     12
+#define SD_PACK_HASH_SIZE    (1U << SD_PACK_HASH_LOG)
+
+// Frame size for a block of len bytes in the worst case
+#define SD_PACK_BOUND(len)   ((len) + sizeof(SdPackHeader))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t raw_size;            // bytes before packing
+    uint32_t packed_size;         // bytes after this header
+    uint8_t method;               // SD_PACK_STORED / SD_PACK_LZ4
+    uint8_t delta;                // delta filter stride in bytes, 0 = off
+    uint16_t reserved;
+} SdPackHeader;
+
+typedef struct SdPack {
+    uint16_t table[SD_PACK_HASH_SIZE];
+    uint8_t delta;
+    uint32_t blocks;
+    uint32_t stored;              // blocks that did not shrink
+    uint32_t raw_bytes;
+    uint32_t packed_bytes;        // frames, headers included
+    uint32_t cycles;              // core cycles spent packing
+} SdPack;
+
+// delta: record size for the byte delta filter (each byte minus the one
+// a record before), 0 for text or mixed data
+void sd_pack_init(SdPack *p, uint8_t delta);
+
+// Pack len bytes (up to SD_PACK_MAX_BLOCK) of src into one frame at dst.
+// src is modified when the delta filter is on. dst_size of
+// SD_PACK_BOUND(len) always fits. Returns the frame size, 0 if it does
+// not fit in dst_size.
+uint32_t sd_pack_block(SdPack *p, uint8_t *src, uint32_t len, uint8_t *dst, uint32_t dst_size);
+
+// Unpack one frame of frame_len bytes into dst. Returns the raw size, 0
+// for a damaged frame or a dst that is too small.
+uint32_t sd_unpack_block(const uint8_t *frame, uint32_t frame_len, uint8_t *dst, uint32_t dst_size);
+
+#endif // __SD_PACK_H__
@@ -0,0 +1,35 @@
+#ifndef __SD_RECORD_H__
+#define __SD_RECORD_H__
+
+#include "fatfs.h"
+#include <stdint.h>
+
+// Recording file: the whole capacity is allocated as one contiguous cluster
+// run with f_expand, then data goes straight to its sectors by DMA with no
+// FAT or directory traffic. The directory entry size is only updated at
+// checkpoints and on close. On exFAT the entry keeps the whole capacity
+// until close, so a recording cut by a power loss is capacity bytes long
+// with the data at the start.
+typedef struct SdRecord {
+    FIL file;
+    DWORD sector;                 // first sector of the run
+    DWORD sectors;                // sectors allocated
+    DWORD next;                   // sectors written so far
+    FSIZE_t size;                 // bytes recorded
+    FSIZE_t synced;               // size in the directory entry
+    uint32_t checkpoint_ms;       // 0 = only on sd_record_checkpoint / close
+    uint32_t last_checkpoint;     // HAL_GetTick() of the last checkpoint
+    volatile uint8_t busy;        // a DMA transfer is running
+    volatile DRESULT dma_res;     // result of the last transfer
+    uint8_t tail_done;            // partial last sector written, no more data
+    uint8_t keep_size;            // exFAT: entry holds the capacity until close
+    uint8_t tail[512] __attribute__((aligned(32)));
+} SdRecord;
+
+int sd_record_open(SdRecord *r, const char *filename, FSIZE_t capacity, uint32_t checkpoint_ms);
+int sd_record_write(SdRecord *r, const void *data, uint32_t len);
+int sd_record_wait(SdRecord *r);
+int sd_record_checkpoint(SdRecord *r);
+int sd_record_close(SdRecord *r);
+
+#endif // __SD_RECORD_H__
@@ -0,0 +1,24 @@
+#ifndef __SD_TRACE_H__
+#define __SD_TRACE_H__
+
+#include <stdint.h>
+#include "sd_trace_points.h"    // SdTraceEvent, SD_TRACE(), shared with FatFs and sd_diskio
+
+// Ring size in records (power of two), 12 bytes each
+#define SD_TRACE_DEPTH       512
+
+// One record, written by whoever hits the trace point (thread or ISR)
+typedef struct {
+    uint32_t cycles;          // DWT->CYCCNT
+    uint32_t arg;
+    uint16_t event;
+    uint16_t count;
+} SdTraceRecord;
+
+// Control, from the application
+void sd_trace_start(void);
+void sd_trace_stop(void);
+void sd_trace_reset(void);
+void sd_trace_dump(void);
+
+#endif // __SD_TRACE_H__
@@ -0,0 +1,114 @@
+#ifndef __SD_TSLOG_H__
+#define __SD_TSLOG_H__
+
+#include "fatfs.h"
+#include <stdint.h>
+
+// Binary time-series log: fixed-size records (a 32-bit timestamp, then
+// the payload described by a format string) packed into fixed-size blocks.
+//
+//   block 0       file header (SdTslogFileHeader, rest zero)
+//   block 1..n    data blocks: SdTslogBlockHeader, then the records
+//   block n+1..   sparse index written by sd_tslog_close
+//
+// Blocks are block_size bytes (a power of two, 512 or more) at multiples
+// of block_size in the file, so none crosses a cluster boundary when
+// block_size <= cluster size. All values little-endian. CRCs are CRC-32
+// (zlib), tools/sd_tslog_to_csv.py reads the format on the host.
+//
+// Timestamps must not go backwards. A file that was not closed has no
+// index: queries then search the block headers alone.
+
+#define SD_TSLOG_MAGIC        0x474C5354U   // "TSLG"
+#define SD_TSLOG_BLOCK_MAGIC  0x4B425354U   // "TSBK"
+#define SD_TSLOG_VERSION      1
+
+// Payload field types, like Python struct: b B h H i I f
+#define SD_TSLOG_FORMAT_MAX   16
+
+// Index entries kept in RAM while writing and reading. When the index is
+// full every other entry is dropped and the stride doubles.
+#define SD_TSLOG_INDEX_MAX    128
+
+// Fast seek link map of a reader (2 per fragment + 1)
+#define SD_TSLOG_CLMT_SIZE    33
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t header_size;         // sizeof(SdTslogFileHeader)
+    uint32_t block_size;
+    uint16_t record_size;         // timestamp included
+    uint16_t records_per_block;
+    char format[SD_TSLOG_FORMAT_MAX];
+    uint32_t blocks;              // data blocks, 0 until closed
+    uint32_t records;
+    uint32_t t_first;
+    uint32_t t_last;
+    uint32_t index_block;         // first index block, 0 = no index
+    uint32_t index_entries;
+    uint32_t index_stride;        // data blocks between index entries
+    uint32_t index_crc;           // CRC of the index entries
+    uint32_t crc;                 // CRC of the bytes above
+} SdTslogFileHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;                 // data block number, from 0
+    uint32_t t_first;
+    uint32_t t_last;
+    uint16_t count;               // records in the block
+    uint16_t record_size;
+    uint32_t crc;                 // CRC of the 20 bytes above, then the records
+} SdTslogBlockHeader;
+
+typedef struct {
+    uint32_t t_first;             // first timestamp of the block
+    uint32_t block;               // data block number
+} SdTslogIndexEntry;
+
+// Writer
+typedef struct SdTslog {
+    FIL file;
+    uint8_t *buf;                 // the block being filled
+    uint32_t fill;                // records in buf
+    SdTslogFileHeader hdr;
+    SdTslogIndexEntry index[SD_TSLOG_INDEX_MAX];
+    FRESULT res;                  // first error, later calls fail with it
+} SdTslog;
+
+int sd_tslog_open(SdTslog *w, const char *filename, const char *format, uint8_t *buf, uint32_t block_size);
+int sd_tslog_append(SdTslog *w, uint32_t t, const void *payload);
+int sd_tslog_sync(SdTslog *w);
+int sd_tslog_close(SdTslog *w);
+
+// Reader: buf holds one block (header block_size, 4-byte aligned)
+typedef struct SdTslogReader {
+    FIL file;
+    uint8_t *buf;
+    uint32_t buf_size;
+    SdTslogFileHeader hdr;        // blocks set from the file size when there is no index
+    SdTslogIndexEntry index[SD_TSLOG_INDEX_MAX];
+    DWORD clmt[SD_TSLOG_CLMT_SIZE];
+    uint32_t blocks_read;         // data blocks read by the last query
+    uint32_t headers_read;        // block headers read to find the first block
+    uint32_t bad_blocks;          // CRC errors, skipped
+} SdTslogReader;
+
+// Called per record in range, payload not aligned; non-zero stops
+typedef int (*SdTslogRecordFn)(uint32_t t, const uint8_t *payload, void *ctx);
+
+int sd_tslog_reader_open(SdTslogReader *r, const char *filename, uint8_t *buf, uint32_t buf_size);
+int sd_tslog_query(SdTslogReader *r, uint32_t t_from, uint32_t t_to,
+                   SdTslogRecordFn fn, void *ctx, uint32_t *records);
+int sd_tslog_reader_close(SdTslogReader *r);
+
+// Records with t_from <= t <= t_to as CSV (time_ms, then one column per
+// format field, floats with 3 decimals), csv_buf as for sd_csv_writer_open
+int sd_tslog_to_csv(const char *filename, const char *csv_name, uint32_t t_from, uint32_t t_to,
+                    uint8_t *buf, uint32_t buf_size, uint8_t *csv_buf, uint32_t csv_buf_size);
+
+// Payload size of a format, 0 when it holds an unknown type
+uint32_t sd_tslog_format_size(const char *format);
+
+#endif // __SD_TSLOG_H__
@@ -26,6 +26,8 @@
 #include <stdio.h>
 #include "sd_functions.h"
 #include "sd_benchmark.h"
+#include "sd_dlog.h"
+#include "console.h"
 
 /* USER CODE END Includes */
 
@@ -49,6 +51,7 @@
 SD_HandleTypeDef hsd1;
 
 UART_HandleTypeDef huart4;
+DMA_HandleTypeDef hdma_uart4_tx;
 
 DMA_HandleTypeDef hdma_dma_generator0;
 DMA_HandleTypeDef hdma_dma_generator1;
@@ -63,13 +66,14 @@ static void MX_DMA_Init(void);
 static void MX_SDMMC1_SD_Init(void);
 static void MX_UART4_Init(void);
 /* USER CODE BEGIN PFP */
+static void SD_DMA_MPU_Config(void);
 
 /*
- *	Function that print data via UART
+ *	Function that print data via UART, queued and sent by DMA
  */
 int _write(int fd, unsigned char *buf, int len) {
   if (fd == 1 || fd == 2) {
-    HAL_UART_Transmit(&huart4, buf, len, 999);  // Print to the UART
+    console_write(buf, len);  // Print to the UART
   }
   return len;
 }
@@ -89,6 +93,11 @@ int main(void)
 {
   /* USER CODE BEGIN 1 */
 
+  /* SD DMA buffers non-cacheable first, then the caches can be turned on */
+  SD_DMA_MPU_Config();
+  SCB_EnableICache();
+  SCB_EnableDCache();
+
   /* USER CODE END 1 */
 
   /* MCU Configuration--------------------------------------------------------*/
@@ -114,10 +123,18 @@ int main(void)
   MX_FATFS_Init();
   MX_UART4_Init();
   /* USER CODE BEGIN 2 */
+  console_init(&huart4);
 
   /* !ONLY test speed for read / write. for some project use sd_function */
   sd_benchmark();
 
+  /* Keep the card mounted; when FSInfo could not be trusted the free
+     space is counted a few FAT sectors at a time in the idle loop */
+  int free_pending = (sd_mount() == FR_OK);
+  /* the mount status and errors only go to the deferred log: print them
+     for tools/sd_dlog_decode.py */
+  sd_dlog_dump();
+
   /* USER CODE END 2 */
 
   /* Infinite loop */
@@ -127,6 +144,10 @@ int main(void)
     /* USER CODE END WHILE */
 
     /* USER CODE BEGIN 3 */
+    /* each call checks the card status: stop once the count is known or failed */
+    if (free_pending && sd_scan_free(SD_FREE_SCAN_STEP) != 0) free_pending = 0;
+    /* small writes left in the driver cache reach the card after SD_WRITE_CACHE_FLUSH_MS */
+    SD_WriteCache_Poll();
   }
   /* USER CODE END 3 */
 }
@@ -317,6 +338,11 @@ static void MX_DMA_Init(void)
     Error_Handler( );
   }
 
+  /* DMA interrupt init */
+  /* DMA1_Stream2_IRQn interrupt configuration */
+  HAL_NVIC_SetPriority(DMA1_Stream2_IRQn, 0, 0);
+  HAL_NVIC_EnableIRQ(DMA1_Stream2_IRQn);
+
 }
 
 /**
@@ -357,6 +383,41 @@ static void MX_GPIO_Init(void)
 
 /* USER CODE BEGIN 4 */
 
+/* start of the .sd_dma_buffer section, aligned to its size by the linker script */
+extern uint8_t _sd_dma_buffer_start[];
+
+/**
+  * @brief  Maps the SD DMA buffer region (scratch buffer and SD_DMA_BUFFER
+  *         variables) as normal non-cacheable memory, everything else keeps
+  *         the default cacheable attributes.
+  * @retval None
+  */
+static void SD_DMA_MPU_Config(void)
+{
+  MPU_Region_InitTypeDef MPU_InitStruct = {0};
+
+  /* Disables the MPU */
+  HAL_MPU_Disable();
+
+  /* SD_DMA_REGION_SIZE = 16 KB */
+  MPU_InitStruct.Enable = MPU_REGION_ENABLE;
+  MPU_InitStruct.Number = MPU_REGION_NUMBER0;
+  MPU_InitStruct.BaseAddress = (uint32_t)_sd_dma_buffer_start;
+  MPU_InitStruct.Size = MPU_REGION_SIZE_16KB;
+  MPU_InitStruct.SubRegionDisable = 0x0;
+  MPU_InitStruct.TypeExtField = MPU_TEX_LEVEL1;
+  MPU_InitStruct.AccessPermission = MPU_REGION_FULL_ACCESS;
+  MPU_InitStruct.DisableExec = MPU_INSTRUCTION_ACCESS_DISABLE;
+  MPU_InitStruct.IsShareable = MPU_ACCESS_NOT_SHAREABLE;
+  MPU_InitStruct.IsCacheable = MPU_ACCESS_NOT_CACHEABLE;
+  MPU_InitStruct.IsBufferable = MPU_ACCESS_NOT_BUFFERABLE;
+
+  HAL_MPU_ConfigRegion(&MPU_InitStruct);
+
+  /* Enables the MPU */
+  HAL_MPU_Enable(MPU_PRIVILEGED_DEFAULT);
+}
+
 /* USER CODE END 4 */
 
 /**
@@ -0,0 +1,247 @@
+#include "sd_benchmark.h"
+#include "sd_benchmark_util.h"
+#include "fatfs.h"
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sd_trace.h"
+
+#define TRACE_RECORDS        32                // small records before the traced chunk
+#define TRACE_CHUNK          4096
+
+/***************************************************************
+ * This function write data into file in small records,
+ * the way a logger does, to check the diskio write cache
+ ***************************************************************/
+
+uint32_t sd_benchmark_small_write(const char* filename, uint32_t size_bytes, UINT record_size) {
+    FIL file;
+    UINT written;
+    uint8_t record[RECORD_SIZE];
+    SD_WriteCacheStatsTypeDef stats;
+
+    if (record_size > sizeof(record)) record_size = sizeof(record);
+    memset(record, 'A', sizeof(record));
+
+    FRESULT res = f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        printf("f_open failed: %d\r\n", res);
+        return 0;
+    }
+
+    SD_WriteCache_ResetStats();
+
+    // start time
+    uint32_t start = HAL_GetTick();
+    uint32_t remaining = size_bytes;
+
+    while (remaining > 0) {
+        UINT to_write = (remaining > record_size) ? record_size : remaining;
+
+        res = f_write(&file, record, to_write, &written);
+        if (res != FR_OK || written != to_write) {
+            printf("f_write error\r\n");
+            break;
+        }
+        remaining -= written;
+    }
+
+    f_close(&file);
+
+    // end time of write operation
+    uint32_t elapsed = HAL_GetTick() - start;
+    SD_WriteCache_GetStats(&stats);
+    printf("Write %lu bytes in %u-byte records in %lu ms\r\n", (unsigned long)size_bytes, record_size, (unsigned long)elapsed);
+    printf("Write cache: %lu sectors in %lu multi-block writes\r\n", (unsigned long)stats.flushed_sectors, (unsigned long)stats.flushes);
+    return elapsed;
+}
+
+/***************************************************************
+ * This function compare multi-block write speed with and
+ * without the ACMD23 pre-erase hint
+ ***************************************************************/
+
+void sd_benchmark_pre_erase(const char* filename, uint32_t size_bytes) {
+    uint32_t t_plain, t_erase;
+
+    SD_SetPreErase(0);
+    f_unlink(filename);
+    t_plain = sd_benchmark_write(filename, size_bytes);
+
+    SD_SetPreErase(1);
+    f_unlink(filename);
+    t_erase = sd_benchmark_write(filename, size_bytes);
+
+    if (t_plain > 0) printf("Write without pre-erase: %lu KB/s\r\n", (unsigned long)((size_bytes / 1024 * 1000) / t_plain));
+    if (t_erase > 0) printf("Write with pre-erase:    %lu KB/s\r\n", (unsigned long)((size_bytes / 1024 * 1000) / t_erase));
+}
+
+/***************************************************************
+ * This function write then read a file through a buffer that
+ * is not 4-byte aligned, so every transfer goes through the
+ * diskio scratch buffer
+ ***************************************************************/
+
+void sd_benchmark_unaligned(const char* filename, uint32_t size_bytes) {
+    FIL file;
+    UINT done;
+    uint8_t *raw = bench_scratch(BUF_SIZE + 4);
+    uint8_t *buffer = raw + 1;   // deliberately misaligned
+    uint32_t remaining, start, t_write, t_read;
+
+    if (raw == NULL) return;
+    memset(raw, 0x55, BUF_SIZE + 4);
+
+    FRESULT res = f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        printf("f_open failed: %d\r\n", res);
+        return;
+    }
+
+    start = HAL_GetTick();
+    remaining = size_bytes;
+    while (remaining > 0) {
+        UINT to_write = (remaining > BUF_SIZE) ? BUF_SIZE : remaining;
+        res = f_write(&file, buffer, to_write, &done);
+        if (res != FR_OK || done != to_write) {
+            printf("f_write error\r\n");
+            break;
+        }
+        remaining -= done;
+    }
+    f_close(&file);
+    t_write = HAL_GetTick() - start;
+
+    res = f_open(&file, filename, FA_READ);
+    if (res != FR_OK) {
+        printf("f_open failed: %d\r\n", res);
+        return;
+    }
+
+    start = HAL_GetTick();
+    remaining = size_bytes;
+    while (remaining > 0) {
+        UINT to_read = (remaining > BUF_SIZE) ? BUF_SIZE : remaining;
+        res = f_read(&file, buffer, to_read, &done);
+        if (res != FR_OK || done != to_read) {
+            printf("f_read error\r\n");
+            break;
+        }
+        remaining -= done;
+    }
+    f_close(&file);
+    t_read = HAL_GetTick() - start;
+
+    if (t_write > 0) printf("Unaligned write speed: %lu KB/s\r\n", (unsigned long)((size_bytes / 1024 * 1000) / t_write));
+    if (t_read > 0) printf("Unaligned read  speed: %lu KB/s\r\n", (unsigned long)((size_bytes / 1024 * 1000) / t_read));
+}
+
+static volatile uint64_t hook_cycles;
+static volatile uint32_t hook_work;
+
+/***************************************************************
+ * Wait hook standing for application work done while the
+ * SD driver waits: counts the cycles it gets
+ ***************************************************************/
+
+static void sd_benchmark_work_hook(SD_WaitTypeDef wait) {
+    uint32_t t0 = DWT->CYCCNT;
+
+    (void)wait;
+    for (uint32_t i = 0; i < 64; i++) {
+        hook_work++;
+    }
+    hook_cycles += DWT->CYCCNT - t0;
+}
+
+/***************************************************************
+ * Write a file in BUF_SIZE calls and return the cycles they
+ * took, summed per call: the 32-bit cycle counter wraps after
+ * 7.8 s at 550 MHz, a whole slow write can take longer
+ ***************************************************************/
+
+static uint64_t cpu_free_write(const char* filename, uint8_t *buffer, uint32_t size_bytes) {
+    FIL file;
+    UINT written;
+    uint64_t cycles = 0;
+    uint32_t c0;
+
+    f_unlink(filename);
+    if (f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return 0;
+    for (uint32_t done = 0; done < size_bytes; done += BUF_SIZE) {
+        UINT to_write = (size_bytes - done > BUF_SIZE) ? BUF_SIZE : size_bytes - done;
+
+        c0 = DWT->CYCCNT;
+        FRESULT res = f_write(&file, buffer, to_write, &written);
+        cycles += DWT->CYCCNT - c0;
+        if (res != FR_OK || written != to_write) break;
+    }
+    c0 = DWT->CYCCNT;
+    f_close(&file);
+    cycles += DWT->CYCCNT - c0;
+    return cycles;
+}
+
+/***************************************************************
+ * This function measure how much CPU time is left to the
+ * application during a write, busy-wait against wait hook
+ ***************************************************************/
+
+void sd_benchmark_cpu_free(const char* filename, uint32_t size_bytes) {
+    uint64_t spin_cycles, hook_total;
+    uint8_t *buffer = bench_scratch(BUF_SIZE);
+
+    if (buffer == NULL) return;
+    memset(buffer, 0xAA, BUF_SIZE);
+    bench_timer_init();
+
+    // original driver: spin until DMA and card are done
+    SD_SetWaitHook(NULL);
+    spin_cycles = cpu_free_write(filename, buffer, size_bytes);
+
+    // event driven: the hook gets the waiting time
+    hook_cycles = 0;
+    hook_work = 0;
+    SD_SetWaitHook(sd_benchmark_work_hook);
+    hook_total = cpu_free_write(filename, buffer, size_bytes);
+
+    SD_SetWaitHook(SD_WaitSleep);
+
+    printf("Busy-wait: %lu kcycles, 0%% CPU free\r\n", (unsigned long)(spin_cycles / 1000));
+    if (hook_total > 0) {
+        printf("Wait hook: %lu kcycles, %lu kcycles free (%lu%%)\r\n",
+               (unsigned long)(hook_total / 1000), (unsigned long)(hook_cycles / 1000),
+               (unsigned long)(hook_cycles * 100 / hook_total));
+    }
+}
+
+/***************************************************************
+ * This function trace a short write / read sequence and print
+ * the ring for tools/sd_trace_decode.py
+ ***************************************************************/
+
+void sd_benchmark_trace(const char* filename) {
+    FIL file;
+    UINT done;
+    uint8_t *buffer = bench_scratch(TRACE_CHUNK);
+
+    if (buffer == NULL) return;
+    memset(buffer, 0x5A, TRACE_CHUNK);
+    if (f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE | FA_READ) != FR_OK) return;
+
+    sd_trace_reset();
+    sd_trace_start();
+    for (uint32_t i = 0; i < TRACE_RECORDS; i++) {
+        f_write(&file, buffer, RECORD_SIZE, &done);
+    }
+    f_write(&file, buffer, TRACE_CHUNK, &done);
+    f_sync(&file);
+    f_lseek(&file, 0);
+    f_read(&file, buffer, RECORD_SIZE, &done);
+    f_read(&file, buffer, TRACE_CHUNK, &done);
+    sd_trace_stop();
+
+    f_close(&file);
+    f_unlink(filename);
+    sd_trace_dump();
+}
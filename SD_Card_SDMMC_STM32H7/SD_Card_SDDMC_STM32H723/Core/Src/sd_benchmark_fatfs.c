@@ -0,0 +1,421 @@
+#include "sd_benchmark.h"
+#include "sd_benchmark_util.h"
+#include "fatfs.h"
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sd_functions.h"
+
+#define FATCACHE_DIR         "bench_fatc"
+#define ALLOC_DIR            "bench_alloc"
+#define ALLOC_MAX_EXTENT     0x7FFFFFFFU       // keep fill files below the FAT32 size limit
+#define BOOT_FILE            "bench_boot.txt"
+#define BOOT_SCAN_STEP       64                // FAT sectors counted at mount
+#define SEEK_FILE            "bench_seek.bin"
+#define SEEK_OPS             200
+#define SEEK_MIN_SIZE        (16U * 1024 * 1024)
+#define SEEK_MAX_SIZE        (2048U * 1024 * 1024)   // below the FAT32 4 GB file limit
+#define DIRIDX_DIR           "bench_dir"
+#define DIRIDX_OPENS         100
+#define CREATE_CHUNK         1000              // files per latency report
+#define CREATE_DIR           "bench_create"
+
+extern FATFS fs;
+
+// sector I/Os since mount (0 without the FAT cache, which counts them)
+static uint32_t bench_io(void) {
+    FSSTATS st;
+
+    return (f_getstats(SDPath, &st) == FR_OK) ? st.n_io : 0;
+}
+
+/***************************************************************
+ * This function write many small files with the FAT cache off
+ * (FAT through win[]) then on, and print the sector I/Os
+ ***************************************************************/
+
+#if _FS_FATCACHE
+static uint32_t fatcache_run(uint32_t files, UINT slots, uint32_t* ms) {
+    FIL file;
+    UINT done;
+    char name[32];
+    uint8_t buffer[512] __attribute__((aligned(32)));
+    uint32_t start, i;
+    FSSTATS st;
+    FRESULT res;
+
+    memset(buffer, 0xC3, sizeof(buffer));
+
+    // remount so the cache starts empty, then pick the mode
+    if (f_mount(&fs, SDPath, 1) != FR_OK) return 0;
+    if (f_setopt(SDPath, FO_FATCACHE, slots) != FR_OK) return 0;
+
+    start = HAL_GetTick();
+    res = f_mkdir(FATCACHE_DIR);
+    for (i = 0; i < files && (res == FR_OK || res == FR_EXIST); i++) {
+        snprintf(name, sizeof(name), FATCACHE_DIR "/s%05lu.bin", (unsigned long)i);
+        res = f_open(&file, name, FA_CREATE_ALWAYS | FA_WRITE);
+        if (res == FR_OK) {
+            res = f_write(&file, buffer, sizeof(buffer), &done);
+            f_close(&file);
+        }
+    }
+    for (i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), FATCACHE_DIR "/s%05lu.bin", (unsigned long)i);
+        f_unlink(name);
+    }
+    f_unlink(FATCACHE_DIR);
+    *ms = HAL_GetTick() - start;
+
+    if (f_getstats(SDPath, &st) != FR_OK) return 0;
+    printf("FAT cache %u slots: %lu files, %lu sector I/Os, hit %lu, miss %lu, %lu ms\r\n",
+           slots, (unsigned long)files, (unsigned long)st.n_io, (unsigned long)st.fc_hit, (unsigned long)st.fc_miss, (unsigned long)(*ms));
+    return st.n_io;
+}
+#endif
+
+void sd_benchmark_fatcache(uint32_t files) {
+#if _FS_FATCACHE
+    uint32_t ms_off, ms_on;
+    uint32_t io_off = fatcache_run(files, 0, &ms_off);
+    uint32_t io_on = fatcache_run(files, _FS_FATCACHE_SLOTS, &ms_on);
+
+    if (io_off > 0 && io_on > 0) printf("FAT cache: %lu%% of the sector I/Os without it\r\n", (unsigned long)(io_on * 100 / io_off));
+#else
+    (void)files;
+    printf("FAT cache disabled (_FS_FATCACHE 0)\r\n");
+#endif
+}
+
+/***************************************************************
+ * This function fragment the free space (one free cluster every
+ * 1/holes of the volume) and time new one-cluster files with the
+ * FAT scan then with the free cluster bitmap
+ ***************************************************************/
+
+#if _FS_FATBITMAP
+static FRESULT alloc_fragment(uint32_t holes, FSIZE_t extent) {
+    FIL file;
+    UINT done;
+    char name[32];
+    uint8_t byte = 0;
+    FRESULT res = f_mkdir(ALLOC_DIR);
+
+    if (res == FR_EXIST) res = FR_OK;
+    // hole file then fill file, so each hole sits in front of one fill extent
+    for (uint32_t i = 0; i < holes && res == FR_OK; i++) {
+        snprintf(name, sizeof(name), ALLOC_DIR "/h%03lu.bin", (unsigned long)i);
+        res = f_open(&file, name, FA_CREATE_ALWAYS | FA_WRITE);
+        if (res != FR_OK) break;
+        res = f_write(&file, &byte, 1, &done);
+        f_close(&file);
+        snprintf(name, sizeof(name), ALLOC_DIR "/f%03lu.bin", (unsigned long)i);
+        if (res == FR_OK) res = f_open(&file, name, FA_CREATE_ALWAYS | FA_WRITE);
+        if (res != FR_OK) break;
+        res = f_lseek(&file, extent);   // allocates the extent without writing data
+        f_close(&file);
+    }
+    for (uint32_t i = 0; i < holes; i++) {
+        snprintf(name, sizeof(name), ALLOC_DIR "/h%03lu.bin", (unsigned long)i);
+        f_unlink(name);
+    }
+    return res;
+}
+
+static void alloc_run(const char* test, BYTE bitmap, uint32_t holes, uint8_t* buffer) {
+    FIL file;
+    UINT done;
+    char name[32];
+    DWORD nclst;
+    FATFS* pfs;
+    FSSTATS st;
+    uint32_t t, io;
+    FRESULT res = FR_OK;
+
+    // boot-time state: remount then the full FAT scan of sd_get_space_kb
+    if (f_mount(&fs, SDPath, 1) != FR_OK) return;
+    f_setopt(SDPath, FO_FREECNT, 0);
+    if (f_getfree(SDPath, &nclst, &pfs) != FR_OK) return;
+    if (f_getstats(SDPath, &st) != FR_OK) return;
+    f_setopt(SDPath, FO_FATBITMAP, bitmap);
+    f_setopt(SDPath, FO_LASTCLST, st.n_clst + 1);     // allocation hint at the end: every search wraps
+    io = st.n_io;
+
+    bench_lat_reset();
+    for (uint32_t i = 0; i < holes && res == FR_OK; i++) {
+        snprintf(name, sizeof(name), ALLOC_DIR "/n%03lu.bin", (unsigned long)i);
+        t = DWT->CYCCNT;
+        res = f_open(&file, name, FA_CREATE_ALWAYS | FA_WRITE);
+        if (res == FR_OK) {
+            res = f_write(&file, buffer, 512, &done);
+            if (f_close(&file) != FR_OK && res == FR_OK) res = FR_DISK_ERR;
+        }
+        bench_lat_add(bench_us_since(t));
+    }
+    io = bench_io() - io;
+    if (res == FR_OK) bench_report(test, 512, holes * 512, 0);
+    printf("BENCH_INFO,%s,clusters,%lu,free,%lu,sector_io,%lu\r\n", test, (unsigned long)st.n_clst,
+           (unsigned long)nclst, (unsigned long)io);
+
+    for (uint32_t i = 0; i < holes; i++) {
+        snprintf(name, sizeof(name), ALLOC_DIR "/n%03lu.bin", (unsigned long)i);
+        f_unlink(name);
+    }
+}
+#endif
+
+void sd_benchmark_alloc(uint32_t holes) {
+#if _FS_FATBITMAP
+    uint8_t buffer[512] __attribute__((aligned(32)));
+    char name[32];
+    DWORD nclst;
+    FATFS* pfs;
+    FSSTATS st;
+    FSIZE_t extent;
+
+    memset(buffer, 0x3C, sizeof(buffer));
+    bench_timer_init();
+    if (f_getfree(SDPath, &nclst, &pfs) != FR_OK || f_getstats(SDPath, &st) != FR_OK) return;
+    if (st.fs_type == FS_EXFAT || nclst <= holes * 2) {
+        printf("Allocation benchmark needs a FAT volume with free space\r\n");
+        return;
+    }
+    extent = (FSIZE_t)((nclst - holes) / holes - 1) * st.csize * _MAX_SS;
+    if (extent > ALLOC_MAX_EXTENT) extent = ALLOC_MAX_EXTENT;
+
+    if (alloc_fragment(holes, extent) == FR_OK) {
+        alloc_run("alloc_scan", 0, holes, buffer);
+        alloc_run("alloc_bitmap", 1, holes, buffer);
+    }
+
+    for (uint32_t i = 0; i < holes; i++) {
+        snprintf(name, sizeof(name), ALLOC_DIR "/f%03lu.bin", (unsigned long)i);
+        f_unlink(name);
+    }
+    f_unlink(ALLOC_DIR);
+#else
+    (void)holes;
+    printf("Free cluster bitmap disabled (_FS_FATBITMAP 0)\r\n");
+#endif
+}
+
+/***************************************************************
+ * This function time mount to first write: with the FSInfo free
+ * count, with a count that is not trusted (power loss) and the
+ * full FAT scan, and with the same count left to f_scanfree steps
+ ***************************************************************/
+
+static void boot_run(const char* test, uint8_t trusted, uint8_t full_scan) {
+    FIL file;
+    UINT done;
+    DWORD nclst;
+    FATFS* pfs;
+    uint8_t byte = '\n';
+    uint32_t t, us, io;
+    FRESULT res;
+
+    t = DWT->CYCCNT;
+    res = f_mount(&fs, SDPath, 1);
+    if (res != FR_OK) return;
+    if (!trusted) f_setopt(SDPath, FO_FREECNT, 0);  // as if the clean shutdown bit was found cleared
+    io = bench_io();
+    res = full_scan ? f_getfree(SDPath, &nclst, &pfs) : f_scanfree(SDPath, BOOT_SCAN_STEP, &nclst);
+    if (res == FR_OK) res = f_open(&file, BOOT_FILE, FA_OPEN_APPEND | FA_WRITE);
+    if (res == FR_OK) {
+        res = f_write(&file, &byte, 1, &done);
+        f_close(&file);
+    }
+    us = bench_us_since(t);
+    io = bench_io() - io;
+    f_syncvol(SDPath);  // clean shutdown point: the next mount may trust FSInfo
+    if (res == FR_OK) {
+        printf("BENCH_INFO,%s,mount_to_write_us,%lu,sector_io,%lu,free_known,%u\r\n",
+               test, (unsigned long)us, (unsigned long)io, nclst != 0xFFFFFFFF);
+    }
+}
+
+void sd_benchmark_boot(void) {
+    bench_timer_init();
+    // the full scan run also leaves a valid FSInfo count for the next mount
+    boot_run("boot_full_scan", 0, 1);
+    boot_run("boot_fsinfo", 1, 0);
+    boot_run("boot_chunked_scan", 0, 0);
+    while (sd_scan_free(BOOT_SCAN_STEP) == 0) {
+        // idle loop work would go here
+    }
+    f_unlink(BOOT_FILE);
+}
+
+/***************************************************************
+ * This function grow one file from 16 MB to 2 GB and time random
+ * 512-byte reads at each size, following the FAT chain and with
+ * the automatic cluster link map
+ ***************************************************************/
+
+#if _FS_AUTOCLMT
+static void seek_run(const char* test, uint8_t clmt, uint8_t* buffer) {
+    FIL file;
+    UINT done;
+    uint32_t t, bytes = 0, fragments = 0;
+    // write access keeps the automatic link map off, as if every map was in use
+    FRESULT res = f_open(&file, SEEK_FILE, clmt ? FA_READ : FA_READ | FA_WRITE);
+    if (res != FR_OK) return;
+
+    FSIZE_t sectors = f_size(&file) / 512;
+    bench_rand_seed();
+    bench_lat_reset();
+    for (uint32_t i = 0; i < SEEK_OPS && res == FR_OK; i++) {
+        FSIZE_t ofs = (FSIZE_t)(bench_rand() % sectors) * 512;
+
+        done = 0;
+        t = DWT->CYCCNT;
+        res = f_lseek(&file, ofs);
+        if (res == FR_OK) res = f_read(&file, buffer, 512, &done);
+        bench_lat_add(bench_us_since(t));
+        if (res == FR_OK && done != 512) res = FR_INT_ERR;
+        bytes += done;
+    }
+    if (file.cltbl) fragments = (file.cltbl[0] - 2) / 2;
+    f_close(&file);
+    if (res == FR_OK) {
+        bench_report(test, 512, bytes, 0);
+        printf("BENCH_INFO,%s,file_mb,%lu,fragments,%lu\r\n", test, (unsigned long)((uint32_t)(sectors / 2048)), (unsigned long)fragments);
+    }
+}
+#endif
+
+void sd_benchmark_seek(void) {
+#if _FS_AUTOCLMT
+    FIL file;
+    uint8_t buffer[512] __attribute__((aligned(32)));
+    FRESULT res = FR_OK;
+
+    bench_timer_init();
+    for (uint32_t size = SEEK_MIN_SIZE; size <= SEEK_MAX_SIZE && res == FR_OK; size *= 2) {
+        // grow the chain without writing data
+        res = f_open(&file, SEEK_FILE, FA_OPEN_ALWAYS | FA_WRITE);
+        if (res != FR_OK) break;
+        res = f_lseek(&file, size);
+        if (res == FR_OK && f_size(&file) != size) res = FR_DENIED;   // disk full
+        if (f_close(&file) != FR_OK && res == FR_OK) res = FR_DISK_ERR;
+        if (res != FR_OK) break;
+
+        seek_run("seek_chain", 0, buffer);
+        seek_run("seek_clmt", 1, buffer);
+        if (size == SEEK_MAX_SIZE) break;
+    }
+    f_unlink(SEEK_FILE);
+#else
+    printf("Automatic fast seek disabled (_FS_AUTOCLMT 0)\r\n");
+#endif
+}
+
+/***************************************************************
+ * This function time creating, opening and deleting rotated log
+ * names in one directory of growing size, with linear directory
+ * search and with the directory index
+ ***************************************************************/
+
+#if _FS_DIRINDEX && _FS_FATCACHE
+static const uint32_t diridx_sizes[] = { 100, 500, 1000 };
+
+// ms: linear runs on large directories outlast the DWT counter
+static void diridx_report(const char* test, uint32_t files, uint32_t ops, uint32_t ms, uint32_t io) {
+    uint32_t rate = ms ? ops * 1000 / ms : 0;
+    printf("BENCH_INFO,%s,files,%lu,ops,%lu,ms,%lu,ops_per_s,%lu,sector_io,%lu\r\n",
+           test, (unsigned long)files, (unsigned long)ops, (unsigned long)ms, (unsigned long)rate, (unsigned long)io);
+}
+
+static void diridx_run(uint32_t files, BYTE index) {
+    FIL file;
+    char name[40];
+    uint32_t t, io, i;
+    FRESULT res;
+
+    if (f_mkdir(DIRIDX_DIR) != FR_OK) return;
+    f_setopt(SDPath, FO_DIRINDEX, index);
+
+    io = bench_io();
+    t = HAL_GetTick();
+    for (i = 0, res = FR_OK; i < files && res == FR_OK; i++) {
+        snprintf(name, sizeof(name), DIRIDX_DIR "/log_%05lu.txt", (unsigned long)i);
+        res = f_open(&file, name, FA_CREATE_NEW | FA_WRITE);
+        if (res == FR_OK) res = f_close(&file);
+    }
+    if (res == FR_OK) diridx_report(index ? "dir_create_index" : "dir_create_linear", files, files, HAL_GetTick() - t, bench_io() - io);
+
+    bench_rand_seed();
+    io = bench_io();
+    t = HAL_GetTick();
+    for (i = 0; i < DIRIDX_OPENS && res == FR_OK; i++) {
+        snprintf(name, sizeof(name), DIRIDX_DIR "/log_%05lu.txt", (unsigned long)(bench_rand() % files));
+        res = f_open(&file, name, FA_READ);
+        if (res == FR_OK) res = f_close(&file);
+    }
+    if (res == FR_OK) diridx_report(index ? "dir_open_index" : "dir_open_linear", files, DIRIDX_OPENS, HAL_GetTick() - t, bench_io() - io);
+
+    // oldest first, the way log rotation deletes
+    io = bench_io();
+    t = HAL_GetTick();
+    for (i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), DIRIDX_DIR "/log_%05lu.txt", (unsigned long)i);
+        if (f_unlink(name) != FR_OK) res = FR_INT_ERR;
+    }
+    if (res == FR_OK) diridx_report(index ? "dir_delete_index" : "dir_delete_linear", files, files, HAL_GetTick() - t, bench_io() - io);
+
+    f_unlink(DIRIDX_DIR);
+    f_setopt(SDPath, FO_DIRINDEX, 1);
+}
+#endif
+
+void sd_benchmark_dirindex(void) {
+#if _FS_DIRINDEX && _FS_FATCACHE
+    FSSTATS st;
+
+    if (f_getstats(SDPath, &st) != FR_OK || st.fs_type == FS_EXFAT) {
+        printf("Directory index benchmark needs a FAT volume\r\n");
+        return;
+    }
+    for (uint32_t i = 0; i < sizeof(diridx_sizes) / sizeof(diridx_sizes[0]); i++) {
+        diridx_run(diridx_sizes[i], 0);
+        diridx_run(diridx_sizes[i], 1);
+    }
+#else
+    printf("Directory index disabled (_FS_DIRINDEX 0)\r\n");
+#endif
+}
+
+/***************************************************************
+ * This function create numbered log files whose names all need
+ * a numbered short name, and print the create latency of every
+ * CREATE_CHUNK files, which stays flat as the directory fills
+ ***************************************************************/
+
+void sd_benchmark_create(uint32_t files) {
+    FIL file;
+    char name[48];
+    uint32_t t, i;
+    FRESULT res = f_mkdir(CREATE_DIR);
+
+    if (res != FR_OK) return;
+    bench_timer_init();
+    bench_lat_reset();
+    for (i = 0; i < files && res == FR_OK; i++) {
+        snprintf(name, sizeof(name), CREATE_DIR "/sensor_log_%06lu.csv", (unsigned long)i);
+        t = DWT->CYCCNT;
+        res = f_open(&file, name, FA_CREATE_NEW | FA_WRITE);
+        if (res == FR_OK) res = f_close(&file);
+        bench_lat_add(bench_us_since(t));
+        if ((i + 1) % CREATE_CHUNK == 0) {
+            bench_report("create_numname", i + 1, 0, 0);
+            bench_lat_reset();
+        }
+    }
+    if (res != FR_OK) printf("create failed at %lu: %d\r\n", (unsigned long)i, res);
+
+    for (i = 0; i < files; i++) {
+        snprintf(name, sizeof(name), CREATE_DIR "/sensor_log_%06lu.csv", (unsigned long)i);
+        f_unlink(name);
+    }
+    f_unlink(CREATE_DIR);
+}
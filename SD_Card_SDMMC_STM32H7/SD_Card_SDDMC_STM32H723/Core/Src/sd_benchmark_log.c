@@ -0,0 +1,379 @@
+#include "sd_benchmark.h"
+#include "sd_benchmark_util.h"
+#include "fatfs.h"
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sd_functions.h"
+#include "sd_stream.h"
+#include "sd_record.h"
+#include "sd_queue.h"
+#include "sd_pack.h"
+
+#define STREAM_BUFS          4
+#define REC_BUF_SIZE         32768             // per ping-pong buffer
+#define REC_CHECKPOINT_MS    1000
+#define QUEUE_RING_SIZE      16384             // power of two
+#define QUEUE_CHUNK_SIZE     8192
+#define PACK_STREAM_SIZE     (4 * 1024 * 1024) // raw bytes per stream run
+#define PACK_STREAM_BUFS     2
+#define PACK_CODEC_BLOCKS    64
+#define PACK_SENSOR_SIZE     12                // tick, x, y, z, status
+
+/***************************************************************
+ * This function stream records through the ping-pong writer:
+ * records go into one buffer while the others are written
+ ***************************************************************/
+
+uint32_t sd_benchmark_stream(const char* filename, uint32_t size_bytes) {
+    SdStream stream;
+    uint8_t *pool = bench_scratch(STREAM_BUF_SIZE * STREAM_BUFS);
+    uint32_t produced = 0;
+
+    if (pool == NULL) return 0;
+    if (sd_stream_open(&stream, filename, pool, STREAM_BUF_SIZE, STREAM_BUFS) != FR_OK) return 0;
+
+    // start time
+    uint32_t start = HAL_GetTick();
+
+    while (produced < size_bytes) {
+        uint8_t *rec = sd_stream_acquire(&stream, RECORD_SIZE);
+        if (rec == NULL) {
+            // all buffers full: the card is the bottleneck
+            if (sd_stream_service(&stream) != FR_OK) break;
+            continue;
+        }
+        memset(rec, 'S', RECORD_SIZE);
+        sd_stream_commit(&stream, RECORD_SIZE);
+        produced += RECORD_SIZE;
+
+        if (stream.filled != stream.drained && sd_stream_service(&stream) != FR_OK) break;
+    }
+
+    sd_stream_close(&stream);
+
+    // end time of write operation
+    uint32_t elapsed = HAL_GetTick() - start;
+    printf("Stream %lu bytes in %lu ms\r\n", (unsigned long)produced, (unsigned long)elapsed);
+    return elapsed;
+}
+
+/***************************************************************
+ * This function compare appending records with open / seek /
+ * write / close per record (the sd_append_file pattern) against
+ * one sd_log handle kept open
+ ***************************************************************/
+
+void sd_benchmark_log(const char* filename, uint32_t appends) {
+    FIL file;
+    UINT bw;
+    SdLog log;
+    char record[RECORD_SIZE];
+    uint8_t *buf = bench_scratch(LOG_BUF_SIZE);
+    uint32_t start, t_reopen, t_log;
+
+    if (buf == NULL) return;
+    memset(record, 'L', sizeof(record));
+    record[sizeof(record) - 2] = '\r';
+    record[sizeof(record) - 1] = '\n';
+
+    // open / seek / write / close per append
+    f_unlink(filename);
+    start = HAL_GetTick();
+    for (uint32_t i = 0; i < appends; i++) {
+        if (f_open(&file, filename, FA_OPEN_ALWAYS | FA_WRITE) != FR_OK) break;
+        f_lseek(&file, f_size(&file));
+        f_write(&file, record, sizeof(record), &bw);
+        f_close(&file);
+    }
+    t_reopen = HAL_GetTick() - start;
+
+    // persistent handle, batched
+    f_unlink(filename);
+    start = HAL_GetTick();
+    if (sd_log_open(&log, filename, buf, LOG_BUF_SIZE, 1000) == FR_OK) {
+        for (uint32_t i = 0; i < appends; i++) {
+            if (sd_log_append(&log, record, sizeof(record)) != FR_OK) break;
+        }
+        sd_log_close(&log);
+    }
+    t_log = HAL_GetTick() - start;
+
+    f_unlink(filename);
+    printf("%lu appends of %u bytes: open/seek/write/close %lu ms, sd_log %lu ms\r\n",
+           (unsigned long)appends, (unsigned)sizeof(record), (unsigned long)t_reopen, (unsigned long)t_log);
+    if (t_reopen > 0) printf("Reopen per append: %lu appends/s\r\n", (unsigned long)(appends * 1000 / t_reopen));
+    if (t_log > 0) printf("sd_log:            %lu appends/s\r\n", (unsigned long)(appends * 1000 / t_log));
+}
+
+/***************************************************************
+ * This function record size_bytes into a preallocated contiguous
+ * file, filling one buffer while the other goes out by DMA, and
+ * compare with f_write of the same data
+ ***************************************************************/
+
+void sd_benchmark_record(const char* filename, uint32_t size_bytes) {
+    SdRecord rec;
+    uint8_t (*buffers)[REC_BUF_SIZE] = bench_scratch(2 * REC_BUF_SIZE);
+    uint32_t remaining = size_bytes;
+    uint32_t n = 0;
+
+    if (buffers == NULL) return;
+    FRESULT res = sd_record_open(&rec, filename, size_bytes, REC_CHECKPOINT_MS);
+    if (res != FR_OK) {
+        printf("sd_record_open failed: %d\r\n", res);
+        return;
+    }
+
+    uint32_t start = HAL_GetTick();
+    while (remaining > 0 && res == FR_OK) {
+        uint32_t len = (remaining > REC_BUF_SIZE) ? REC_BUF_SIZE : remaining;
+
+        // producer: fill the free buffer while the other one is written
+        memset(buffers[n & 1], (uint8_t)n, len);
+        res = sd_record_write(&rec, buffers[n & 1], len);
+        remaining -= len;
+        n++;
+    }
+    FRESULT res_close = sd_record_close(&rec);
+    if (res == FR_OK) res = res_close;
+    uint32_t t_rec = HAL_GetTick() - start;
+
+    f_unlink(filename);
+    if (res != FR_OK) {
+        printf("sd_record_write failed: %d\r\n", res);
+        return;
+    }
+
+    uint32_t t_write = sd_benchmark_write(filename, size_bytes);
+    f_unlink(filename);
+
+    printf("Record %lu bytes: sd_record %lu ms, f_write %lu ms\r\n", (unsigned long)size_bytes, (unsigned long)t_rec,
+           (unsigned long)t_write);
+    if (t_rec > 0) printf("sd_record: %lu KB/s\r\n", (unsigned long)((size_bytes / 1024 * 1000) / t_rec));
+    if (t_write > 0) printf("f_write:   %lu KB/s\r\n", (unsigned long)((size_bytes / 1024 * 1000) / t_write));
+}
+
+/***************************************************************
+ * This function push RECORD_SIZE records from the main loop
+ * while SysTick pushes a timestamp record every ms, drain both
+ * into one file and print the push cost, drops and ring
+ * high-watermark
+ ***************************************************************/
+
+static SdQueue *volatile tick_queue;
+static uint32_t tick_records;
+
+// SysTick hook: a second producer at interrupt level
+static void queue_tick(void) {
+    SdQueue *q = tick_queue;
+
+    if (q != NULL) {
+        uint32_t rec[4] = { HAL_GetTick(), tick_records++, DWT->CYCCNT, 0 };
+        sd_queue_push(q, rec, sizeof(rec));
+    }
+}
+
+void sd_benchmark_queue(const char* filename, uint32_t size_bytes) {
+    SdQueue queue;
+    uint8_t *ring = bench_scratch(QUEUE_RING_SIZE + QUEUE_CHUNK_SIZE);
+    uint8_t *chunk = ring + QUEUE_RING_SIZE;     // still 32-byte aligned
+    uint8_t record[RECORD_SIZE];
+    uint32_t produced = 0, pushes = 0, cycles = 0, max_cycles = 0;
+    FRESULT res = FR_OK;
+
+    if (ring == NULL) return;
+    if (sd_queue_open(&queue, filename, ring, QUEUE_RING_SIZE, chunk, QUEUE_CHUNK_SIZE) != FR_OK) return;
+    bench_timer_init();
+    memset(record, 'Q', sizeof(record));
+    tick_records = 0;
+    tick_queue = &queue;
+    SysTick_SetHook(queue_tick);
+
+    uint32_t start = HAL_GetTick();
+    while (produced < size_bytes && res == FR_OK) {
+        uint32_t t = DWT->CYCCNT;
+        int ok = sd_queue_push(&queue, record, RECORD_SIZE);
+        t = DWT->CYCCNT - t;
+
+        cycles += t;
+        if (t > max_cycles) max_cycles = t;
+        pushes++;
+        if (ok) produced += RECORD_SIZE;
+
+        if (queue.head - queue.tail >= QUEUE_CHUNK_SIZE) res = sd_queue_service(&queue);
+    }
+    SysTick_SetHook(NULL);
+    tick_queue = NULL;
+    FRESULT res_close = sd_queue_close(&queue);
+    if (res == FR_OK) res = res_close;
+    uint32_t elapsed = HAL_GetTick() - start;
+
+    f_unlink(filename);
+    if (res != FR_OK) {
+        printf("sd_queue failed: %d\r\n", res);
+        return;
+    }
+    printf("BENCH_INFO,queue,records,%lu,tick_records,%lu,dropped,%lu,high_water,%lu,ring,%lu,"
+           "push_avg_cycles,%lu,push_max_cycles,%lu,ms,%lu\r\n",
+           (unsigned long)queue.records, (unsigned long)tick_records, (unsigned long)queue.dropped,
+           (unsigned long)queue.high_water, (unsigned long)queue.size,
+           (unsigned long)(cycles / pushes), (unsigned long)max_cycles, (unsigned long)elapsed);
+    if (elapsed > 0) printf("Queue write speed: %lu KB/s\r\n", (unsigned long)((queue.bytes / 1024 * 1000) / elapsed));
+}
+
+/***************************************************************
+ * This function measure the sd_pack stage: the codec alone on
+ * text log lines and on binary sensor records (with and without
+ * the delta filter), then the same data streamed to the card
+ * through SdStream with and without packing
+ * in/out are raw and packed KB/s, cpu the share of the elapsed
+ * time spent packing
+ ***************************************************************/
+
+typedef enum { PACK_TEXT, PACK_SENSOR } PackData;
+
+static const struct {
+    const char* name;
+    PackData data;
+    uint8_t delta;
+} pack_cases[] = {
+    { "text",         PACK_TEXT,   0 },
+    { "sensor",       PACK_SENSOR, 0 },
+    { "sensor_delta", PACK_SENSOR, PACK_SENSOR_SIZE },
+};
+
+// Fill len bytes with whole records, returns the bytes used
+static uint32_t pack_fill(PackData data, uint8_t* dst, uint32_t len, uint32_t* seq) {
+    static int16_t axis[3];
+    uint32_t used = 0;
+
+    if (*seq == 0) {
+        axis[0] = 0;
+        axis[1] = 0;
+        axis[2] = 1000;
+    }
+
+    if (data == PACK_TEXT) {
+        char line[RECORD_SIZE + 1];
+        for (;;) {
+            int n = snprintf(line, sizeof(line), "%08lu,sensor_%02lu,%ld,OK\r\n",
+                             (unsigned long)(*seq * 10), (unsigned long)(*seq % 16), (long)(bench_rand() % 1000) - 500);
+            if (used + n > len) break;
+            memcpy(dst + used, line, n);
+            used += n;
+            (*seq)++;
+        }
+    } else {
+        while (used + PACK_SENSOR_SIZE <= len) {
+            uint32_t t = *seq * 10;
+            uint16_t status = 0;
+            for (int i = 0; i < 3; i++) axis[i] += (int16_t)(bench_rand() % 7) - 3;
+            memcpy(dst + used, &t, 4);
+            memcpy(dst + used + 4, axis, 6);
+            memcpy(dst + used + 10, &status, 2);
+            used += PACK_SENSOR_SIZE;
+            (*seq)++;
+        }
+    }
+    return used;
+}
+
+static void pack_codec(const char* name, PackData data, uint8_t delta, SdPack* pack,
+                       uint8_t* raw, uint8_t* work, uint8_t* frame, uint32_t frame_size) {
+    uint32_t seq = 0, unpack_cycles = 0, raw_bytes = 0, errors = 0;
+    uint32_t mhz = SystemCoreClock / 1000000U, pack_us, unpack_us;
+    char test[32];
+
+    sd_pack_init(pack, delta);
+    bench_rand_seed();
+    for (uint32_t i = 0; i < PACK_CODEC_BLOCKS; i++) {
+        uint32_t len = pack_fill(data, raw, STREAM_BUF_SIZE, &seq);
+        uint32_t n, t;
+
+        memcpy(work, raw, len);
+        n = sd_pack_block(pack, work, len, frame, frame_size);
+        t = DWT->CYCCNT;
+        if (n == 0 || sd_unpack_block(frame, n, work, STREAM_BUF_SIZE) != len || memcmp(work, raw, len) != 0) errors++;
+        unpack_cycles += DWT->CYCCNT - t;
+        raw_bytes += len;
+    }
+
+    pack_us = pack->cycles / mhz;
+    unpack_us = unpack_cycles / mhz;
+    snprintf(test, sizeof(test), "pack_codec_%s", name);
+    printf("BENCH_INFO,%s,raw,%lu,packed,%lu,ratio_x100,%lu,in_kbps,%lu,out_kbps,%lu,cycles_per_kb,%lu,unpack_kbps,%lu,stored,%lu,errors,%lu\r\n",
+           test, (unsigned long)raw_bytes, (unsigned long)pack->packed_bytes,
+           (unsigned long)(pack->packed_bytes ? raw_bytes * 100 / pack->packed_bytes : 0),
+           (unsigned long)(pack_us ? (uint32_t)((uint64_t)raw_bytes * 1000000U / 1024U / pack_us) : 0),
+           (unsigned long)(pack_us ? (uint32_t)((uint64_t)pack->packed_bytes * 1000000U / 1024U / pack_us) : 0),
+           (unsigned long)(raw_bytes ? (uint32_t)((uint64_t)pack->cycles * 1024U / raw_bytes) : 0),
+           (unsigned long)(unpack_us ? (uint32_t)((uint64_t)raw_bytes * 1000000U / 1024U / unpack_us) : 0),
+           (unsigned long)pack->stored, (unsigned long)errors);
+}
+
+static void pack_stream(const char* filename, const char* name, PackData data, uint8_t delta, SdPack* pack,
+                        uint8_t* pool, uint8_t* out, uint32_t out_size) {
+    SdStream stream;
+    uint32_t seq = 0, produced = 0, start, ms;
+    char test[32];
+
+    if (sd_stream_open(&stream, filename, pool, STREAM_BUF_SIZE, PACK_STREAM_BUFS) != FR_OK) return;
+    if (pack != NULL) {
+        sd_pack_init(pack, delta);
+        if (sd_stream_set_pack(&stream, pack, out, out_size) != FR_OK) {
+            sd_stream_close(&stream);
+            return;
+        }
+    }
+
+    bench_rand_seed();
+    start = HAL_GetTick();
+    while (produced < PACK_STREAM_SIZE) {
+        // one buffer worth of records at a time, the way a logger task fills it
+        uint8_t* buf = sd_stream_acquire(&stream, STREAM_BUF_SIZE);
+        if (buf == NULL) {
+            if (sd_stream_service(&stream) != FR_OK) break;
+            continue;
+        }
+        uint32_t len = pack_fill(data, buf, STREAM_BUF_SIZE, &seq);
+        sd_stream_commit(&stream, len);   // the next acquire hands the buffer over
+        produced += len;
+        if (sd_stream_service(&stream) != FR_OK) break;
+    }
+    sd_stream_close(&stream);
+    ms = HAL_GetTick() - start;
+
+    snprintf(test, sizeof(test), "pack_stream_%s%s", pack ? "" : "plain_", name);
+    printf("BENCH_INFO,%s,raw,%lu,file,%lu,ms,%lu,in_kbps,%lu,out_kbps,%lu,cpu_pct,%lu\r\n",
+           test, (unsigned long)produced, (unsigned long)stream.bytes_written, (unsigned long)ms,
+           (unsigned long)(ms ? produced / 1024 * 1000 / ms : 0), (unsigned long)(ms ? stream.bytes_written / 1024 * 1000 / ms : 0),
+           (unsigned long)((pack && ms) ? (uint32_t)((uint64_t)pack->cycles * 100U / ((uint64_t)ms * (SystemCoreClock / 1000U))) : 0));
+    f_unlink(filename);
+}
+
+typedef struct {
+    uint8_t pool[STREAM_BUF_SIZE * PACK_STREAM_BUFS];
+    uint8_t out[SD_STREAM_PACK_OUT_SIZE(STREAM_BUF_SIZE)];
+    SdPack pack;
+} PackScratch;
+
+void sd_benchmark_pack(const char* filename) {
+    PackScratch *s = bench_scratch(sizeof(PackScratch));
+
+    if (s == NULL) return;
+    bench_timer_init();
+    printf("BENCH_INFO,pack,core_mhz,%lu,hash_entries,%u,block,%u\r\n",
+           (unsigned long)(SystemCoreClock / 1000000U), SD_PACK_HASH_SIZE, STREAM_BUF_SIZE);
+
+    for (uint32_t i = 0; i < sizeof(pack_cases) / sizeof(pack_cases[0]); i++) {
+        pack_codec(pack_cases[i].name, pack_cases[i].data, pack_cases[i].delta, &s->pack,
+                   s->pool, s->pool + STREAM_BUF_SIZE, s->out, sizeof(s->out));
+    }
+    for (uint32_t i = 0; i < sizeof(pack_cases) / sizeof(pack_cases[0]); i++) {
+        if (pack_cases[i].delta == 0) {
+            pack_stream(filename, pack_cases[i].name, pack_cases[i].data, 0, NULL, s->pool, s->out, sizeof(s->out));
+        }
+        pack_stream(filename, pack_cases[i].name, pack_cases[i].data, pack_cases[i].delta, &s->pack, s->pool, s->out, sizeof(s->out));
+    }
+}
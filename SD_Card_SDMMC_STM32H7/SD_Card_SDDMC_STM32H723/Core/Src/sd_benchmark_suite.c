@@ -0,0 +1,169 @@
+#include "sd_benchmark.h"
+#include "sd_benchmark_util.h"
+#include "fatfs.h"
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "bsp_driver_sd.h"
+
+#define SUITE_SEQ_FILE_SIZE  (4 * 1024 * 1024) // 4 MB per sequential case
+#define SUITE_RANDOM_OPS     1000
+#define SUITE_MIXED_READ_PCT 70
+#define SUITE_FILES          100
+#define SUITE_FILE           "bench_suite.bin"
+#define BENCH_DIR            "bench_files"
+#define RANDOM_BLOCK         4096
+
+static const UINT seq_sizes[] = { 512, 1024, 4096, 16384, 65536 };
+
+static FRESULT bench_seq_write(const char* filename, uint8_t* buffer, UINT size, uint32_t file_size) {
+    FIL file;
+    UINT done;
+    uint32_t t, bytes = 0;
+    FRESULT res = f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) return res;
+
+    bench_lat_reset();
+    while (bytes < file_size && res == FR_OK) {
+        t = DWT->CYCCNT;
+        res = f_write(&file, buffer, size, &done);
+        bench_lat_add(bench_us_since(t));
+        if (res == FR_OK && done != size) res = FR_DENIED;   // disk full
+        bytes += done;
+    }
+    t = DWT->CYCCNT;
+    if (f_close(&file) != FR_OK && res == FR_OK) res = FR_DISK_ERR;
+    if (res == FR_OK) bench_report("seq_write", size, bytes, bench_us_since(t));
+    return res;
+}
+
+static FRESULT bench_seq_read(const char* filename, uint8_t* buffer, UINT size, uint32_t file_size) {
+    FIL file;
+    UINT done;
+    uint32_t t, bytes = 0;
+    FRESULT res = f_open(&file, filename, FA_READ);
+    if (res != FR_OK) return res;
+
+    bench_lat_reset();
+    while (bytes < file_size && res == FR_OK) {
+        t = DWT->CYCCNT;
+        res = f_read(&file, buffer, size, &done);
+        bench_lat_add(bench_us_since(t));
+        if (res == FR_OK && done != size) res = FR_INT_ERR;
+        bytes += done;
+    }
+    f_close(&file);
+    if (res == FR_OK) bench_report("seq_read", size, bytes, 0);
+    return res;
+}
+
+// read_pct: 100 = random read, 0 = random write, in between = mixed
+static FRESULT bench_random(const char* test, const char* filename, uint8_t* buffer,
+                            uint32_t file_size, uint32_t ops, uint32_t read_pct) {
+    FIL file;
+    UINT done;
+    uint32_t t, blocks = file_size / RANDOM_BLOCK, bytes = 0;
+    FRESULT res = f_open(&file, filename, FA_READ | FA_WRITE);
+    if (res != FR_OK) return res;
+    if (blocks == 0) {
+        f_close(&file);
+        return FR_INVALID_PARAMETER;
+    }
+
+    bench_rand_seed();
+    bench_lat_reset();
+    for (uint32_t i = 0; i < ops && res == FR_OK; i++) {
+        FSIZE_t ofs = (FSIZE_t)(bench_rand() % blocks) * RANDOM_BLOCK;
+        uint8_t is_read = (bench_rand() % 100) < read_pct;
+
+        done = 0;
+        t = DWT->CYCCNT;
+        res = f_lseek(&file, ofs);
+        if (res == FR_OK) {
+            res = is_read ? f_read(&file, buffer, RANDOM_BLOCK, &done)
+                          : f_write(&file, buffer, RANDOM_BLOCK, &done);
+        }
+        bench_lat_add(bench_us_since(t));
+        if (res == FR_OK && done != RANDOM_BLOCK) res = FR_INT_ERR;
+        bytes += done;
+    }
+    t = DWT->CYCCNT;
+    if (f_close(&file) != FR_OK && res == FR_OK) res = FR_DISK_ERR;
+    if (res == FR_OK) bench_report(test, RANDOM_BLOCK, bytes, bench_us_since(t));
+    return res;
+}
+
+static FRESULT bench_files(uint8_t* buffer, uint32_t files) {
+    FIL file;
+    UINT done;
+    char name[32];
+    uint32_t t, i;
+    FRESULT res = f_mkdir(BENCH_DIR);
+    if (res != FR_OK && res != FR_EXIST) return res;
+
+    res = FR_OK;
+    bench_lat_reset();
+    for (i = 0; i < files && res == FR_OK; i++) {
+        snprintf(name, sizeof(name), BENCH_DIR "/f%05lu.bin", (unsigned long)i);
+        t = DWT->CYCCNT;
+        res = f_open(&file, name, FA_CREATE_ALWAYS | FA_WRITE);
+        if (res == FR_OK) {
+            res = f_write(&file, buffer, 512, &done);
+            if (f_close(&file) != FR_OK && res == FR_OK) res = FR_DISK_ERR;
+        }
+        bench_lat_add(bench_us_since(t));
+    }
+    if (res == FR_OK) bench_report("create", 512, files * 512, 0);
+
+    bench_lat_reset();
+    for (i = 0; i < files && res == FR_OK; i++) {
+        snprintf(name, sizeof(name), BENCH_DIR "/f%05lu.bin", (unsigned long)i);
+        t = DWT->CYCCNT;
+        res = f_unlink(name);
+        bench_lat_add(bench_us_since(t));
+    }
+    if (res == FR_OK) bench_report("delete", 0, 0, 0);
+
+    f_unlink(BENCH_DIR);
+    return res;
+}
+
+/***************************************************************
+ * This function run the whole suite with cfg (NULL = defaults)
+ ***************************************************************/
+
+void sd_benchmark_suite(const SdBenchConfig* cfg) {
+    static const SdBenchConfig defaults = {
+        .seq_file_size  = SUITE_SEQ_FILE_SIZE,
+        .random_ops     = SUITE_RANDOM_OPS,
+        .mixed_read_pct = SUITE_MIXED_READ_PCT,
+        .files          = SUITE_FILES,
+    };
+    uint8_t *buffer = bench_scratch(BUF_SIZE);
+    BSP_SD_CardInfo info;
+    FRESULT res = FR_OK;
+
+    if (buffer == NULL) return;
+    if (cfg == NULL) cfg = &defaults;
+    memset(buffer, 0xAA, BUF_SIZE);
+    bench_timer_init();
+
+    BSP_SD_GetCardInfo(&info);
+    printf("BENCH_INFO,core_hz,%lu,card_type,%lu,card_class,%lu,blocks,%lu\r\n",
+           (unsigned long)SystemCoreClock, (unsigned long)info.CardType, (unsigned long)info.Class, (unsigned long)info.LogBlockNbr);
+    printf("BENCH,test,size,ops,bytes,time_us,kbps,iops,p50_us,p99_us,max_us\r\n");
+
+    for (uint32_t i = 0; i < sizeof(seq_sizes) / sizeof(seq_sizes[0]) && res == FR_OK; i++) {
+        res = bench_seq_write(SUITE_FILE, buffer, seq_sizes[i], cfg->seq_file_size);
+        if (res == FR_OK) res = bench_seq_read(SUITE_FILE, buffer, seq_sizes[i], cfg->seq_file_size);
+    }
+
+    // random cases run inside the last sequential file
+    if (res == FR_OK) res = bench_random("rand_read", SUITE_FILE, buffer, cfg->seq_file_size, cfg->random_ops, 100);
+    if (res == FR_OK) res = bench_random("rand_write", SUITE_FILE, buffer, cfg->seq_file_size, cfg->random_ops, 0);
+    if (res == FR_OK) res = bench_random("mixed", SUITE_FILE, buffer, cfg->seq_file_size, cfg->random_ops, cfg->mixed_read_pct);
+    if (res == FR_OK) res = bench_files(buffer, cfg->files);
+
+    f_unlink(SUITE_FILE);
+    if (res != FR_OK) printf("BENCH_ERROR,%d\r\n", res);
+}
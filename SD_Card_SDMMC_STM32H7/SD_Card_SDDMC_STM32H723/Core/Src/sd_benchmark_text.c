@@ -0,0 +1,365 @@
+#include "sd_benchmark.h"
+#include "sd_benchmark_util.h"
+#include "fatfs.h"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "main.h"
+#include "sd_functions.h"
+#include "sd_csv.h"
+#include "sd_text.h"
+#include "sd_tslog.h"
+
+#define CSV_BUF_MAX          32768
+#define TSLOG_BLOCK_SIZE     4096
+#define TSLOG_PERIOD_MS      10                // timestamp step between records
+#define TSLOG_QUERIES        50
+#define TSLOG_WINDOW_MS      1000
+#define TSLOG_CSV_SCANS      2
+#define TEXT_BUF_MAX         16384
+
+/***************************************************************
+ * This function write a CSV file of CsvRecord-like rows (every
+ * 16th row with a quoted field) and time reading it back with
+ * f_gets + strtok, the old sd_read_csv loop, then with
+ * sd_csv_read at 4, 16 and 32 KB blocks
+ ***************************************************************/
+
+static const uint32_t csv_blocks[] = { 4096, 16384, 32768 };
+
+static int csv_bench_record(const SdCsvField *fields, uint32_t nfields, void *ctx) {
+    int32_t *sum = ctx;
+
+    if (nfields > 2) *sum += sd_csv_to_int(&fields[2]);
+    return 0;
+}
+
+static void csv_report(const char* test, uint32_t bytes, uint32_t records, uint32_t ms) {
+    printf("BENCH_INFO,%s,bytes,%lu,records,%lu,ms,%lu,kbps,%lu\r\n",
+           test, (unsigned long)bytes, (unsigned long)records, (unsigned long)ms, (unsigned long)(ms ? bytes / 1024 * 1000 / ms : 0));
+}
+
+void sd_benchmark_csv(const char* filename, uint32_t size_bytes) {
+    FIL file;
+    UINT bw;
+    char line[128];
+    char test[24];
+    CsvRecord rec;
+    uint8_t *buf = bench_scratch(CSV_BUF_MAX);
+    uint32_t written = 0, rows = 0, fill = 0, records, start, ms;
+    int32_t sum;
+
+    if (buf == NULL) return;
+    FRESULT res = f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) return;
+    while (written < size_bytes && res == FR_OK) {
+        int n = (rows % 16 == 15)
+              ? snprintf((char *)buf + fill, 64, "sensor_%05lu,\"room %lu, \"\"north\"\"\",%ld\r\n",
+                         (unsigned long)rows, (unsigned long)(rows % 7), (long)rows - 5000)
+              : snprintf((char *)buf + fill, 64, "sensor_%05lu,room_%lu,%ld\r\n", (unsigned long)rows,
+                         (unsigned long)(rows % 7), (long)rows - 5000);
+        fill += n;
+        rows++;
+        if (fill > CSV_BUF_MAX - 64 || written + fill >= size_bytes) {
+            res = f_write(&file, buf, fill, &bw);
+            written += bw;
+            fill = 0;
+        }
+    }
+    f_close(&file);
+    if (res != FR_OK) {
+        printf("CSV write failed: %d\r\n", res);
+        return;
+    }
+
+    // old sd_read_csv: f_gets one byte at a time, strtok, strncpy, atoi
+    records = 0;
+    sum = 0;
+    start = HAL_GetTick();
+    if (f_open(&file, filename, FA_READ) == FR_OK) {
+        while (f_gets(line, sizeof(line), &file)) {
+            char *token = strtok(line, ",");
+            if (!token) continue;
+            strncpy(rec.field1, token, sizeof(rec.field1) - 1);
+            rec.field1[sizeof(rec.field1) - 1] = '\0';
+            token = strtok(NULL, ",");
+            if (!token) continue;
+            strncpy(rec.field2, token, sizeof(rec.field2) - 1);
+            rec.field2[sizeof(rec.field2) - 1] = '\0';
+            token = strtok(NULL, ",");
+            rec.value = token ? atoi(token) : 0;
+            sum += rec.value;
+            records++;
+        }
+        f_close(&file);
+    }
+    csv_report("csv_fgets", written, records, HAL_GetTick() - start);
+
+    for (uint32_t i = 0; i < sizeof(csv_blocks) / sizeof(csv_blocks[0]); i++) {
+        sum = 0;
+        start = HAL_GetTick();
+        res = sd_csv_read(filename, buf, csv_blocks[i], csv_bench_record, &sum, &records);
+        ms = HAL_GetTick() - start;
+        if (res != FR_OK) {
+            printf("sd_csv_read failed: %d\r\n", res);
+            break;
+        }
+        snprintf(test, sizeof(test), "csv_block_%luk", (unsigned long)(csv_blocks[i] / 1024));
+        csv_report(test, written, records, ms);
+    }
+    f_unlink(filename);
+}
+
+/***************************************************************
+ * This function write the same CsvRecord rows with f_printf,
+ * with sd_text_printf (buffered, still printf) and with the
+ * sd_csv row writer, then rows with fixed point and float
+ * columns through the row writer
+ ***************************************************************/
+
+static void csv_write_report(const char* test, uint32_t rows, uint32_t bytes, uint32_t ms) {
+    printf("BENCH_INFO,%s,rows,%lu,bytes,%lu,ms,%lu,rows_per_s,%lu\r\n",
+           test, (unsigned long)rows, (unsigned long)bytes, (unsigned long)ms, (unsigned long)(ms ? rows * 1000 / ms : 0));
+}
+
+void sd_benchmark_csv_write(const char* filename, uint32_t rows) {
+    FIL file;
+    SdText text;
+    SdCsvWriter writer;
+    CsvRecord recs[16];
+    uint8_t *buf = bench_scratch(LOG_BUF_SIZE);
+    uint32_t i, start;
+
+    if (buf == NULL) return;
+    for (i = 0; i < 16; i++) {
+        snprintf(recs[i].field1, sizeof(recs[i].field1), "sensor_%02lu", (unsigned long)i);
+        snprintf(recs[i].field2, sizeof(recs[i].field2), "room_%lu", (unsigned long)(i % 7));
+    }
+
+    start = HAL_GetTick();
+    if (f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return;
+    for (i = 0; i < rows; i++) {
+        const CsvRecord *r = &recs[i & 15];
+        if (f_printf(&file, "%s,%s,%d\n", r->field1, r->field2, (int)i - 5000) < 0) break;
+    }
+    csv_write_report("csvw_fprintf", i, f_tell(&file), HAL_GetTick() - start);
+    f_close(&file);
+
+    start = HAL_GetTick();
+    if (sd_text_open(&text, filename, FA_CREATE_ALWAYS | FA_WRITE, buf, LOG_BUF_SIZE) != FR_OK) return;
+    for (i = 0; i < rows; i++) {
+        const CsvRecord *r = &recs[i & 15];
+        if (sd_text_printf(&text, "%s,%s,%d\n", r->field1, r->field2, (int)i - 5000) < 0) break;
+    }
+    sd_text_close(&text);
+    csv_write_report("csvw_text_printf", i, text.bytes, HAL_GetTick() - start);
+
+    start = HAL_GetTick();
+    if (sd_csv_writer_open(&writer, filename, buf, LOG_BUF_SIZE) != FR_OK) return;
+    for (i = 0; i < rows; i++) {
+        const CsvRecord *r = &recs[i & 15];
+        sd_csv_put_str(&writer, r->field1);
+        sd_csv_put_str(&writer, r->field2);
+        sd_csv_put_int(&writer, (int32_t)i - 5000);
+        if (sd_csv_end_row(&writer) != FR_OK) break;
+    }
+    sd_csv_writer_close(&writer);
+    csv_write_report("csvw_writer", writer.rows, writer.bytes, HAL_GetTick() - start);
+
+    // tick, temperature in centi-degrees, float reading
+    start = HAL_GetTick();
+    if (sd_csv_writer_open(&writer, filename, buf, LOG_BUF_SIZE) != FR_OK) return;
+    for (i = 0; i < rows; i++) {
+        sd_csv_put_uint(&writer, start + i);
+        sd_csv_put_fixed(&writer, 2150 + (int32_t)(i % 100) - 50, 2);
+        sd_csv_put_float(&writer, (float)i * 0.173f - 300.0f, 3);
+        if (sd_csv_end_row(&writer) != FR_OK) break;
+    }
+    sd_csv_writer_close(&writer);
+    csv_write_report("csvw_writer_fixed_float", writer.rows, writer.bytes, HAL_GetTick() - start);
+    f_unlink(filename);
+}
+
+/***************************************************************
+ * This function log the same samples (tick, counter, reading)
+ * as a binary time-series file and as CSV, then time queries
+ * of short time windows: sd_tslog seeking through its index
+ * against a full sd_csv_read scan, and the CSV conversion
+ ***************************************************************/
+
+typedef struct __attribute__((packed)) {
+    int32_t counter;
+    float reading;
+} TslogSample;
+
+typedef struct {
+    uint32_t t_from, t_to, matches;
+} TslogScan;
+
+static int tslog_count(uint32_t t, const uint8_t *payload, void *ctx) {
+    (void)t;
+    (void)payload;
+    (*(uint32_t *)ctx)++;
+    return 0;
+}
+
+static int tslog_csv_match(const SdCsvField *fields, uint32_t nfields, void *ctx) {
+    TslogScan *scan = ctx;
+    uint32_t t = (uint32_t)sd_csv_to_int(&fields[0]);
+
+    (void)nfields;
+    if (t >= scan->t_from && t <= scan->t_to) scan->matches++;
+    return 0;
+}
+
+void sd_benchmark_tslog(const char* filename, const char* csv_name, uint32_t records) {
+    SdTslog log;
+    SdTslogReader reader;
+    SdCsvWriter csv;
+    TslogSample sample;
+    TslogScan scan;
+    uint8_t *buf = bench_scratch(TSLOG_BLOCK_SIZE + LOG_BUF_SIZE);
+    uint8_t *csv_buf = buf + TSLOG_BLOCK_SIZE;
+    uint32_t i, start, ms, matches, bytes = 0, headers = 0, span = records * TSLOG_PERIOD_MS;
+    FRESULT res;
+
+    if (buf == NULL) return;
+    bench_timer_init();
+
+    start = HAL_GetTick();
+    res = sd_tslog_open(&log, filename, "if", buf, TSLOG_BLOCK_SIZE);
+    for (i = 0; i < records && res == FR_OK; i++) {
+        sample.counter = (int32_t)i;
+        sample.reading = (float)(i % 1000) * 0.125f - 40.0f;
+        res = sd_tslog_append(&log, i * TSLOG_PERIOD_MS, &sample);
+    }
+    if (res == FR_OK) res = sd_tslog_close(&log);
+    ms = HAL_GetTick() - start;
+    if (res != FR_OK) {
+        printf("sd_tslog write failed: %d\r\n", res);
+        return;
+    }
+    printf("BENCH_INFO,tslog_write,records,%lu,bytes,%lu,ms,%lu,index_entries,%lu,index_stride,%lu\r\n",
+           (unsigned long)records,
+           (unsigned long)(log.hdr.index_block * TSLOG_BLOCK_SIZE + log.hdr.index_entries * sizeof(SdTslogIndexEntry)),
+           (unsigned long)ms, (unsigned long)log.hdr.index_entries, (unsigned long)log.hdr.index_stride);
+
+    start = HAL_GetTick();
+    res = sd_csv_writer_open(&csv, csv_name, csv_buf, LOG_BUF_SIZE);
+    for (i = 0; i < records && res == FR_OK; i++) {
+        sd_csv_put_uint(&csv, i * TSLOG_PERIOD_MS);
+        sd_csv_put_int(&csv, (int32_t)i);
+        sd_csv_put_float(&csv, (float)(i % 1000) * 0.125f - 40.0f, 3);
+        res = sd_csv_end_row(&csv);
+    }
+    res = sd_csv_writer_close(&csv);
+    printf("BENCH_INFO,tslog_csv_write,records,%lu,bytes,%lu,ms,%lu\r\n", (unsigned long)records,
+           (unsigned long)csv.bytes, (unsigned long)(HAL_GetTick() - start));
+    if (res != FR_OK) return;
+
+    // short windows anywhere in the log
+    if (sd_tslog_reader_open(&reader, filename, buf, TSLOG_BLOCK_SIZE) != FR_OK) return;
+    bench_rand_seed();
+    bench_lat_reset();
+    for (i = 0; i < TSLOG_QUERIES; i++) {
+        uint32_t t_from = bench_rand() % span;
+        uint32_t t = DWT->CYCCNT;
+
+        matches = 0;
+        res = sd_tslog_query(&reader, t_from, t_from + TSLOG_WINDOW_MS - 1, tslog_count, &matches, NULL);
+        bench_lat_add(bench_us_since(t));
+        if (res != FR_OK) break;
+        bytes += reader.blocks_read * TSLOG_BLOCK_SIZE;
+        headers += reader.headers_read;
+    }
+    sd_tslog_reader_close(&reader);
+    bench_report("tslog_query", TSLOG_WINDOW_MS, bytes, 0);
+    printf("BENCH_INFO,tslog_query,queries,%lu,headers_read,%lu,bad_blocks,%lu\r\n", (unsigned long)i,
+           (unsigned long)headers, (unsigned long)reader.bad_blocks);
+
+    // the same windows found by reading the whole CSV
+    bench_rand_seed();
+    start = HAL_GetTick();
+    for (i = 0; i < TSLOG_CSV_SCANS; i++) {
+        scan.t_from = bench_rand() % span;
+        scan.t_to = scan.t_from + TSLOG_WINDOW_MS - 1;
+        scan.matches = 0;
+        if (sd_csv_read(csv_name, csv_buf, LOG_BUF_SIZE, tslog_csv_match, &scan, NULL) != FR_OK) break;
+    }
+    ms = HAL_GetTick() - start;
+    printf("BENCH_INFO,tslog_csv_scan,queries,%lu,ms_per_query,%lu,matches,%lu\r\n", (unsigned long)i,
+           (unsigned long)(i ? ms / i : 0), (unsigned long)scan.matches);
+
+    start = HAL_GetTick();
+    res = sd_tslog_to_csv(filename, csv_name, 0, 0xFFFFFFFFU, buf, TSLOG_BLOCK_SIZE, csv_buf, LOG_BUF_SIZE);
+    printf("BENCH_INFO,tslog_to_csv,records,%lu,ms,%lu,res,%d\r\n", (unsigned long)records, (unsigned long)(HAL_GetTick() - start), res);
+
+    f_unlink(filename);
+    f_unlink(csv_name);
+}
+
+/***************************************************************
+ * This function write and read back a file of short text lines
+ * with the FatFs string functions (f_printf, f_gets) and with
+ * sd_text at 4 and 16 KB buffers, same lines each time
+ ***************************************************************/
+
+static const uint32_t text_blocks[] = { 4096, 16384 };
+
+static void text_report(const char* test, uint32_t lines, uint32_t bytes, uint32_t ms) {
+    printf("BENCH_INFO,%s,lines,%lu,bytes,%lu,ms,%lu,lines_per_s,%lu,kbps,%lu\r\n",
+           test, (unsigned long)lines, (unsigned long)bytes, (unsigned long)ms,
+           (unsigned long)(ms ? lines * 1000 / ms : 0), (unsigned long)(ms ? bytes / 1024 * 1000 / ms : 0));
+}
+
+void sd_benchmark_text(const char* filename, uint32_t size_bytes) {
+    FIL file;
+    SdText text;
+    char line[64];
+    char test[24];
+    uint8_t *buf = bench_scratch(TEXT_BUF_MAX);
+    uint32_t lines = 0, n, bytes, start;
+
+    if (buf == NULL) return;
+
+    // f_printf: every character through putc_bfd, f_write per 64 bytes
+    start = HAL_GetTick();
+    if (f_open(&file, filename, FA_CREATE_ALWAYS | FA_WRITE) != FR_OK) return;
+    while (f_tell(&file) < size_bytes) {
+        if (f_printf(&file, "%05lu,%lu,%ld\n", (unsigned long)lines, (unsigned long)(lines % 7), (long)lines - 5000) < 0) break;
+        lines++;
+    }
+    bytes = f_tell(&file);
+    f_close(&file);
+    text_report("text_fprintf", lines, bytes, HAL_GetTick() - start);
+
+    for (uint32_t i = 0; i < sizeof(text_blocks) / sizeof(text_blocks[0]); i++) {
+        start = HAL_GetTick();
+        if (sd_text_open(&text, filename, FA_CREATE_ALWAYS | FA_WRITE, buf, text_blocks[i]) != FR_OK) return;
+        for (n = 0; n < lines; n++) {
+            if (sd_text_printf(&text, "%05lu,%lu,%ld\n", (unsigned long)n, (unsigned long)(n % 7), (long)n - 5000) < 0) break;
+        }
+        if (sd_text_close(&text) != FR_OK) printf("sd_text write failed: %d\r\n", text.res);
+        snprintf(test, sizeof(test), "text_printf_%luk", (unsigned long)(text_blocks[i] / 1024));
+        text_report(test, n, text.bytes, HAL_GetTick() - start);
+    }
+
+    // f_gets: one f_read per character
+    n = 0;
+    start = HAL_GetTick();
+    if (f_open(&file, filename, FA_READ) != FR_OK) return;
+    while (f_gets(line, sizeof(line), &file)) n++;
+    bytes = f_tell(&file);
+    f_close(&file);
+    text_report("text_fgets", n, bytes, HAL_GetTick() - start);
+
+    for (uint32_t i = 0; i < sizeof(text_blocks) / sizeof(text_blocks[0]); i++) {
+        start = HAL_GetTick();
+        if (sd_text_open(&text, filename, FA_READ, buf, text_blocks[i]) != FR_OK) return;
+        while (sd_text_readline(&text, NULL)) {}
+        if (sd_text_close(&text) != FR_OK) printf("sd_text read failed: %d\r\n", text.res);
+        snprintf(test, sizeof(test), "text_readline_%luk", (unsigned long)(text_blocks[i] / 1024));
+        text_report(test, text.lines, text.bytes, HAL_GetTick() - start);
+    }
+    f_unlink(filename);
+}
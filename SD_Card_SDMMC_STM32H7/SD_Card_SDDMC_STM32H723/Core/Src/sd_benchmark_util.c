@@ -0,0 +1,132 @@
+#include "sd_benchmark_util.h"
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+
+#define LAT_BUCKETS          200               // up to ~2^27 us
+
+/***************************************************************
+ * Helpers shared by the benchmarks: every operation is timed
+ * with the DWT cycle counter, latencies go into a log-linear
+ * histogram (exact up to 16 us, then 8 buckets per power of
+ * two) for p50/p99/max. Results are printed one per line as
+ * BENCH,test,size,ops,bytes,time_us,kbps,iops,p50_us,p99_us,max_us
+ ***************************************************************/
+
+typedef struct {
+    uint32_t count;
+    uint32_t max_us;
+    uint32_t total_us;
+    uint32_t hist[LAT_BUCKETS];
+} BenchLatency;
+
+static BenchLatency lat;
+static uint32_t cycles_per_us;
+static uint32_t rand_state;
+
+// buffers of the running benchmark: off the stack and 32-byte aligned
+// for zero-copy DMA (DMA can not reach the F407 CCM RAM, so not there)
+static uint8_t scratch[BENCH_SCRATCH_SIZE] __attribute__((aligned(32)));
+
+/***************************************************************
+ * Start the DWT cycle counter
+ ***************************************************************/
+
+static void dwt_init(void) {
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CYCCNT = 0;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+void bench_timer_init(void) {
+    dwt_init();
+    cycles_per_us = SystemCoreClock / 1000000U;
+}
+
+uint32_t bench_us_since(uint32_t start) {
+    return (DWT->CYCCNT - start) / cycles_per_us;
+}
+
+// xorshift32, fixed seed so every card sees the same access pattern
+void bench_rand_seed(void) {
+    rand_state = 0x2545F491U;
+}
+
+uint32_t bench_rand(void) {
+    rand_state ^= rand_state << 13;
+    rand_state ^= rand_state >> 17;
+    rand_state ^= rand_state << 5;
+    return rand_state;
+}
+
+static uint32_t lat_bucket(uint32_t us) {
+    uint32_t e, idx;
+
+    if (us < 16) return us;
+    e = 31 - __builtin_clz(us);
+    idx = 16 + (e - 4) * 8 + ((us >> (e - 3)) & 7);
+    return (idx < LAT_BUCKETS) ? idx : LAT_BUCKETS - 1;
+}
+
+// highest latency falling into a bucket
+static uint32_t lat_bucket_top(uint32_t idx) {
+    uint32_t e, sub;
+
+    if (idx < 16) return idx;
+    e = (idx - 16) / 8 + 4;
+    sub = (idx - 16) % 8;
+    return ((8 + sub) << (e - 3)) + (1U << (e - 3)) - 1;
+}
+
+void bench_lat_reset(void) {
+    memset(&lat, 0, sizeof(lat));
+}
+
+void bench_lat_add(uint32_t us) {
+    lat.count++;
+    lat.total_us += us;
+    if (us > lat.max_us) lat.max_us = us;
+    lat.hist[lat_bucket(us)]++;
+}
+
+static uint32_t lat_percentile(uint32_t pct) {
+    uint32_t rank = (lat.count * pct + 99) / 100;
+    uint32_t seen = 0;
+
+    for (uint32_t i = 0; i < LAT_BUCKETS; i++) {
+        seen += lat.hist[i];
+        if (seen > 0 && seen >= rank) {
+            uint32_t top = lat_bucket_top(i);
+            return (top < lat.max_us) ? top : lat.max_us;
+        }
+    }
+    return lat.max_us;
+}
+
+// extra_us: time spent outside the timed operations (final sync / close)
+void bench_report(const char* test, uint32_t size, uint32_t bytes, uint32_t extra_us) {
+    uint32_t total_us = lat.total_us + extra_us;
+    uint32_t kbps = 0, iops = 0;
+
+    if (total_us > 0) {
+        kbps = (uint32_t)(((uint64_t)bytes * 1000000U / 1024U) / total_us);
+        iops = (uint32_t)(((uint64_t)lat.count * 1000000U) / total_us);
+    }
+    printf("BENCH,%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n", test, (unsigned long)size, (unsigned long)lat.count,
+           (unsigned long)bytes, (unsigned long)total_us,
+           (unsigned long)kbps, (unsigned long)iops, (unsigned long)lat_percentile(50),
+           (unsigned long)lat_percentile(99), (unsigned long)lat.max_us);
+}
+
+/***************************************************************
+ * Scratch area shared by the benchmarks, one at a time: returns
+ * NULL when size does not fit
+ ***************************************************************/
+
+void* bench_scratch(uint32_t size) {
+    if (size > sizeof(scratch)) {
+        printf("Benchmark scratch: %lu bytes needed, %u available\r\n", (unsigned long)size, (unsigned)sizeof(scratch));
+        return NULL;
+    }
+    return scratch;
+}
@@ -1,76 +1,110 @@
 #include "fatfs.h"
 #include <stdio.h>
 #include <string.h>
-#include <stdlib.h>
 #include "bsp_driver_sd.h"
+#include "sd_functions.h"
+#include "sd_dlog.h"
+#include "sd_csv.h"
 
 extern char SDPath[4];
 FATFS fs;
 BSP_SD_CardInfo myCardInfo;
 
+#define SD_CSV_BUF_SIZE 4096	// sd_read_csv / sd_write_csv block size
+
+// Block buffer of the CSV functions: static, too large for the 8 KB stack
+static uint8_t csv_buf[SD_CSV_BUF_SIZE] __attribute__((aligned(4)));
+
 /***************************************************************
  * Get the total and free space of the SD card in KB
- * Uses FatFs f_getfree to calculate available clusters
+ * Uses the FSInfo / allocator free count when it is trusted,
+ * otherwise counts SD_FREE_SCAN_STEP FAT sectors and reports
+ * the free space as unknown until sd_scan_free completes it
  * Prints the information to the console
  ***************************************************************/
 
 int sd_get_space_kb(void) {
-	FATFS *pfs;
 	DWORD fre_clust, tot_sect, fre_sect, total_kb, free_kb;
-	FRESULT res = f_getfree(SDPath, &fre_clust, &pfs);
+	FRESULT res = f_scanfree(SDPath, SD_FREE_SCAN_STEP, &fre_clust);
 	if (res != FR_OK) return res;
 
-	 // Calculate total sectors and free sectors
-	tot_sect = (pfs->n_fatent - 2) * pfs->csize;
-	fre_sect = fre_clust * pfs->csize;
+	 // Calculate total sectors
+	tot_sect = (fs.n_fatent - 2) * fs.csize;
+	total_kb = tot_sect / 2;
+	if (fre_clust == 0xFFFFFFFF) {
+		printf("💾 Total: %lu KB, Free: counting (%lu%%)\r\n", (unsigned long)total_kb,
+				(unsigned long)((fs.fsc_clst - 2) * 100 / (fs.n_fatent - 2)));
+		return FR_OK;
+	}
 
 	// Convert to KB
-	total_kb = tot_sect / 2;
+	fre_sect = fre_clust * fs.csize;
 	free_kb = fre_sect / 2;
-	printf("💾 Total: %lu KB, Free: %lu KB\r\n", total_kb, free_kb);
+	printf("💾 Total: %lu KB, Free: %lu KB\r\n", (unsigned long)total_kb, (unsigned long)free_kb);
 	return FR_OK;
 }
 
+/***************************************************************
+ * Continue counting free clusters in the background
+ * Call from the idle loop, each call reads at most nsect FAT
+ * sectors; returns 1 once the free space is known, 0 while
+ * counting and -FRESULT on error
+ ***************************************************************/
+
+int sd_scan_free(UINT nsect) {
+	DWORD fre_clust;
+	FRESULT res = f_scanfree(SDPath, nsect, &fre_clust);
+
+	if (res != FR_OK) return -(int)res;
+	return (fre_clust != 0xFFFFFFFF);
+}
+
 /***************************************************************
  * Mount the SD card filesystem
  * Uses f_mount to mount the SD card
- * Prints capacity, free space, card type, version, and class
+ * Logs capacity, free space, card type, version, and class
  ***************************************************************/
 
 int sd_mount(void) {
 	FRESULT res;
+	uint32_t start = HAL_GetTick();
 
-	printf("Attempting mount at %s...\r\n", SDPath);
+	SD_DLOG_INFO(SD_MSG_MOUNT_TRY, SDPath);
 	res = f_mount(&fs, SDPath, 1);
 	if (res == FR_OK)
 	{
-		printf("SD card mounted successfully at %s\r\n", SDPath);
+		SD_DLOG_INFO(SD_MSG_MOUNT_OK, SDPath);
 
-		// Capacity and free space reporting
+		// Capacity and free space reporting, bounded: no full FAT scan here
 		sd_get_space_kb();
+		SD_DLOG_INFO(SD_MSG_MOUNT_TIME, HAL_GetTick() - start);
 
 		// Get Card Info
 		BSP_SD_GetCardInfo(&myCardInfo);
-		printf("Card Type: %s\r\n", myCardInfo.CardType ? "SDSC" : "SDHC/SDXC");
-		printf("Card Version: %s\r\n", myCardInfo.CardVersion ? "CARD_V1_X" : "CARD_V2_X");
-		printf("Card Class: %lu\r\n", myCardInfo.Class);
+		SD_DLOG_INFO(SD_MSG_CARD_TYPE, myCardInfo.CardType ? "SDSC" : "SDHC/SDXC");
+		SD_DLOG_INFO(SD_MSG_CARD_VERSION, myCardInfo.CardVersion ? "CARD_V1_X" : "CARD_V2_X");
+		SD_DLOG_INFO(SD_MSG_CARD_CLASS, myCardInfo.Class);
 		return FR_OK;
 	}
 
 	// Any other mount error
-	printf("Mount failed with code: %d\r\n", res);
+	SD_DLOG_ERROR(SD_MSG_MOUNT_FAIL, res);
 	return res;
 }
 
 /***************************************************************
  * Unmount the SD card
- * Calls f_mount with NULL to unmount
- * Prints success/failure status
+ * Marks the volume clean with f_syncvol, so the next mount trusts
+ * the FSInfo free count, then calls f_mount with NULL to unmount
+ * Logs success/failure status
  ***************************************************************/
 
 int sd_unmount(void) {
-	FRESULT res = f_mount(NULL, SDPath, 1);
-	printf("SD card unmounted: %s\r\n\r\n\r\n", (res == FR_OK) ? "OK" : "Failed");
+	FRESULT res = f_syncvol(SDPath);
+	FRESULT unmount = f_mount(NULL, SDPath, 1);
+
+	if (res == FR_OK) res = unmount;
+	SD_DLOG_INFO(SD_MSG_UNMOUNT, (res == FR_OK) ? "OK" : "Failed");
 	return res;
 }
 
@@ -78,7 +112,7 @@ int sd_unmount(void) {
  * Write text to a file (overwrite if exists)
  * Opens the file with FA_CREATE_ALWAYS | FA_WRITE
  * Writes the text and closes the file
- * Prints the number of bytes written
+ * Logs the number of bytes written
  ***************************************************************/
 
 int sd_write_file(const char *filename, const char *text) {
@@ -92,7 +126,7 @@ int sd_write_file(const char *filename, const char *text) {
 	// Write data using f_write
 	res = f_write(&file, text, strlen(text), &bw);
 	f_close(&file);
-	printf("Write %u bytes to %s\r\n", bw, filename);
+	SD_DLOG_INFO(SD_MSG_WRITE, bw, filename);
 	return (res == FR_OK && bw == strlen(text)) ? FR_OK : FR_DISK_ERR;
 }
 
@@ -101,7 +135,7 @@ int sd_write_file(const char *filename, const char *text) {
  * Opens file with FA_OPEN_ALWAYS | FA_WRITE
  * Moves the file pointer to the end
  * Writes new text and closes the file
- * Prints number of bytes appended
+ * Logs number of bytes appended
  ***************************************************************/
 
 int sd_append_file(const char *filename, const char *text) {
@@ -122,16 +156,125 @@ int sd_append_file(const char *filename, const char *text) {
 	// Write new data
 	res = f_write(&file, text, strlen(text), &bw);
 	f_close(&file);
-	printf("Appended %u bytes to %s\r\n", bw, filename);
+	SD_DLOG_INFO(SD_MSG_APPEND, bw, filename);
 	return (res == FR_OK && bw == strlen(text)) ? FR_OK : FR_DISK_ERR;
 }
 
+/***************************************************************
+ * Write the batch buffer to the file
+ * Unless all is set, the write stops on a sector boundary and
+ * the rest stays in the buffer, so FatFs never has to merge a
+ * partial sector with what is already on the card
+ ***************************************************************/
+
+static int sd_log_drain(SdLog *log, int all) {
+	uint32_t n = log->fill;
+	uint32_t over;
+	UINT bw;
+
+	if (!all) {
+		over = (uint32_t)((log->tail + n) % 512);
+		if (over < n) n -= over;
+	}
+	if (n == 0) return FR_OK;
+
+	FRESULT res = f_write(&log->file, log->buf, n, &bw);
+	log->tail += bw;
+	if (bw < log->fill) memmove(log->buf, log->buf + bw, log->fill - bw);
+	log->fill -= bw;
+	if (res == FR_OK && bw != n) res = FR_DENIED;	// disk full
+	return res;
+}
+
+/***************************************************************
+ * Open (or create) a log file for appending
+ * The FIL stays open until sd_log_close, the tail is tracked
+ * here so no f_lseek is needed per append
+ * buf may be NULL, otherwise a multiple of 512 bytes is best
+ ***************************************************************/
+
+int sd_log_open(SdLog *log, const char *filename, uint8_t *buf, uint32_t buf_size, uint32_t sync_ms) {
+	memset(log, 0, sizeof(*log));
+	log->buf = (buf_size > 0) ? buf : NULL;
+	log->buf_size = buf_size;
+	log->sync_ms = sync_ms;
+
+	FRESULT res = f_open(&log->file, filename, FA_OPEN_APPEND | FA_WRITE);
+	if (res != FR_OK) {
+		SD_DLOG_ERROR(SD_MSG_OPEN_FAIL, res);
+		return res;
+	}
+	log->tail = f_size(&log->file);
+	log->last_sync = HAL_GetTick();
+	return FR_OK;
+}
+
+/***************************************************************
+ * Append data to the log
+ * Data is copied into the batch buffer, a full buffer is
+ * written in one f_write; appends larger than the buffer go
+ * straight to the file once the buffer is empty
+ ***************************************************************/
+
+int sd_log_append(SdLog *log, const void *data, uint32_t len) {
+	const uint8_t *src = (const uint8_t *)data;
+	FRESULT res = FR_OK;
+	UINT bw;
+
+	while (len > 0 && res == FR_OK) {
+		if (log->buf == NULL || (log->fill == 0 && len >= log->buf_size)) {
+			res = f_write(&log->file, src, len, &bw);
+			log->tail += bw;
+			if (res == FR_OK && bw != len) res = FR_DENIED;	// disk full
+			break;
+		}
+
+		uint32_t n = log->buf_size - log->fill;
+		if (n > len) n = len;
+		memcpy(log->buf + log->fill, src, n);
+		log->fill += n;
+		src += n;
+		len -= n;
+
+		if (log->fill == log->buf_size) res = sd_log_drain(log, 0);
+	}
+
+	if (res == FR_OK && log->sync_ms > 0 && (HAL_GetTick() - log->last_sync) >= log->sync_ms) {
+		res = sd_log_flush(log);
+	}
+	return res;
+}
+
+/***************************************************************
+ * Write everything buffered and commit it with f_sync
+ * After this the data survives a power loss
+ ***************************************************************/
+
+int sd_log_flush(SdLog *log) {
+	FRESULT res = FR_OK;
+
+	if (log->buf != NULL) res = sd_log_drain(log, 1);
+	if (res == FR_OK) res = f_sync(&log->file);
+	log->last_sync = HAL_GetTick();
+	return res;
+}
+
+/***************************************************************
+ * Flush and close the log file
+ ***************************************************************/
+
+int sd_log_close(SdLog *log) {
+	FRESULT res = sd_log_flush(log);
+	FRESULT res_close = f_close(&log->file);
+	return (res != FR_OK) ? res : res_close;
+}
+
 /***************************************************************
  * Read data from a file into a buffer
  * Opens file for reading
  * Reads up to bufsize-1 bytes
  * Null-terminates the buffer
- * Prints number of bytes read
+ * Logs number of bytes read
  ***************************************************************/
 
 int sd_read_file(const char *filename, char *buffer, UINT bufsize, UINT *bytes_read) {
@@ -141,14 +284,14 @@ int sd_read_file(const char *filename, char *buffer, UINT bufsize, UINT *bytes_r
 	// Open file for reading
 	FRESULT res = f_open(&file, filename, FA_READ);
 	if (res != FR_OK) {
-		printf("f_open failed with code: %d\r\n", res);
+		SD_DLOG_ERROR(SD_MSG_OPEN_FAIL, res);
 		return res;
 	}
 
 	// Read file content using f_read
 	res = f_read(&file, buffer, bufsize - 1, bytes_read);
 	if (res != FR_OK) {
-		printf("f_read failed with code: %d\r\n", res);
+		SD_DLOG_ERROR(SD_MSG_READ_FAIL, res);
 		f_close(&file);
 		return res;
 	}
@@ -158,69 +301,69 @@ int sd_read_file(const char *filename, char *buffer, UINT bufsize, UINT *bytes_r
 
 	res = f_close(&file);
 	if (res != FR_OK) {
-		printf("f_close failed with code: %d\r\n", res);
+		SD_DLOG_ERROR(SD_MSG_CLOSE_FAIL, res);
 		return res;
 	}
 
-	printf("Read %u bytes from %s\r\n", *bytes_read, filename);
+	SD_DLOG_INFO(SD_MSG_READ, *bytes_read, filename);
 	return FR_OK;
 }
 
-// we can add new field
-typedef struct CsvRecord {
-	char field1[32];
-	char field2[32];
-	int value;
-} CsvRecord;
+/***************************************************************
+ * Store one parsed CSV record into the caller's array
+ * Records with fewer than two fields are skipped
+ ***************************************************************/
+
+typedef struct {
+	CsvRecord *records;
+	int max_records;
+	int *record_count;
+} CsvLoad;
+
+static int sd_read_csv_record(const SdCsvField *fields, uint32_t nfields, void *ctx) {
+	CsvLoad *load = ctx;
+	CsvRecord *rec;
+
+	if (nfields < 2) return 0;
+
+	rec = &load->records[*load->record_count];
+	sd_csv_copy(&fields[0], rec->field1, sizeof(rec->field1));
+	sd_csv_copy(&fields[1], rec->field2, sizeof(rec->field2));
+	rec->value = (nfields > 2) ? sd_csv_to_int(&fields[2]) : 0;
+
+	(*load->record_count)++;
+	return *load->record_count >= load->max_records;
+}
 
 /***************************************************************
  * Read CSV file into an array of CsvRecord structures
- * Parses each line into fields separated by commas
- * Stores values in CsvRecord array
+ * Reads the file in SD_CSV_BUF_SIZE blocks with sd_csv_read_file
+ * (quoted fields allowed) and copies the first three fields
+ * of each record into the CsvRecord array
  * Prints parsed CSV content
  ***************************************************************/
 
 int sd_read_csv(const char *filename, CsvRecord *records, int max_records, int *record_count) {
+	CsvLoad load = { records, max_records, record_count };
 	FIL file;
-	char line[128];
 	*record_count = 0;
 
-	// Open CSV file
+	if (max_records <= 0) return FR_INVALID_PARAMETER;
+
 	FRESULT res = f_open(&file, filename, FA_READ);
 	if (res != FR_OK) {
-		printf("Failed to open CSV: %s (%d)", filename, res);
+		SD_DLOG_ERROR(SD_MSG_CSV_OPEN_FAIL, filename, res);
 		return res;
 	}
-	printf("📄 Reading CSV: %s\r\n", filename);
-
-	// Loop through lines with f_gets
-	while (f_gets(line, sizeof(line), &file) && *record_count < max_records) {
-		char *token = strtok(line, ",");
-
-		// Tokenize line using strtok
-		if (!token) continue;
-
-		// Copy tokens into record fields
-		strncpy(records[*record_count].field1, token, sizeof(records[*record_count].field1));
-
-		token = strtok(NULL, ",");
-		if (!token) continue;
-
-		// Copy tokens into record fields
-		strncpy(records[*record_count].field2, token, sizeof(records[*record_count].field2));
-
-		token = strtok(NULL, ",");
-		if (token)
-
-			// Convert numeric field with atoi
-			records[*record_count].value = atoi(token);
-		else
-			records[*record_count].value = 0;
-
-		(*record_count)++;
-	}
 
+	// Parse the file block by block
+	res = sd_csv_read_file(&file, csv_buf, sizeof(csv_buf), sd_read_csv_record, &load, NULL);
 	f_close(&file);
+	if (res != FR_OK) {
+		SD_DLOG_ERROR(SD_MSG_CSV_READ_FAIL, filename, res);
+		return res;
+	}
+	printf("📄 Reading CSV: %s\r\n", filename);
 
 	// Print parsed data
 	for (int i = 0; i < *record_count; i++) {
@@ -233,39 +376,67 @@ int sd_read_csv(const char *filename, CsvRecord *records, int max_records, int *
 	return FR_OK;
 }
 
+/***************************************************************
+ * Write an array of CsvRecord structures as a CSV file
+ * Rows are formatted by the sd_csv row writer into an
+ * SD_CSV_BUF_SIZE block and written a sector at a time
+ * Logs number of bytes written
+ ***************************************************************/
+
+int sd_write_csv(const char *filename, const CsvRecord *records, int record_count) {
+	SdCsvWriter writer;
+
+	FRESULT res = sd_csv_writer_open(&writer, filename, csv_buf, sizeof(csv_buf));
+	if (res != FR_OK) {
+		SD_DLOG_ERROR(SD_MSG_CSV_OPEN_FAIL, filename, res);
+		return res;
+	}
+
+	for (int i = 0; i < record_count; i++) {
+		sd_csv_put_str(&writer, records[i].field1);
+		sd_csv_put_str(&writer, records[i].field2);
+		sd_csv_put_int(&writer, records[i].value);
+		if (sd_csv_end_row(&writer) != FR_OK) break;
+	}
+
+	res = sd_csv_writer_close(&writer);
+	SD_DLOG_INFO(SD_MSG_WRITE, writer.bytes, filename);
+	return res;
+}
+
 /***************************************************************
  * Delete a file from the SD card
  * Uses f_unlink
- * Prints success/failure message
+ * Logs success/failure message
  ***************************************************************/
 
 int sd_delete_file(const char *filename) {
 	FRESULT res = f_unlink(filename);
-	printf("Delete %s: %s\r\n", filename, (res == FR_OK ? "OK" : "Failed"));
+	SD_DLOG_INFO(SD_MSG_DELETE, filename, (res == FR_OK ? "OK" : "Failed"));
 	return res;
 }
 
 /***************************************************************
  * Rename a file on the SD card
  * Uses f_rename
- * Prints success/failure message
+ * Logs success/failure message
  ***************************************************************/
 
 int sd_rename_file(const char *oldname, const char *newname) {
 	FRESULT res = f_rename(oldname, newname);
-	printf("Rename %s to %s: %s\r\n", oldname, newname, (res == FR_OK ? "OK" : "Failed"));
+	SD_DLOG_INFO(SD_MSG_RENAME, oldname, newname, (res == FR_OK ? "OK" : "Failed"));
 	return res;
 }
 
 /***************************************************************
  * Create a directory on the SD card
  * Uses f_mkdir
- * Prints success/failure message
+ * Logs success/failure message
  ***************************************************************/
 
 FRESULT sd_create_directory(const char *path) {
 	FRESULT res = f_mkdir(path);
-	printf("Create directory %s: %s\r\n", path, (res == FR_OK ? "OK" : "Failed"));
+	SD_DLOG_INFO(SD_MSG_MKDIR, path, (res == FR_OK ? "OK" : "Failed"));
 	return res;
 }
 
@@ -302,7 +473,10 @@ void sd_list_directory_recursive(const char *path, int depth) {
 			if (strcmp(name, ".") && strcmp(name, "..")) {
 				printf("%*s📁 %s\r\n", depth * 2, "", name);
 				char newpath[128];
-				snprintf(newpath, sizeof(newpath), "%s/%s", path, name);
+				if (snprintf(newpath, sizeof(newpath), "%s/%s", path, name) >= (int)sizeof(newpath)) {
+					printf("%*s[ERR] Path too long\r\n", depth * 2 + 2, "");
+					continue;
+				}
 
 				// call recursively
 				sd_list_directory_recursive(newpath, depth + 1);
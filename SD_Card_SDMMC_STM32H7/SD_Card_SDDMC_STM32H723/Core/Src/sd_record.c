@@ -0,0 +1,173 @@
+#include "sd_record.h"
+#include <stdio.h>
+#include <string.h>
+#include "main.h"
+#include "sd_diskio.h"
+
+#define SD_RECORD_TIMEOUT_MS (30 * 1000)   // same limit as the driver's transfers
+
+/***************************************************************
+ * End of a DMA transfer, runs in the SD interrupt
+ ***************************************************************/
+
+static void sd_record_done(DRESULT res, void *ctx) {
+    SdRecord *r = ctx;
+
+    r->dma_res = res;
+    __DMB(); // result visible before the buffer is released
+    r->busy = 0;
+}
+
+/***************************************************************
+ * Start writing count sectors from buff at the recording end
+ ***************************************************************/
+
+static int sd_record_start(SdRecord *r, const uint8_t *buff, uint32_t count) {
+    r->busy = 1;
+    if (SD_WriteAsync(buff, r->sector + r->next, count, sd_record_done, r) != RES_OK) {
+        r->busy = 0;
+        return FR_DISK_ERR;
+    }
+    r->next += count;
+    return FR_OK;
+}
+
+/***************************************************************
+ * Create a recording file able to hold capacity bytes
+ * The capacity is allocated as one contiguous cluster run
+ * (FR_DENIED when no free run is that long) and the directory
+ * entry starts with size 0, except on exFAT where it keeps the
+ * capacity until close: the run is only marked in the
+ * allocation bitmap there, and an entry of size 0 would leave
+ * it allocated to nothing after a power loss
+ ***************************************************************/
+
+int sd_record_open(SdRecord *r, const char *filename, FSIZE_t capacity, uint32_t checkpoint_ms) {
+    FATFS *fs;
+
+    memset(r, 0, sizeof(*r));
+    if (capacity == 0) return FR_INVALID_PARAMETER;
+    r->checkpoint_ms = checkpoint_ms;
+
+    FRESULT res = f_open(&r->file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (res != FR_OK) {
+        printf("f_open failed: %d\r\n", res);
+        return res;
+    }
+
+    fs = r->file.obj.fs;
+#if _FS_EXFAT
+    r->keep_size = (fs->fs_type == FS_EXFAT);
+#endif
+    res = f_expand(&r->file, capacity, 1);
+    if (res == FR_OK && !r->keep_size) res = f_setsize(&r->file, 0);
+    if (res == FR_OK) res = f_sync(&r->file);
+    if (res != FR_OK) {
+        printf("f_expand failed: %d\r\n", res);
+        f_close(&r->file);
+        f_unlink(filename);
+        return res;
+    }
+
+    r->sector = fs->database + (r->file.obj.sclust - 2) * fs->csize;
+    r->sectors = (DWORD)((capacity + 511) / 512);
+    r->last_checkpoint = HAL_GetTick();
+    return FR_OK;
+}
+
+/***************************************************************
+ * Wait for the running transfer
+ ***************************************************************/
+
+int sd_record_wait(SdRecord *r) {
+    uint32_t start = HAL_GetTick();
+
+    while (r->busy) {
+        if ((HAL_GetTick() - start) >= SD_RECORD_TIMEOUT_MS) {
+            // stop the DMA before the caller reuses its buffer
+            SD_AsyncAbort();
+            r->busy = 0;
+            return FR_TIMEOUT;
+        }
+        SD_WaitSleep(SD_WAIT_TRANSFER);
+    }
+    return (r->dma_res == RES_OK) ? FR_OK : FR_DISK_ERR;
+}
+
+/***************************************************************
+ * Append len bytes to the recording
+ * Waits for the previous transfer, starts the DMA straight from
+ * data and returns: data must stay untouched until the next
+ * sd_record_* call, so producers fill two buffers in turn
+ * data must be 4-byte aligned and len a multiple of 512, except
+ * for the last write whose partial sector is padded with zeros
+ ***************************************************************/
+
+int sd_record_write(SdRecord *r, const void *data, uint32_t len) {
+    const uint8_t *src = data;
+    uint32_t count = len / 512;
+    uint32_t rest = len % 512;
+
+    FRESULT res = sd_record_wait(r);
+    if (res != FR_OK) return res;
+    if (r->tail_done || r->next + count + (rest ? 1 : 0) > r->sectors) return FR_DENIED;
+
+    if (count > 0) {
+        res = sd_record_start(r, src, count);
+        if (res != FR_OK) return res;
+        r->size += (FSIZE_t)count * 512;
+    }
+
+    if (rest > 0) {
+        res = sd_record_wait(r);
+        if (res != FR_OK) return res;
+        memcpy(r->tail, src + count * 512, rest);
+        memset(r->tail + rest, 0, sizeof(r->tail) - rest);
+        res = sd_record_start(r, r->tail, 1);
+        if (res != FR_OK) return res;
+        r->size += rest;
+        r->tail_done = 1;
+    }
+
+    if (r->checkpoint_ms > 0 && (HAL_GetTick() - r->last_checkpoint) >= r->checkpoint_ms) {
+        res = sd_record_checkpoint(r);
+    }
+    return res;
+}
+
+/***************************************************************
+ * Store the recorded size in the directory entry
+ * After a power loss the file holds the data up to the last
+ * checkpoint (exFAT: the whole capacity, see sd_record_open)
+ ***************************************************************/
+
+int sd_record_checkpoint(SdRecord *r) {
+    FRESULT res = sd_record_wait(r);
+
+    if (res == FR_OK && !r->keep_size && r->size != r->synced) {
+        res = f_setsize(&r->file, r->size);
+        if (res == FR_OK) res = f_sync(&r->file);
+        if (res == FR_OK) r->synced = r->size;
+    }
+    r->last_checkpoint = HAL_GetTick();
+    return res;
+}
+
+/***************************************************************
+ * Finish the recording and close the file
+ * The clusters past the recorded data go back to the free space
+ ***************************************************************/
+
+int sd_record_close(SdRecord *r) {
+    FRESULT res = sd_record_wait(r);
+
+    // back to the allocated size so f_truncate finds the whole run
+    if (res == FR_OK) res = f_setsize(&r->file, (FSIZE_t)r->sectors * 512);
+    if (res == FR_OK) res = f_lseek(&r->file, r->size);
+    if (res == FR_OK) res = f_truncate(&r->file);
+    FRESULT res_close = f_close(&r->file);
+
+    printf("Recording closed: %lu bytes in %lu sectors from %lu\r\n",
+           (unsigned long)((uint32_t)r->size), (unsigned long)r->next, (unsigned long)r->sector);
+    return (res != FR_OK) ? res : res_close;
+}
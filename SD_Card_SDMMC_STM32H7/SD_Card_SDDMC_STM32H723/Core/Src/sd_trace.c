@@ -0,0 +1,112 @@
+#include "sd_trace.h"
+#include <stdio.h>
+#include <string.h>
+#if defined(SD_HOST_IMAGE)
+#include "sd_diskio.h"
+#else
+#include "main.h"
+#include "console.h"
+#endif
+
+static SdTraceRecord ring[SD_TRACE_DEPTH];
+static volatile uint32_t head;      // records ever claimed, slot = head % depth
+static volatile uint8_t enabled;
+
+/***************************************************************
+ * Timestamp source: core cycles on the board, simulated
+ * microseconds with the host disk image
+ ***************************************************************/
+
+static inline uint32_t sd_trace_now(void) {
+#if defined(SD_HOST_IMAGE)
+    return (uint32_t)SD_Host_GetTimeUs();
+#else
+    return DWT->CYCCNT;
+#endif
+}
+
+static uint32_t sd_trace_cycles_per_us(void) {
+#if defined(SD_HOST_IMAGE)
+    return 1;
+#else
+    return SystemCoreClock / 1000000U;
+#endif
+}
+
+/***************************************************************
+ * Record one event, lock-free: the slot is claimed with
+ * LDREX/STREX so a trace point in an ISR can preempt one in
+ * the main loop. The oldest records are overwritten.
+ ***************************************************************/
+
+#if SD_TRACE_ENABLE
+void sd_trace(uint16_t event, uint32_t arg, uint32_t count) {
+    uint32_t idx;
+    SdTraceRecord *rec;
+
+    if (!enabled) return;
+
+#if defined(SD_HOST_IMAGE)
+    idx = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+#else
+    do {
+        idx = __LDREXW(&head);
+    } while (__STREXW(idx + 1, &head));
+#endif
+
+    rec = &ring[idx & (SD_TRACE_DEPTH - 1)];
+    rec->cycles = sd_trace_now();
+    rec->arg = arg;
+    rec->event = event;
+    rec->count = (count > 0xFFFF) ? 0xFFFF : (uint16_t)count;
+}
+#endif
+
+/***************************************************************
+ * Start / stop recording, the cycle counter is enabled here
+ ***************************************************************/
+
+void sd_trace_start(void) {
+#if !defined(SD_HOST_IMAGE)
+    CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+    DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+#endif
+    enabled = 1;
+}
+
+void sd_trace_stop(void) {
+    enabled = 0;
+}
+
+void sd_trace_reset(void) {
+    enabled = 0;
+    head = 0;
+    memset(ring, 0, sizeof(ring));
+}
+
+/***************************************************************
+ * Print the ring for tools/sd_trace_decode.py:
+ * TRACE_BEGIN,cycles_per_us,records,lost
+ * TRACE,cycles,event,arg,count   (hex, oldest first)
+ * TRACE_END
+ ***************************************************************/
+
+void sd_trace_dump(void) {
+    uint32_t end, n, start;
+
+    sd_trace_stop();
+    end = head;
+    n = (end > SD_TRACE_DEPTH) ? SD_TRACE_DEPTH : end;
+    start = end - n;
+
+    printf("TRACE_BEGIN,%lu,%lu,%lu\r\n", (unsigned long)sd_trace_cycles_per_us(), (unsigned long)n, (unsigned long)start);
+    for (uint32_t i = 0; i < n; i++) {
+        const SdTraceRecord *rec = &ring[(start + i) & (SD_TRACE_DEPTH - 1)];
+        printf("TRACE,%08lx,%u,%lx,%u\r\n", (unsigned long)rec->cycles, rec->event, (unsigned long)rec->arg, rec->count);
+#if !defined(SD_HOST_IMAGE)
+        // the dump is larger than the console ring: let it drain
+        if ((i & 63) == 63) console_flush(CONSOLE_FLUSH_TIMEOUT_MS);
+#endif
+    }
+    printf("TRACE_END\r\n");
+}
@@ -0,0 +1,446 @@
+#include "sd_tslog.h"
+#include "sd_csv.h"
+#include <stddef.h>
+#include <string.h>
+
+#define SD_TSLOG_BLOCK_HDR   sizeof(SdTslogBlockHeader)
+#define SD_TSLOG_HDR_CRC     offsetof(SdTslogFileHeader, crc)
+#define SD_TSLOG_BLK_CRC     offsetof(SdTslogBlockHeader, crc)
+
+static uint32_t crc_table[256];
+
+/***************************************************************
+ * CRC-32 as zlib.crc32(data, crc), byte table built at the
+ * first open
+ ***************************************************************/
+
+static void sd_tslog_crc_init(void) {
+    if (crc_table[1] != 0) return;
+    for (uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : c >> 1;
+        crc_table[i] = c;
+    }
+}
+
+static uint32_t sd_tslog_crc(uint32_t crc, const void *data, uint32_t len) {
+    const uint8_t *p = data;
+
+    crc = ~crc;
+    while (len--) crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    return ~crc;
+}
+
+uint32_t sd_tslog_format_size(const char *format) {
+    uint32_t size = 0;
+
+    for (; *format != '\0'; format++) {
+        switch (*format) {
+        case 'b': case 'B': size += 1; break;
+        case 'h': case 'H': size += 2; break;
+        case 'i': case 'I': case 'f': size += 4; break;
+        default: return 0;
+        }
+    }
+    return size;
+}
+
+/***************************************************************
+ * Write the block in buf: header and CRC filled in, unused
+ * record slots zeroed. A block written by sd_tslog_sync is
+ * written again at the same place when it fills
+ ***************************************************************/
+
+static int sd_tslog_write_block(SdTslog *w) {
+    SdTslogBlockHeader *bh = (SdTslogBlockHeader *)w->buf;
+    uint32_t used = SD_TSLOG_BLOCK_HDR + w->fill * w->hdr.record_size;
+    FSIZE_t ofs = (FSIZE_t)(w->hdr.blocks + 1) * w->hdr.block_size;
+    UINT bw;
+
+    bh->magic = SD_TSLOG_BLOCK_MAGIC;
+    bh->seq = w->hdr.blocks;
+    bh->count = w->fill;
+    bh->record_size = w->hdr.record_size;
+    bh->crc = sd_tslog_crc(sd_tslog_crc(0, bh, SD_TSLOG_BLK_CRC), w->buf + SD_TSLOG_BLOCK_HDR, used - SD_TSLOG_BLOCK_HDR);
+    memset(w->buf + used, 0, w->hdr.block_size - used);
+
+    if (f_tell(&w->file) != ofs) {
+        w->res = f_lseek(&w->file, ofs);
+        if (w->res != FR_OK) return w->res;
+    }
+    w->res = f_write(&w->file, w->buf, w->hdr.block_size, &bw);
+    if (w->res == FR_OK && bw < w->hdr.block_size) w->res = FR_DENIED;    // volume full
+    return w->res;
+}
+
+// The file header, alone in block 0
+static int sd_tslog_write_header(SdTslog *w) {
+    UINT bw;
+
+    w->hdr.crc = sd_tslog_crc(0, &w->hdr, SD_TSLOG_HDR_CRC);
+    memset(w->buf, 0, w->hdr.block_size);
+    memcpy(w->buf, &w->hdr, sizeof(w->hdr));
+
+    w->res = f_lseek(&w->file, 0);
+    if (w->res == FR_OK) w->res = f_write(&w->file, w->buf, w->hdr.block_size, &bw);
+    if (w->res == FR_OK && bw < w->hdr.block_size) w->res = FR_DENIED;
+    return w->res;
+}
+
+/***************************************************************
+ * Create a log of records with the given payload format
+ * buf holds one block of block_size bytes (a power of two from
+ * 512, 4-byte aligned)
+ ***************************************************************/
+
+int sd_tslog_open(SdTslog *w, const char *filename, const char *format, uint8_t *buf, uint32_t block_size) {
+    uint32_t payload = sd_tslog_format_size(format);
+
+    if (block_size < 512 || (block_size & (block_size - 1)) || ((uintptr_t)buf & 0x3)) return FR_INVALID_PARAMETER;
+    if (payload == 0 || strlen(format) >= SD_TSLOG_FORMAT_MAX) return FR_INVALID_PARAMETER;
+    if (4 + payload > block_size - SD_TSLOG_BLOCK_HDR) return FR_INVALID_PARAMETER;
+
+    sd_tslog_crc_init();
+    memset(w, 0, sizeof(*w));
+    w->buf = buf;
+    w->hdr.magic = SD_TSLOG_MAGIC;
+    w->hdr.version = SD_TSLOG_VERSION;
+    w->hdr.header_size = sizeof(SdTslogFileHeader);
+    w->hdr.block_size = block_size;
+    w->hdr.record_size = 4 + payload;
+    w->hdr.records_per_block = (block_size - SD_TSLOG_BLOCK_HDR) / w->hdr.record_size;
+    strcpy(w->hdr.format, format);
+    w->hdr.index_stride = 1;
+
+    w->res = f_open(&w->file, filename, FA_CREATE_ALWAYS | FA_WRITE);
+    if (w->res != FR_OK) return w->res;
+    return sd_tslog_write_header(w);
+}
+
+/***************************************************************
+ * Add one record, payload as described by the format
+ * A new block gets an index entry when its number is a
+ * multiple of the stride
+ ***************************************************************/
+
+int sd_tslog_append(SdTslog *w, uint32_t t, const void *payload) {
+    SdTslogBlockHeader *bh = (SdTslogBlockHeader *)w->buf;
+    uint8_t *rec;
+
+    if (w->res != FR_OK) return w->res;
+    if (w->hdr.records > 0 && t < w->hdr.t_last) return FR_INVALID_PARAMETER;
+
+    if (w->fill == 0) {
+        uint32_t seq = w->hdr.blocks;
+
+        if (seq % w->hdr.index_stride == 0 && w->hdr.index_entries == SD_TSLOG_INDEX_MAX) {
+            for (uint32_t i = 0; i < SD_TSLOG_INDEX_MAX / 2; i++) {
+                w->index[i] = w->index[2 * i];
+            }
+            w->hdr.index_entries = SD_TSLOG_INDEX_MAX / 2;
+            w->hdr.index_stride *= 2;
+        }
+        if (seq % w->hdr.index_stride == 0) {
+            w->index[w->hdr.index_entries].t_first = t;
+            w->index[w->hdr.index_entries].block = seq;
+            w->hdr.index_entries++;
+        }
+        bh->t_first = t;
+    }
+    if (w->hdr.records == 0) w->hdr.t_first = t;
+
+    rec = w->buf + SD_TSLOG_BLOCK_HDR + w->fill * w->hdr.record_size;
+    memcpy(rec, &t, 4);
+    memcpy(rec + 4, payload, w->hdr.record_size - 4);
+    bh->t_last = t;
+    w->hdr.t_last = t;
+    w->hdr.records++;
+
+    if (++w->fill == w->hdr.records_per_block) {
+        if (sd_tslog_write_block(w) != FR_OK) return w->res;
+        w->hdr.blocks++;
+        w->fill = 0;
+    }
+    return FR_OK;
+}
+
+/***************************************************************
+ * Put the records so far on the card: the partial block is
+ * written and the file synced, so a reader of an unclosed log
+ * (no index) finds them
+ ***************************************************************/
+
+int sd_tslog_sync(SdTslog *w) {
+    if (w->res != FR_OK) return w->res;
+    if (w->fill > 0 && sd_tslog_write_block(w) != FR_OK) return w->res;
+    w->res = f_sync(&w->file);
+    return w->res;
+}
+
+/***************************************************************
+ * Write the last block, the index behind it and the final
+ * file header, then close
+ ***************************************************************/
+
+int sd_tslog_close(SdTslog *w) {
+    uint32_t bytes = w->hdr.index_entries * sizeof(SdTslogIndexEntry);
+    const uint8_t *index = (const uint8_t *)w->index;
+    UINT bw;
+
+    if (w->res == FR_OK && w->fill > 0 && sd_tslog_write_block(w) == FR_OK) {
+        w->hdr.blocks++;
+        w->fill = 0;
+    }
+
+    if (w->res == FR_OK) {
+        w->hdr.index_block = w->hdr.blocks + 1;
+        w->hdr.index_crc = sd_tslog_crc(0, index, bytes);
+        w->res = f_lseek(&w->file, (FSIZE_t)w->hdr.index_block * w->hdr.block_size);
+    }
+    while (w->res == FR_OK && bytes > 0) {
+        uint32_t n = bytes < w->hdr.block_size ? bytes : w->hdr.block_size;
+
+        memset(w->buf, 0, w->hdr.block_size);
+        memcpy(w->buf, index, n);
+        w->res = f_write(&w->file, w->buf, w->hdr.block_size, &bw);
+        if (w->res == FR_OK && bw < w->hdr.block_size) w->res = FR_DENIED;
+        index += n;
+        bytes -= n;
+    }
+    if (w->res == FR_OK) sd_tslog_write_header(w);
+
+    FRESULT res_close = f_close(&w->file);
+    return (w->res != FR_OK) ? w->res : res_close;
+}
+
+/***************************************************************
+ * Open a log for queries: checks the header, builds the fast
+ * seek link map and loads the index. Without a valid index the
+ * data blocks are counted from the file size
+ ***************************************************************/
+
+int sd_tslog_reader_open(SdTslogReader *r, const char *filename, uint8_t *buf, uint32_t buf_size) {
+    SdTslogFileHeader *hdr = &r->hdr;
+    UINT br;
+
+    if (buf_size < 512 || ((uintptr_t)buf & 0x3)) return FR_INVALID_PARAMETER;
+
+    sd_tslog_crc_init();
+    memset(r, 0, sizeof(*r));
+    r->buf = buf;
+    r->buf_size = buf_size;
+
+    FRESULT res = f_open(&r->file, filename, FA_READ);
+    if (res != FR_OK) return res;
+
+    res = f_read(&r->file, buf, 512, &br);
+    if (res == FR_OK && br < sizeof(*hdr)) res = FR_NO_FILE;
+    if (res == FR_OK) {
+        memcpy(hdr, buf, sizeof(*hdr));
+        hdr->format[SD_TSLOG_FORMAT_MAX - 1] = '\0';
+        if (hdr->magic != SD_TSLOG_MAGIC || hdr->version != SD_TSLOG_VERSION
+                || hdr->crc != sd_tslog_crc(0, hdr, SD_TSLOG_HDR_CRC)) {
+            res = FR_NO_FILE;       // not a log
+        } else if (hdr->block_size < 512 || (hdr->block_size & (hdr->block_size - 1)) || hdr->block_size > buf_size
+                || hdr->record_size != 4 + sd_tslog_format_size(hdr->format)) {
+            res = FR_INVALID_PARAMETER;
+        }
+    }
+
+#if _USE_FASTSEEK
+    if (res == FR_OK) {
+        r->file.cltbl = r->clmt;
+        r->clmt[0] = SD_TSLOG_CLMT_SIZE;
+        res = f_lseek(&r->file, CREATE_LINKMAP);
+        if (res == FR_NOT_ENOUGH_CORE) {
+            r->file.cltbl = 0;      // too fragmented, follow the FAT chain
+            res = FR_OK;
+        }
+    }
+#endif
+
+    if (res == FR_OK && hdr->index_block != 0 && hdr->index_entries <= SD_TSLOG_INDEX_MAX) {
+        uint32_t bytes = hdr->index_entries * sizeof(SdTslogIndexEntry);
+
+        res = f_lseek(&r->file, (FSIZE_t)hdr->index_block * hdr->block_size);
+        if (res == FR_OK) res = f_read(&r->file, r->index, bytes, &br);
+        if (res == FR_OK && (br < bytes || hdr->index_crc != sd_tslog_crc(0, r->index, bytes))) {
+            hdr->index_block = 0;
+        }
+    } else {
+        hdr->index_block = 0;
+    }
+    if (res == FR_OK && hdr->index_block == 0) {
+        // not closed: every whole block behind the header is data
+        hdr->index_entries = 0;
+        hdr->blocks = (uint32_t)(f_size(&r->file) / hdr->block_size);
+        if (hdr->blocks > 0) hdr->blocks--;
+    }
+
+    if (res != FR_OK) f_close(&r->file);
+    return res;
+}
+
+/***************************************************************
+ * Read data block b into buf, whole (len = block_size) or only
+ * its first sector for the header
+ ***************************************************************/
+
+static int sd_tslog_read_block(SdTslogReader *r, uint32_t b, uint32_t len, SdTslogBlockHeader *bh) {
+    UINT br;
+    FRESULT res = f_lseek(&r->file, (FSIZE_t)(b + 1) * r->hdr.block_size);
+
+    if (res == FR_OK) res = f_read(&r->file, r->buf, len, &br);
+    if (res == FR_OK && br < len) res = FR_INT_ERR;
+    if (res == FR_OK) memcpy(bh, r->buf, sizeof(*bh));
+    return res;
+}
+
+/***************************************************************
+ * Call fn for every record with t_from <= t <= t_to
+ * The index brackets the first block, a binary search over the
+ * block headers in the bracket finds it, then blocks are read
+ * in order until one starts after t_to. Blocks failing their
+ * CRC are counted in bad_blocks and skipped
+ ***************************************************************/
+
+int sd_tslog_query(SdTslogReader *r, uint32_t t_from, uint32_t t_to,
+                   SdTslogRecordFn fn, void *ctx, uint32_t *records) {
+    const SdTslogFileHeader *hdr = &r->hdr;
+    SdTslogBlockHeader bh;
+    uint32_t lo = 0, hi = hdr->blocks, count = 0;
+    FRESULT res = FR_OK;
+    int stop = 0;
+
+    r->blocks_read = 0;
+    r->headers_read = 0;
+    if (records) *records = 0;
+
+    // index: last entry starting before t_from, first starting at or after it
+    for (uint32_t a = 0, b = hdr->index_entries; a < b; ) {
+        uint32_t mid = (a + b) / 2;
+
+        if (r->index[mid].t_first < t_from) {
+            lo = r->index[mid].block;
+            a = mid + 1;
+        } else {
+            hi = r->index[mid].block;
+            b = mid;
+        }
+    }
+
+    // first block in [lo, hi) whose last record is not before t_from
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        res = sd_tslog_read_block(r, mid, 512, &bh);
+        if (res != FR_OK) return res;
+        r->headers_read++;
+        if (bh.magic != SD_TSLOG_BLOCK_MAGIC || bh.t_last < t_from) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (uint32_t b = lo; b < hdr->blocks && !stop; b++) {
+        const uint8_t *rec;
+
+        res = sd_tslog_read_block(r, b, hdr->block_size, &bh);
+        if (res != FR_OK) break;
+        r->blocks_read++;
+
+        if (bh.magic != SD_TSLOG_BLOCK_MAGIC || bh.count > hdr->records_per_block || bh.record_size != hdr->record_size
+                || bh.crc != sd_tslog_crc(sd_tslog_crc(0, &bh, SD_TSLOG_BLK_CRC),
+                                          r->buf + SD_TSLOG_BLOCK_HDR, bh.count * bh.record_size)) {
+            r->bad_blocks++;
+            continue;
+        }
+        if (bh.t_first > t_to) break;
+
+        rec = r->buf + SD_TSLOG_BLOCK_HDR;
+        for (uint32_t i = 0; i < bh.count; i++, rec += hdr->record_size) {
+            uint32_t t;
+
+            memcpy(&t, rec, 4);
+            if (t < t_from) continue;
+            if (t > t_to) {
+                stop = 1;
+                break;
+            }
+            count++;
+            if (fn(t, rec + 4, ctx) != 0) {
+                stop = 1;
+                break;
+            }
+        }
+    }
+
+    if (records) *records = count;
+    return res;
+}
+
+int sd_tslog_reader_close(SdTslogReader *r) {
+    return f_close(&r->file);
+}
+
+/***************************************************************
+ * CSV conversion: one row per record through the sd_csv row
+ * writer, the payload decoded field by field from the format
+ ***************************************************************/
+
+typedef struct {
+    SdCsvWriter *csv;
+    const char *format;
+} TslogCsv;
+
+static int sd_tslog_csv_record(uint32_t t, const uint8_t *payload, void *ctx) {
+    TslogCsv *conv = ctx;
+    SdCsvWriter *csv = conv->csv;
+
+    sd_csv_put_uint(csv, t);
+    for (const char *f = conv->format; *f != '\0'; f++) {
+        switch (*f) {
+        case 'b': sd_csv_put_int(csv, (int8_t)payload[0]); payload += 1; break;
+        case 'B': sd_csv_put_uint(csv, payload[0]); payload += 1; break;
+        case 'h': { int16_t v; memcpy(&v, payload, 2); sd_csv_put_int(csv, v); payload += 2; break; }
+        case 'H': { uint16_t v; memcpy(&v, payload, 2); sd_csv_put_uint(csv, v); payload += 2; break; }
+        case 'i': { int32_t v; memcpy(&v, payload, 4); sd_csv_put_int(csv, v); payload += 4; break; }
+        case 'I': { uint32_t v; memcpy(&v, payload, 4); sd_csv_put_uint(csv, v); payload += 4; break; }
+        case 'f': { float v; memcpy(&v, payload, 4); sd_csv_put_float(csv, v, 3); payload += 4; break; }
+        }
+    }
+    return sd_csv_end_row(csv) != FR_OK;
+}
+
+int sd_tslog_to_csv(const char *filename, const char *csv_name, uint32_t t_from, uint32_t t_to,
+                    uint8_t *buf, uint32_t buf_size, uint8_t *csv_buf, uint32_t csv_buf_size) {
+    SdTslogReader reader;
+    SdCsvWriter csv;
+    TslogCsv conv = { &csv, reader.hdr.format };
+    char name[4] = "v";   // v0 .. v14
+
+    FRESULT res = sd_tslog_reader_open(&reader, filename, buf, buf_size);
+    if (res != FR_OK) return res;
+
+    res = sd_csv_writer_open(&csv, csv_name, csv_buf, csv_buf_size);
+    if (res == FR_OK) {
+        sd_csv_put_str(&csv, "time_ms");
+        for (uint32_t i = 0; reader.hdr.format[i] != '\0'; i++) {
+            if (i < 10) {
+                name[1] = (char)('0' + i);
+            } else {
+                name[1] = (char)('0' + i / 10);
+                name[2] = (char)('0' + i % 10);
+            }
+            sd_csv_put_str(&csv, name);
+        }
+        sd_csv_end_row(&csv);
+
+        res = sd_tslog_query(&reader, t_from, t_to, sd_tslog_csv_record, &conv, NULL);
+        FRESULT res_csv = sd_csv_writer_close(&csv);
+        if (res == FR_OK) res = res_csv;
+    }
+    sd_tslog_reader_close(&reader);
+    return res;
+}
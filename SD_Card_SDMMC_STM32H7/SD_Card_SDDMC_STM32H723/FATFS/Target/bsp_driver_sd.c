@@ -171,6 +171,55 @@ __weak uint8_t BSP_SD_WriteBlocks_DMA(uint32_t *pData, uint32_t WriteAddr, uint3
   return sd_state;
 }
 
+/**
+  * @brief  Tells the card how many blocks the next multi-block write will carry
+  *         (ACMD23 SET_WR_BLK_ERASE_COUNT) so it can pre-erase them.
+  *         Must be issued right before BSP_SD_WriteBlocks_DMA().
+  * @param  NumOfBlocks: Number of SD blocks of the next write
+  * @retval SD status
+  */
+uint8_t BSP_SD_SetWriteBlockEraseCount(uint32_t NumOfBlocks)
+{
+  SDMMC_CmdInitTypeDef sdmmc_cmdinit;
+
+  /* CMD55: next command is application specific */
+  if (SDMMC_CmdAppCommand(hsd1.Instance, (uint32_t)(hsd1.SdCard.RelCardAdd << 16U)) != HAL_SD_ERROR_NONE)
+  {
+    return MSD_ERROR;
+  }
+
+  /* ACMD23: number of blocks to pre-erase, 23-bit argument */
+  sdmmc_cmdinit.Argument         = NumOfBlocks & 0x007FFFFFU;
+  sdmmc_cmdinit.CmdIndex         = SD_CMD_SD_APP_SET_WR_BLK_ERASE_COUNT;
+  sdmmc_cmdinit.Response         = SDMMC_RESPONSE_SHORT;
+  sdmmc_cmdinit.WaitForInterrupt = SDMMC_WAIT_NO;
+  sdmmc_cmdinit.CPSM             = SDMMC_CPSM_ENABLE;
+  (void)SDMMC_SendCommand(hsd1.Instance, &sdmmc_cmdinit);
+
+  if (SDMMC_GetCmdResp1(hsd1.Instance, SD_CMD_SD_APP_SET_WR_BLK_ERASE_COUNT, SDMMC_CMDTIMEOUT) != HAL_SD_ERROR_NONE)
+  {
+    return MSD_ERROR;
+  }
+
+  return MSD_OK;
+}
+
+/**
+  * @brief  Stops a running DMA transfer and the card (CMD12)
+  * @retval SD status
+  */
+uint8_t BSP_SD_Abort(void)
+{
+  uint8_t sd_state = MSD_OK;
+
+  if (HAL_SD_Abort(&hsd1) != HAL_OK)
+  {
+    sd_state = MSD_ERROR;
+  }
+
+  return sd_state;
+}
+
 /* USER CODE BEGIN BeforeEraseSection */
 /* can be used to modify previous code / undefine following code / add code */
 /* USER CODE END BeforeEraseSection */
@@ -233,6 +282,16 @@ void HAL_SD_AbortCallback(SD_HandleTypeDef *hsd)
   BSP_SD_AbortCallback();
 }
 
+/**
+  * @brief SD error callback
+  * @param hsd: SD handle
+  * @retval None
+  */
+void HAL_SD_ErrorCallback(SD_HandleTypeDef *hsd)
+{
+  BSP_SD_ErrorCallback();
+}
+
 /**
   * @brief Tx Transfer completed callback
   * @param hsd: SD handle
@@ -264,6 +323,16 @@ __weak void BSP_SD_AbortCallback(void)
 
 }
 
+/**
+  * @brief BSP SD error callback
+  * @retval None
+  * @note empty (up to the user to fill it in or to remove it if useless)
+  */
+__weak void BSP_SD_ErrorCallback(void)
+{
+
+}
+
 /**
   * @brief BSP Tx Transfer completed callback
   * @retval None
@@ -22,9 +22,11 @@
 /*-----------------------------------------------------------------------------/
 / Additional user header to be used
 /-----------------------------------------------------------------------------*/
+#if !defined(SD_HOST_IMAGE)
 #include "main.h"
 #include "stm32h7xx_hal.h"
 #include "bsp_driver_sd.h"
+#endif
 
 /*-----------------------------------------------------------------------------/
 / Function Configurations
@@ -199,6 +201,13 @@
 /  bit1=1: Do not trust last allocated cluster number in the FSINFO.
 */
 
+#define _FS_CLNSHUT     1 /* 0:Disable or 1:Enable */
+/* When enabled, the FAT32 clean shutdown bit (bit 27 of FAT[1]) is cleared before
+/  the first FAT change and set again by f_syncvol(), which sd_unmount() calls.
+/  f_sync() leaves it cleared, so periodic syncs cost no extra FAT[1] and FSINFO
+/  writes. At mount, the FSINFO free cluster count is trusted only if the bit is
+/  set, so a count left stale by a power loss is recounted instead of reported. */
+
 /*---------------------------------------------------------------------------/
 / System Configurations
 /----------------------------------------------------------------------------*/
@@ -209,6 +218,41 @@
 /  Instead of private sector buffer eliminated from the file object, common sector
 /  buffer in the file system object (FATFS) is used for the file data transfer. */
 
+#define _FS_FATCACHE    4096 /* 0:Disable or RAM budget in bytes (>= _MAX_SS) */
+/* This option sets the size of the FAT sector cache in the file system object.
+/  FAT sectors are kept in _FS_FATCACHE / _MAX_SS slots with LRU replacement and
+/  written back to all FAT copies at f_sync()/f_close() or on eviction, so that
+/  cluster allocation does not evict directory sectors from the shared window.
+/  When 0, FAT sectors go through the window as in the original FatFs. */
+
+#define _FS_FATBITMAP   1024 /* 0:Disable or size of the free cluster bitmap in bytes */
+/* This option adds a bitmap with one bit per group of clusters to the file system
+/  object. A set bit means every cluster of the group is in use, so the allocator
+/  skips the group without reading the FAT. Groups are sized at mount so that the
+/  whole FAT12/16/32 volume fits in _FS_FATBITMAP * 8 bits. The bitmap is built by
+/  the f_getfree() FAT scan and while allocating, and freed clusters clear it. */
+
+#define _FS_AUTOCLMT       2 /* 0:Disable or number of files with an automatic link map */
+#define _FS_AUTOCLMT_SIZE  256 /* Items per automatic link map (2 per fragment + 2) */
+/* This option makes fast seek automatic for files opened without FA_WRITE. The
+/  first f_lseek() past the top cluster of such a file builds its cluster link map
+/  into one of _FS_AUTOCLMT static tables of _FS_AUTOCLMT_SIZE DWORDs, and later
+/  seeks and reads convert offsets with the map instead of following the FAT chain.
+/  The table is released at f_close(), or when the volume is unmounted or remounted
+/  for a file dropped without f_close(). A file is left in normal seek mode when all
+/  tables are in use or its chain has too many fragments. Needs _USE_FASTSEEK. */
+
+#define _FS_DIRINDEX    10240 /* 0:Disable or number of items in the directory index */
+/* This option adds a lookup index of one FAT12/16/32 directory to the file system
+/  object, 6 bytes per item. The index is built by the first lookup of a file name
+/  in a directory and keeps a hash of the long and short name and the entry offset
+/  of every item, so that finding a name reads only the entries with a matching
+/  hash and a missing name reads none. It also tracks the lowest entry that may be
+/  free, where the search for free entries starts. Creating and removing items
+/  updates the index. Directories with more items than the index holds are
+/  searched linearly, and the last one found is remembered so that later lookups
+/  in it do not scan it again trying to index it. Needs _USE_LFN. */
+
 #define _FS_EXFAT	0
 /* This option switches support of exFAT file system. (0:Disable or 1:Enable)
 /  When enable exFAT, also LFN needs to be enabled. (_USE_LFN >= 1)
@@ -28,12 +28,112 @@
 /* USER CODE END firstSection */
 
 /* Includes ------------------------------------------------------------------*/
+#if defined(SD_HOST_IMAGE)
+#include "ff_gen_drv.h"
+#else
 #include "bsp_driver_sd.h"
+#endif
 /* Exported types ------------------------------------------------------------*/
+#if defined(SD_HOST_IMAGE)
+/**
+  * @brief  Timing model of the host disk image backend.
+  *         Time is simulated (no sleeping): every command adds cmd_latency_us,
+  *         the payload is charged at the given throughput and each write command
+  *         also pays busy_us for the card programming phase.
+  */
+typedef struct
+{
+  const char *name;
+  uint32_t    cmd_latency_us;  /*!< CMD17/18/24/25 issue + response overhead */
+  uint32_t    read_kbps;       /*!< Sustained read throughput in KB/s        */
+  uint32_t    write_kbps;      /*!< Sustained write throughput in KB/s       */
+  uint32_t    busy_us;         /*!< Card busy time after each write command  */
+} SD_HostProfileTypeDef;
+
+/**
+  * @brief  Command / sector counters of the host disk image backend
+  */
+typedef struct
+{
+  uint32_t read_cmds;
+  uint32_t write_cmds;
+  uint32_t read_sectors;
+  uint32_t write_sectors;
+} SD_HostStatsTypeDef;
+#endif /* SD_HOST_IMAGE */
+
+/**
+  * @brief  What the driver is waiting for when it calls the wait hook
+  */
+typedef enum
+{
+  SD_WAIT_TRANSFER = 0,   /*!< DMA running, ends with the Rx/Tx complete interrupt */
+  SD_WAIT_CARD_BUSY       /*!< Card programming, polled: no interrupt will come    */
+} SD_WaitTypeDef;
+
+typedef void (*SD_WaitHookTypeDef)(SD_WaitTypeDef wait);
+typedef void (*SD_DoneCallbackTypeDef)(DRESULT res, void *ctx);
+
+/**
+  * @brief  Write-back cache counters
+  */
+typedef struct
+{
+  uint32_t cached_sectors;   /*!< Sectors accepted into the cache          */
+  uint32_t flushes;          /*!< Multi-block writes issued from the cache */
+  uint32_t flushed_sectors;  /*!< Sectors written by those flushes         */
+  uint32_t bypass_writes;    /*!< Large writes sent straight to the card   */
+  uint32_t errors;           /*!< Failed flushes                           */
+} SD_WriteCacheStatsTypeDef;
+
 /* Exported constants --------------------------------------------------------*/
+/*
+ * DMA buffer placement. On cores with a D-cache, buffers tagged SD_DMA_BUFFER go to the
+ * .sd_dma_buffer section which the MPU maps non-cacheable (see the linker script and
+ * SD_DMA_MPU_Config() in main.c): no cache maintenance is done on them. Other buffers
+ * stay cacheable and are cleaned / invalidated around each transfer.
+ */
+#if defined(__DCACHE_PRESENT) && (__DCACHE_PRESENT == 1U)
+#define SD_DMA_BUFFER            __attribute__((section(".sd_dma_buffer"), aligned(32)))
+#define SD_DMA_REGION_SIZE       (16U * 1024U)   /* must match the linker script */
+#else
+#define SD_DMA_BUFFER            __attribute__((aligned(32)))
+#endif
+
+#if defined(SD_HOST_IMAGE)
+extern const SD_HostProfileTypeDef SD_HostProfile_H723_SDMMC1;
+extern const SD_HostProfileTypeDef SD_HostProfile_F407_SDIO;
+#endif /* SD_HOST_IMAGE */
+
 /* Exported functions ------------------------------------------------------- */
 extern const Diskio_drvTypeDef  SD_Driver;
 
+DRESULT SD_WriteCache_Flush(void);
+DRESULT SD_WriteCache_Poll(void);
+void    SD_WriteCache_GetStats(SD_WriteCacheStatsTypeDef *stats);
+void    SD_WriteCache_ResetStats(void);
+void    SD_SetPreErase(uint8_t enable);
+
+void    SD_SetWaitHook(SD_WaitHookTypeDef hook);
+void    SD_WaitSleep(SD_WaitTypeDef wait);
+DRESULT SD_ReadAsync(BYTE *buff, DWORD sector, UINT count, SD_DoneCallbackTypeDef cb, void *ctx);
+DRESULT SD_WriteAsync(const BYTE *buff, DWORD sector, UINT count, SD_DoneCallbackTypeDef cb, void *ctx);
+uint8_t SD_AsyncBusy(void);
+DRESULT SD_AsyncAbort(void);
+
+#if defined(SD_HOST_IMAGE)
+/*
+ * Host build: SD_Driver is backed by a memory-mapped disk image instead of the
+ * SDIO/SDMMC BSP. Build FATFS/App, FATFS/Target/sd_diskio.c and the FatFs
+ * middleware with -DSD_HOST_IMAGE and call SD_Host_Open() before f_mount().
+ */
+int      SD_Host_Open(const char *path, const SD_HostProfileTypeDef *profile);
+void     SD_Host_Close(void);
+uint64_t SD_Host_GetTimeUs(void);
+void     SD_Host_GetStats(SD_HostStatsTypeDef *stats);
+void     SD_Host_ResetStats(void);
+#endif /* SD_HOST_IMAGE */
+
 /* USER CODE BEGIN lastSection */
 /* can be used to modify / undefine previous code or add new definitions */
 /* USER CODE END lastSection */
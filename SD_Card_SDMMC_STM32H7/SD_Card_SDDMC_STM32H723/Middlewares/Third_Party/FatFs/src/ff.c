@@ -20,6 +20,7 @@
 
 #include "ff.h"			/* Declarations of FatFs API */
 #include "diskio.h"		/* Declarations of device I/O functions */
+#include "sd_trace_points.h"	/* SD_TRACE() trace points */
 
 
 /*--------------------------------------------------------------------------
@@ -324,6 +325,7 @@
 /* Limits and boundaries */
 #define MAX_DIR		0x200000		/* Max size of FAT directory */
 #define MAX_DIR_EX	0x10000000		/* Max size of exFAT directory */
+#define NUMNAME_BATCH	8				/* Numbered SFNs checked in one directory pass */
 #define MAX_FAT12	0xFF5			/* Max FAT12 clusters (differs from specs, but correct for real DOS/Windows behavior) */
 #define	MAX_FAT16	0xFFF5			/* Max FAT16 clusters (differs from specs, but correct for real DOS/Windows behavior) */
 #define	MAX_FAT32	0x0FFFFFF5		/* Max FAT32 clusters (not specified, practical limit) */
@@ -489,6 +491,50 @@
 #endif
 
 
+/* FAT sector cache */
+#if _FS_FATCACHE
+#if _FS_FATCACHE_SLOTS < 1
+#error _FS_FATCACHE must be 0 or at least _MAX_SS
+#endif
+#define FAT_DIRTY(fs)	{ if ((fs)->fc_slots) (fs)->fc_dirty[(fs)->fc_cur] = 1; else (fs)->wflag = 1; }
+#else
+#define FAT_DIRTY(fs)	(fs)->wflag = 1
+#endif
+
+
+/* Free cluster bitmap */
+#if _FS_FATBITMAP
+#define FBM_MASK(fs)		(((DWORD)1 << (fs)->fbm_shift) - 1)	/* Cluster index in the group */
+#define FBM_GRP(fs, clst)	((clst) >> (fs)->fbm_shift)
+#define FBM_FULL(fs, clst)	((fs)->fbm[FBM_GRP(fs, clst) / 8] & (1 << (FBM_GRP(fs, clst) % 8)))
+#define FBM_SET(fs, clst)	(fs)->fbm[FBM_GRP(fs, clst) / 8] |= (BYTE)(1 << (FBM_GRP(fs, clst) % 8))
+#define FBM_CLR(fs, clst)	(fs)->fbm[FBM_GRP(fs, clst) / 8] &= (BYTE)~(1 << (FBM_GRP(fs, clst) % 8))
+#endif
+
+
+/* Automatic fast seek */
+#if _FS_AUTOCLMT
+#if !_USE_FASTSEEK
+#error _FS_AUTOCLMT needs _USE_FASTSEEK
+#endif
+#if _FS_AUTOCLMT_SIZE < 4
+#error _FS_AUTOCLMT_SIZE must be at least 4
+#endif
+#endif
+
+
+/* Directory index */
+#if _FS_DIRINDEX
+#if _USE_LFN == 0
+#error _FS_DIRINDEX needs _USE_LFN
+#endif
+#if _FS_DIRINDEX > MAX_DIR / SZDIRE
+#error _FS_DIRINDEX is larger than a directory
+#endif
+#define DI_HELD(fs, dp)	((fs)->di_valid && (fs)->di_sclust == (dp)->obj.sclust)	/* Is the directory in the index? */
+#endif
+
+
 /* Timestamp */
 #if _FS_NORTC == 1
 #if _NORTC_YEAR < 1980 || _NORTC_YEAR > 2107 || _NORTC_MON < 1 || _NORTC_MON > 12 || _NORTC_MDAY < 1 || _NORTC_MDAY > 31
@@ -513,6 +559,15 @@ typedef struct {
 } FILESEM;
 #endif
 
+#if _FS_AUTOCLMT
+typedef struct {
+	FIL *fp;		/* File using the table (NULL:free), compared only, never dereferenced */
+	FATFS *fs;		/* Owner ID 1, volume */
+	WORD id;		/* Owner ID 2, mount ID of the volume */
+	DWORD sclust;	/* Owner ID 3, top cluster of the file */
+} CLMTOWN;
+#endif
+
 
 
 
@@ -541,6 +596,11 @@ static BYTE CurrVol;			/* Current drive */
 static FILESEM Files[_FS_LOCK];	/* Open object lock semaphores */
 #endif
 
+#if _FS_AUTOCLMT
+static DWORD ClmtPool[_FS_AUTOCLMT][_FS_AUTOCLMT_SIZE];	/* Automatic link map tables */
+static CLMTOWN ClmtOwner[_FS_AUTOCLMT];	/* Owner of each table */
+#endif
+
 #if _USE_LFN == 0		/* Non-LFN configuration */
 #define	DEF_NAMBUF
 #define INIT_NAMBUF(fs)
@@ -891,14 +951,21 @@ FRESULT sync_window (	/* Returns FR_OK or FR_DISK_ERROR */
 
 	if (fs->wflag) {	/* Write back the sector if it is dirty */
 		wsect = fs->winsect;	/* Current sector number */
+		SD_TRACE(SD_TRACE_SYNC_WINDOW, wsect, 1);
 		if (disk_write(fs->drv, fs->win, wsect, 1) != RES_OK) {
 			res = FR_DISK_ERR;
 		} else {
 			fs->wflag = 0;
+#if _FS_FATCACHE
+			fs->n_io++;
+#endif
 			if (wsect - fs->fatbase < fs->fsize) {		/* Is it in the FAT area? */
 				for (nf = fs->n_fats; nf >= 2; nf--) {	/* Reflect the change to all FAT copies */
 					wsect += fs->fsize;
 					disk_write(fs->drv, fs->win, wsect, 1);
+#if _FS_FATCACHE
+					fs->n_io++;
+#endif
 				}
 			}
 		}
@@ -918,6 +985,7 @@ FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERROR */
 
 
 	if (sector != fs->winsect) {	/* Window offset changed? */
+		SD_TRACE(SD_TRACE_MOVE_WINDOW, sector, 1);
 #if !_FS_READONLY
 		res = sync_window(fs);		/* Write-back changes */
 #endif
@@ -926,6 +994,9 @@ FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERROR */
 				sector = 0xFFFFFFFF;	/* Invalidate window if data is not reliable */
 				res = FR_DISK_ERR;
 			}
+#if _FS_FATCACHE
+			fs->n_io++;
+#endif
 			fs->winsect = sector;
 		}
 	}
@@ -935,6 +1006,153 @@ FRESULT move_window (	/* Returns FR_OK or FR_DISK_ERROR */
 
 
 
+/*-----------------------------------------------------------------------*/
+/* FAT sector cache                                                      */
+/*-----------------------------------------------------------------------*/
+/* FAT sectors are kept in fs->fc_buf[] slots (LRU, write-back) so that  */
+/* cluster allocation does not evict the directory sector from fs->win[] */
+
+#if _FS_FATCACHE
+static
+void clear_fatcache (
+	FATFS* fs			/* File system object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_FATCACHE_SLOTS; i++) {
+		fs->fc_sect[i] = 0xFFFFFFFF;
+		fs->fc_used[i] = 0;
+		fs->fc_dirty[i] = 0;
+	}
+	fs->fc_tick = 0;
+	fs->fc_cur = 0;
+}
+
+
+#if !_FS_READONLY
+static
+FRESULT write_fatcache (	/* Returns FR_OK or FR_DISK_ERROR */
+	FATFS* fs,			/* File system object */
+	UINT slot			/* Slot to be written back if dirty */
+)
+{
+	DWORD wsect;
+	UINT nf;
+
+
+	if (fs->fc_dirty[slot]) {
+		wsect = fs->fc_sect[slot];
+		SD_TRACE(SD_TRACE_SYNC_WINDOW, wsect, 1);
+		if (disk_write(fs->drv, fs->fc_buf[slot], wsect, 1) != RES_OK) return FR_DISK_ERR;
+		fs->fc_dirty[slot] = 0;
+		fs->n_io++;
+		for (nf = fs->n_fats; nf >= 2; nf--) {	/* Reflect the change to all FAT copies */
+			wsect += fs->fsize;
+			disk_write(fs->drv, fs->fc_buf[slot], wsect, 1);
+			fs->n_io++;
+		}
+	}
+	return FR_OK;
+}
+
+
+static
+FRESULT sync_fatcache (	/* Returns FR_OK or FR_DISK_ERROR */
+	FATFS* fs			/* File system object */
+)
+{
+	UINT i;
+
+
+	for (i = 0; i < _FS_FATCACHE_SLOTS; i++) {
+		if (write_fatcache(fs, i) != FR_OK) return FR_DISK_ERR;
+	}
+	return FR_OK;
+}
+#endif
+#endif	/* _FS_FATCACHE */
+
+
+static
+BYTE* fat_sector (	/* Pointer to the sector data, 0:Disk error */
+	FATFS* fs,			/* File system object */
+	DWORD sector		/* FAT sector number to be accessed */
+)
+{
+#if _FS_FATCACHE
+	UINT i, lru;
+
+
+	if (fs->fc_slots) {
+		lru = 0;
+		for (i = 0; i < fs->fc_slots; i++) {
+			if (fs->fc_sect[i] == sector) {		/* Hit */
+				fs->fc_hit++;
+				fs->fc_used[i] = ++fs->fc_tick;
+				fs->fc_cur = i;
+				return fs->fc_buf[i];
+			}
+			if (fs->fc_used[i] < fs->fc_used[lru]) lru = i;	/* Empty slots have the oldest stamp */
+		}
+		fs->fc_miss++;
+#if !_FS_READONLY
+		if (write_fatcache(fs, lru) != FR_OK) return 0;	/* Evict the least recently used slot */
+#endif
+		SD_TRACE(SD_TRACE_MOVE_WINDOW, sector, 1);
+		if (disk_read(fs->drv, fs->fc_buf[lru], sector, 1) != RES_OK) {
+			fs->fc_sect[lru] = 0xFFFFFFFF; fs->fc_used[lru] = 0;	/* Data is not reliable */
+			return 0;
+		}
+		fs->n_io++;
+		fs->fc_sect[lru] = sector;
+		fs->fc_used[lru] = ++fs->fc_tick;
+		fs->fc_cur = lru;
+		return fs->fc_buf[lru];
+	}
+	if (sector == fs->winsect) fs->fc_hit++; else fs->fc_miss++;
+#endif
+	return (move_window(fs, sector) == FR_OK) ? fs->win : 0;
+}
+
+
+
+
+#if _FS_CLNSHUT && !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* FAT32 clean shutdown bit (FAT[1] bit 27)                              */
+/*-----------------------------------------------------------------------*/
+/* Cleared before the first FAT change and set again only by f_syncvol, */
+/* so a volume left with the bit cleared has an FSInfo that can not be   */
+/* trusted. Periodic f_sync calls do not touch FAT[1] or FSInfo for it.  */
+
+static
+FRESULT set_clnshut (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* File system object */
+	BYTE clean		/* 1:Volume is consistent, 0:Volume is being modified */
+)
+{
+	BYTE *fat;
+	DWORD val;
+
+
+	if ((fat = fat_sector(fs, fs->fatbase)) == 0) return FR_DISK_ERR;
+	val = ld_dword(fat + 4);
+	st_dword(fat + 4, clean ? (val | 0x08000000) : (val & ~0x08000000));
+	FAT_DIRTY(fs);
+	fs->clnshut = clean ? 1 : 2;
+	/* Write it now, ahead of (clean=0) or behind (clean=1) the other FAT changes */
+#if _FS_FATCACHE
+	if (fs->fc_slots) return write_fatcache(fs, fs->fc_cur);
+#endif
+	return sync_window(fs);
+}
+#endif
+
+
+
+
 #if !_FS_READONLY
 /*-----------------------------------------------------------------------*/
 /* Synchronize file system and strage device                             */
@@ -948,7 +1166,12 @@ FRESULT sync_fs (	/* FR_OK:succeeded, !=0:error */
 	FRESULT res;
 
 
+#if _FS_FATCACHE
+	res = sync_fatcache(fs);
+	if (res == FR_OK) res = sync_window(fs);
+#else
 	res = sync_window(fs);
+#endif
 	if (res == FR_OK) {
 		/* Update FSInfo sector if needed */
 		if (fs->fs_type == FS_FAT32 && fs->fsi_flag == 1) {
@@ -961,8 +1184,11 @@ FRESULT sync_fs (	/* FR_OK:succeeded, !=0:error */
 			st_dword(fs->win + FSI_Nxt_Free, fs->last_clst);
 			/* Write it into the FSInfo sector */
 			fs->winsect = fs->volbase + 1;
-			disk_write(fs->drv, fs->win, fs->winsect, 1);
-			fs->fsi_flag = 0;
+			if (disk_write(fs->drv, fs->win, fs->winsect, 1) == RES_OK) {
+				fs->fsi_flag = 0;
+			} else {
+				res = FR_DISK_ERR;
+			}
 		}
 		/* Make sure that no pending write process in the physical drive */
 		if (disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK) res = FR_DISK_ERR;
@@ -1005,6 +1231,7 @@ DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFFF:Cluste
 {
 	UINT wc, bc;
 	DWORD val;
+	BYTE *fat;
 	FATFS *fs = obj->fs;
 
 
@@ -1017,21 +1244,21 @@ DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFFF:Cluste
 		switch (fs->fs_type) {
 		case FS_FAT12 :
 			bc = (UINT)clst; bc += bc / 2;
-			if (move_window(fs, fs->fatbase + (bc / SS(fs))) != FR_OK) break;
-			wc = fs->win[bc++ % SS(fs)];
-			if (move_window(fs, fs->fatbase + (bc / SS(fs))) != FR_OK) break;
-			wc |= fs->win[bc % SS(fs)] << 8;
+			if ((fat = fat_sector(fs, fs->fatbase + (bc / SS(fs)))) == 0) break;
+			wc = fat[bc++ % SS(fs)];
+			if ((fat = fat_sector(fs, fs->fatbase + (bc / SS(fs)))) == 0) break;
+			wc |= fat[bc % SS(fs)] << 8;
 			val = (clst & 1) ? (wc >> 4) : (wc & 0xFFF);
 			break;
 
 		case FS_FAT16 :
-			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 2))) != FR_OK) break;
-			val = ld_word(fs->win + clst * 2 % SS(fs));
+			if ((fat = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 2)))) == 0) break;
+			val = ld_word(fat + clst * 2 % SS(fs));
 			break;
 
 		case FS_FAT32 :
-			if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
-			val = ld_dword(fs->win + clst * 4 % SS(fs)) & 0x0FFFFFFF;
+			if ((fat = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 4)))) == 0) break;
+			val = ld_dword(fat + clst * 4 % SS(fs)) & 0x0FFFFFFF;
 			break;
 #if _FS_EXFAT
 		case FS_EXFAT :
@@ -1053,8 +1280,8 @@ DWORD get_fat (	/* 0xFFFFFFFF:Disk error, 1:Internal error, 2..0x7FFFFFFF:Cluste
 					if (obj->n_frag != 0) {	/* Is it on the growing edge? */
 						val = 0x7FFFFFFF;	/* Generate EOC */
 					} else {
-						if (move_window(fs, fs->fatbase + (clst / (SS(fs) / 4))) != FR_OK) break;
-						val = ld_dword(fs->win + clst * 4 % SS(fs)) & 0x7FFFFFFF;
+						if ((fat = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 4)))) == 0) break;
+						val = ld_dword(fat + clst * 4 % SS(fs)) & 0x7FFFFFFF;
 					}
 					break;
 				}
@@ -1085,45 +1312,57 @@ FRESULT put_fat (	/* FR_OK(0):succeeded, !=0:error */
 )
 {
 	UINT bc;
-	BYTE *p;
+	BYTE *p, *fat;
 	FRESULT res = FR_INT_ERR;
 
 	if (clst >= 2 && clst < fs->n_fatent) {	/* Check if in valid range */
+#if _FS_CLNSHUT
+		if (fs->clnshut == 1) {		/* First FAT change since the volume was clean? */
+			res = set_clnshut(fs, 0);
+			if (res != FR_OK) return res;
+			res = FR_INT_ERR;
+		}
+#endif
 		switch (fs->fs_type) {
 		case FS_FAT12 :	/* Bitfield items */
 			bc = (UINT)clst; bc += bc / 2;
-			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
-			if (res != FR_OK) break;
-			p = fs->win + bc++ % SS(fs);
+			res = FR_DISK_ERR;
+			if ((fat = fat_sector(fs, fs->fatbase + (bc / SS(fs)))) == 0) break;
+			p = fat + bc++ % SS(fs);
 			*p = (clst & 1) ? ((*p & 0x0F) | ((BYTE)val << 4)) : (BYTE)val;
-			fs->wflag = 1;
-			res = move_window(fs, fs->fatbase + (bc / SS(fs)));
-			if (res != FR_OK) break;
-			p = fs->win + bc % SS(fs);
+			FAT_DIRTY(fs);
+			if ((fat = fat_sector(fs, fs->fatbase + (bc / SS(fs)))) == 0) break;
+			p = fat + bc % SS(fs);
 			*p = (clst & 1) ? (BYTE)(val >> 4) : ((*p & 0xF0) | ((BYTE)(val >> 8) & 0x0F));
-			fs->wflag = 1;
+			FAT_DIRTY(fs);
+			res = FR_OK;
 			break;
 
 		case FS_FAT16 :	/* WORD aligned items */
-			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 2)));
-			if (res != FR_OK) break;
-			st_word(fs->win + clst * 2 % SS(fs), (WORD)val);
-			fs->wflag = 1;
+			res = FR_DISK_ERR;
+			if ((fat = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 2)))) == 0) break;
+			st_word(fat + clst * 2 % SS(fs), (WORD)val);
+			FAT_DIRTY(fs);
+			res = FR_OK;
 			break;
 
 		case FS_FAT32 :	/* DWORD aligned items */
 #if _FS_EXFAT
 		case FS_EXFAT :
 #endif
-			res = move_window(fs, fs->fatbase + (clst / (SS(fs) / 4)));
-			if (res != FR_OK) break;
+			res = FR_DISK_ERR;
+			if ((fat = fat_sector(fs, fs->fatbase + (clst / (SS(fs) / 4)))) == 0) break;
 			if (!_FS_EXFAT || fs->fs_type != FS_EXFAT) {
-				val = (val & 0x0FFFFFFF) | (ld_dword(fs->win + clst * 4 % SS(fs)) & 0xF0000000);
+				val = (val & 0x0FFFFFFF) | (ld_dword(fat + clst * 4 % SS(fs)) & 0xF0000000);
 			}
-			st_dword(fs->win + clst * 4 % SS(fs), val);
-			fs->wflag = 1;
+			st_dword(fat + clst * 4 % SS(fs), val);
+			FAT_DIRTY(fs);
+			res = FR_OK;
 			break;
 		}
+#if _FS_FATBITMAP
+		if (res == FR_OK && val == 0) FBM_CLR(fs, clst);	/* The group has a free cluster now */
+#endif
 	}
 	return res;
 }
@@ -1306,6 +1545,7 @@ FRESULT remove_chain (	/* FR_OK(0):succeeded, !=0:error */
 			fs->free_clst++;
 			fs->fsi_flag |= 1;
 		}
+		if (clst < fs->fsc_clst) fs->fsc_free++;	/* Freed behind the free cluster scan */
 #if _FS_EXFAT || _USE_TRIM
 		if (ecl + 1 == nxt) {	/* Is next cluster contiguous? */
 			ecl = nxt;
@@ -1354,6 +1594,9 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 )
 {
 	DWORD cs, ncl, scl;
+#if _FS_FATBITMAP
+	DWORD gcl = 0, gend = 0;
+#endif
 	FRESULT res;
 	FATFS *fs = obj->fs;
 
@@ -1404,9 +1647,25 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 				ncl = 2;
 				if (ncl > scl) return 0;	/* No free cluster */
 			}
+#if _FS_FATBITMAP
+			if (fs->fbm_on) {
+				gend = ncl | FBM_MASK(fs);		/* Last cluster of the group */
+				if (FBM_FULL(fs, ncl)) {		/* Skip the group without reading its FAT entries */
+					if (scl >= ncl && scl <= gend) return 0;	/* No free cluster */
+					ncl = gend;
+					continue;
+				}
+				if (ncl == 2 || (ncl & FBM_MASK(fs)) == 0) gcl = ncl;	/* Scanning from the top of the group */
+			}
+#endif
 			cs = get_fat(obj, ncl);			/* Get the cluster status */
 			if (cs == 0) break;				/* Found a free cluster */
 			if (cs == 1 || cs == 0xFFFFFFFF) return cs;	/* An error occurred */
+#if _FS_FATBITMAP
+			if (fs->fbm_on && (ncl == gend || ncl == fs->n_fatent - 1) && gcl && FBM_GRP(fs, gcl) == FBM_GRP(fs, ncl)) {
+				FBM_SET(fs, ncl);			/* Whole group scanned and in use */
+			}
+#endif
 			if (ncl == scl) return 0;		/* No free cluster */
 		}
 		res = put_fat(fs, ncl, 0xFFFFFFFF);	/* Mark the new cluster 'EOC' */
@@ -1418,6 +1677,7 @@ DWORD create_chain (	/* 0:No free cluster, 1:Internal error, 0xFFFFFFFF:Disk err
 	if (res == FR_OK) {			/* Update FSINFO if function succeeded. */
 		fs->last_clst = ncl;
 		if (fs->free_clst <= fs->n_fatent - 2) fs->free_clst--;
+		if (ncl < fs->fsc_clst) fs->fsc_free--;	/* Allocated behind the free cluster scan */
 		fs->fsi_flag |= 1;
 	} else {
 		ncl = (res == FR_DISK_ERR) ? 0xFFFFFFFF : 1;	/* Failed. Generate error status */
@@ -1457,6 +1717,90 @@ DWORD clmt_clust (	/* <2:Error, >=2:Cluster number */
 	return cl + *tbl;	/* Return the cluster number */
 }
 
+
+
+
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Create link map table of the file                      */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT create_clmt (	/* FR_OK, FR_NOT_ENOUGH_CORE:Table too small, FR_INT_ERR, FR_DISK_ERR */
+	FIL* fp			/* Pointer to the file object, cltbl[0] holds the table size */
+)
+{
+	DWORD cl, pcl, ncl, tcl, tlen, ulen, *tbl;
+	FATFS *fs = fp->obj.fs;
+
+
+	tbl = fp->cltbl;
+	tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
+	cl = fp->obj.sclust;		/* Origin of the chain */
+	if (cl) {
+		do {
+			/* Get a fragment */
+			tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
+			do {
+				pcl = cl; ncl++;
+				cl = get_fat(&fp->obj, cl);
+				if (cl <= 1) return FR_INT_ERR;
+				if (cl == 0xFFFFFFFF) return FR_DISK_ERR;
+			} while (cl == pcl + 1);
+			if (ulen <= tlen) {		/* Store the length and top of the fragment */
+				*tbl++ = ncl; *tbl++ = tcl;
+			}
+		} while (cl < fs->n_fatent);	/* Repeat until end of chain */
+	}
+	*fp->cltbl = ulen;	/* Number of items used */
+	if (ulen > tlen) return FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
+	*tbl = 0;		/* Terminate table */
+	return FR_OK;
+}
+
+
+
+#if _FS_AUTOCLMT
+/*-----------------------------------------------------------------------*/
+/* FAT handling - Give the file a link map table from the pool           */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT clmt_alloc (	/* FR_OK:Fast or normal seek mode, FR_INT_ERR, FR_DISK_ERR */
+	FIL* fp			/* Pointer to the file object */
+)
+{
+	UINT i, v;
+	CLMTOWN *own;
+	FRESULT res;
+
+
+	fp->clmt = 1;	/* Try once per open */
+	for (i = 0; i < _FS_AUTOCLMT; i++) {	/* Find a free table */
+		own = &ClmtOwner[i];
+		if (!own->fp) break;
+		for (v = 0; v < _VOLUMES && FatFs[v] != own->fs; v++) ;	/* The owner FIL may be gone, only its copied ID is checked */
+		if (v == _VOLUMES || !own->fs->fs_type || own->fs->id != own->id) break;	/* Its volume was unmounted or remounted */
+	}
+	if (i == _FS_AUTOCLMT) return FR_OK;	/* All tables in use, stay in normal seek mode */
+
+	own = &ClmtOwner[i];
+	own->fp = 0;
+	ClmtPool[i][0] = _FS_AUTOCLMT_SIZE;
+	fp->cltbl = ClmtPool[i];
+	res = create_clmt(fp);
+	if (res == FR_OK) {
+		own->fp = fp;
+		own->fs = fp->obj.fs;
+		own->id = fp->obj.fs->id;
+		own->sclust = fp->obj.sclust;
+	} else {
+		fp->cltbl = 0;		/* Too many fragments or error, stay in normal seek mode */
+		if (res == FR_NOT_ENOUGH_CORE) res = FR_OK;
+	}
+	return res;
+}
+#endif	/* _FS_AUTOCLMT */
+
 #endif	/* _USE_FASTSEEK */
 
 
@@ -1596,7 +1940,12 @@ FRESULT dir_alloc (	/* FR_OK(0):succeeded, !=0:error */
 	FATFS *fs = dp->obj.fs;
 
 
+#if _FS_DIRINDEX
+	/* Entries below the hole are in use, start at the one before it to stay inside the table */
+	res = dir_sdi(dp, (DI_HELD(fs, dp) && fs->di_hole) ? (DWORD)(fs->di_hole - 1) * SZDIRE : 0);
+#else
 	res = dir_sdi(dp, 0);
+#endif
 	if (res == FR_OK) {
 		n = 0;
 		do {
@@ -1801,7 +2150,7 @@ void gen_numname (
 
 	mem_cpy(dst, src, 11);
 
-	if (seq > 5) {	/* In case of many collisions, generate a hash number instead of sequential number */
+	if (seq > 1) {	/* After the first collision, generate a hash number instead of sequential number */
 		sr = seq;
 		while (*lfn) {	/* Create a CRC */
 			wc = *lfn++;
@@ -2203,12 +2552,13 @@ FRESULT dir_read (
 
 
 /*-----------------------------------------------------------------------*/
-/* Directory handling - Find an object in the directory                  */
+/* Directory handling - Compare the name with FAT12/16/32 entries        */
 /*-----------------------------------------------------------------------*/
 
 static
-FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
-	DIR* dp			/* Pointer to the directory object with the file name */
+FRESULT dir_scan (	/* FR_OK(0):found, FR_NO_FILE:not found, !=0:error */
+	DIR* dp,		/* Pointer to the directory object at the first entry to compare */
+	UINT nitem		/* Number of items to compare (0:up to the end of table) */
 )
 {
 	FRESULT res;
@@ -2218,6 +2568,274 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 	BYTE a, ord, sum;
 #endif
 
+#if _USE_LFN != 0
+	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+#endif
+	do {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) break;
+		c = dp->dir[DIR_Name];
+		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
+#if _USE_LFN != 0	/* LFN configuration */
+		dp->obj.attr = a = dp->dir[DIR_Attr] & AM_MASK;
+		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
+			ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+		} else {
+			if (a == AM_LFN) {			/* An LFN entry is found */
+				if (!(dp->fn[NSFLAG] & NS_NOLFN)) {
+					if (c & LLEF) {		/* Is it start of LFN sequence? */
+						sum = dp->dir[LDIR_Chksum];
+						c &= (BYTE)~LLEF; ord = c;	/* LFN start order */
+						dp->blk_ofs = dp->dptr;	/* Start offset of LFN */
+					}
+					/* Check validity of the LFN entry and compare it with given name */
+					ord = (c == ord && sum == dp->dir[LDIR_Chksum] && cmp_lfn(fs->lfnbuf, dp->dir)) ? ord - 1 : 0xFF;
+				}
+			} else {					/* An SFN entry is found */
+				if (!ord && sum == sum_sfn(dp->dir)) break;	/* LFN matched? */
+				if (!(dp->fn[NSFLAG] & NS_LOSS) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* SFN matched? */
+				ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
+				if (nitem && !--nitem) { res = FR_NO_FILE; break; }	/* Compared all items? */
+			}
+		}
+#else		/* Non LFN configuration */
+		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
+		if (!(dp->dir[DIR_Attr] & AM_VOL) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
+		if (nitem && !--nitem) { res = FR_NO_FILE; break; }	/* Compared all items? */
+#endif
+		res = dir_next(dp, 0);	/* Next entry */
+	} while (res == FR_OK);
+
+	return res;
+}
+
+
+
+
+#if _FS_DIRINDEX
+/*-----------------------------------------------------------------------*/
+/* Directory index - Name hashes                                         */
+/*-----------------------------------------------------------------------*/
+
+static
+DWORD di_lfn_sum (	/* Sum of the characters of an LFN part, fold it with di_fold() */
+	const WCHAR* lfn,	/* Pointer to the name characters (0:take them from the entry) */
+	const BYTE* dir,	/* Pointer to the LFN entry when lfn is 0 */
+	UINT pos			/* Position of the first character in the name */
+)
+{
+	DWORD sum = 0, x;
+	UINT s;
+	WCHAR wc;
+
+
+	for (s = 0; ; s++, pos++) {
+		if (lfn) {
+			wc = lfn[s];
+		} else {
+			if (s == 13) break;
+			wc = ld_word(dir + LfnOfs[s]);
+		}
+		if (wc == 0 || wc == 0xFFFF) break;
+		x = ((DWORD)ff_wtoupper(wc) | (DWORD)pos << 16) * 0x9E3779B1;	/* Mix character and position */
+		x ^= x >> 15;
+		x *= 0x85EBCA6B;
+		sum += x ^ (x >> 13);	/* A sum does not depend on the order the LFN entries are read */
+	}
+	return sum;
+}
+
+#define di_fold(sum)	((WORD)((sum) ^ (sum) >> 16))
+
+static
+WORD di_sfn_hash (
+	const BYTE* sfn		/* Pointer to the 11-byte SFN */
+)
+{
+	DWORD sum = 0;
+	UINT n;
+
+
+	for (n = 0; n < 11; n++) sum = sum * 31 + sfn[n];
+	return di_fold(sum);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory index - Build the index of the directory                    */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT di_build (	/* FR_OK:Built or too many items (di_valid = 0, di_over = the directory), !=0:error */
+	DIR* dp			/* Pointer to the directory object */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	BYTE c, a, ord, sum;
+	DWORD lsum, blk, hole;
+	UINT n;
+	WORD hs;
+
+
+	fs->di_valid = 0;
+	res = dir_sdi(dp, 0);
+	if (res != FR_OK) return res;
+	n = 0; ord = sum = 0xFF; lsum = blk = 0; hole = 0xFFFFFFFF;
+	do {
+		res = move_window(fs, dp->sect);
+		if (res != FR_OK) return res;
+		c = dp->dir[DIR_Name];
+		if (c == 0) break;		/* End of table, the rest is free */
+		a = dp->dir[DIR_Attr] & AM_MASK;
+		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* Deleted entry or volume label */
+			if (c == DDEM && hole == 0xFFFFFFFF) hole = dp->dptr / SZDIRE;
+			ord = 0xFF;
+		} else if (a == AM_LFN) {	/* Same sequence check as dir_scan() */
+			if (c & LLEF) {
+				sum = dp->dir[LDIR_Chksum];
+				c &= (BYTE)~LLEF; ord = c;
+				lsum = 0; blk = dp->dptr;
+			}
+			if (c == ord && sum == dp->dir[LDIR_Chksum] && ld_word(dp->dir + LDIR_FstClusLO) == 0) {
+				lsum += di_lfn_sum(0, dp->dir, ((c & 0x3F) - 1) * 13);
+				ord--;
+			} else {
+				ord = 0xFF;
+			}
+		} else {					/* SFN entry, the end of an item */
+			if (n == _FS_DIRINDEX) {	/* Too many items for the index: do not try it again */
+				fs->di_over = dp->obj.sclust;
+				return FR_OK;
+			}
+			hs = di_sfn_hash(dp->dir);
+			if (!ord && sum == sum_sfn(dp->dir)) {	/* Item with LFN */
+				fs->di_hash[n] = (DWORD)di_fold(lsum) << 16 | hs;
+				fs->di_ent[n] = (WORD)(blk / SZDIRE);
+			} else {
+				fs->di_hash[n] = (DWORD)hs << 16 | hs;
+				fs->di_ent[n] = (WORD)(dp->dptr / SZDIRE);
+			}
+			n++;
+			ord = 0xFF;
+		}
+		res = dir_next(dp, 0);
+	} while (res == FR_OK);
+	if (res != FR_OK && res != FR_NO_FILE) return res;
+
+	fs->di_sclust = dp->obj.sclust;
+	fs->di_cnt = n;
+	fs->di_hole = (hole != 0xFFFFFFFF) ? hole : (res == FR_NO_FILE) ? dp->dptr / SZDIRE + 1 : dp->dptr / SZDIRE;
+	fs->di_valid = 1;
+	return FR_OK;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory index - Find the name with the index                        */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT di_find (	/* FR_OK(0):found, FR_NO_FILE:not found, !=0:error */
+	DIR* dp			/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	BYTE ns = dp->fn[NSFLAG];
+	WORD hl, hs;
+	DWORD h;
+	UINT i;
+
+
+	hl = di_fold(di_lfn_sum(fs->lfnbuf, 0, 0));
+	hs = di_sfn_hash(dp->fn);
+	for (i = 0; i < fs->di_cnt; i++) {
+		h = fs->di_hash[i];
+		if ((!(ns & NS_NOLFN) && (WORD)(h >> 16) == hl) || (!(ns & NS_LOSS) && (WORD)h == hs)) {	/* Candidate */
+			res = dir_sdi(dp, (DWORD)fs->di_ent[i] * SZDIRE);
+			if (res == FR_OK) res = dir_scan(dp, 1);	/* Compare the item */
+			if (res != FR_NO_FILE) return res;
+		}
+	}
+	return FR_NO_FILE;
+}
+
+
+
+
+#if !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Directory index - Add or remove an item                               */
+/*-----------------------------------------------------------------------*/
+
+static
+void di_add (
+	DIR* dp,		/* Pointer to the directory object at the SFN entry of the new item */
+	UINT nent,		/* Number of entries of the item */
+	int lfn			/* The item has LFN entries with the name in lfnbuf */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	UINT ent = dp->dptr / SZDIRE - (nent - 1);
+	WORD hs = di_sfn_hash(dp->fn);
+
+
+	if (fs->di_cnt == _FS_DIRINDEX) {	/* Directory outgrows the index */
+		fs->di_valid = 0;
+		fs->di_over = fs->di_sclust;
+		return;
+	}
+	fs->di_hash[fs->di_cnt] = (DWORD)(lfn ? di_fold(di_lfn_sum(fs->lfnbuf, 0, 0)) : hs) << 16 | hs;
+	fs->di_ent[fs->di_cnt++] = (WORD)ent;
+	if (ent == fs->di_hole) fs->di_hole = ent + nent;	/* Allocated at the hole */
+}
+
+
+static
+void di_remove (
+	DIR* dp			/* Pointer to the directory object at the last entry of the removed item */
+)
+{
+	FATFS *fs = dp->obj.fs;
+	UINT top = ((dp->blk_ofs == 0xFFFFFFFF) ? dp->dptr : dp->blk_ofs) / SZDIRE;
+	UINT last = dp->dptr / SZDIRE;
+	UINT i;
+
+
+	for (i = 0; i < fs->di_cnt; i++) {
+		if (fs->di_ent[i] >= top && fs->di_ent[i] <= last) {	/* Item in the removed entries */
+			fs->di_cnt--;
+			fs->di_hash[i] = fs->di_hash[fs->di_cnt];	/* Fill the gap with the last item */
+			fs->di_ent[i] = fs->di_ent[fs->di_cnt];
+			break;
+		}
+	}
+	if (top < fs->di_hole) fs->di_hole = top;
+}
+#endif	/* !_FS_READONLY */
+
+#endif	/* _FS_DIRINDEX */
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Directory handling - Find an object in the directory                  */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
+	DIR* dp			/* Pointer to the directory object with the file name */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+
 	res = dir_sdi(dp, 0);			/* Rewind directory object */
 	if (res != FR_OK) return res;
 #if _FS_EXFAT
@@ -2235,51 +2853,99 @@ FRESULT dir_find (	/* FR_OK(0):succeeded, !=0:error */
 				if ((di % SZDIRE) == 0) di += 2;
 				if (ff_wtoupper(ld_word(fs->dirbuf + di)) != ff_wtoupper(fs->lfnbuf[ni])) break;
 			}
-			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
+			if (nc == 0 && !fs->lfnbuf[ni]) break;	/* Name matched? */
+		}
+		return res;
+	}
+#endif
+	/* On the FAT12/16/32 volume */
+#if _FS_DIRINDEX
+	if (fs->di_on) {
+		if (!DI_HELD(fs, dp) && fs->di_over != dp->obj.sclust && (dp->fn[NSFLAG] & NS_LAST)) {	/* Index the directory of the object */
+			res = di_build(dp);
+			if (res != FR_OK) return res;
+			if (!fs->di_valid) {	/* Too many items */
+				res = dir_sdi(dp, 0);
+				if (res != FR_OK) return res;
+			}
+		}
+		if (DI_HELD(fs, dp)) return di_find(dp);
+	}
+#endif
+	return dir_scan(dp, 0);
+}
+
+
+
+
+#if !_FS_READONLY && _USE_LFN != 0
+/*-----------------------------------------------------------------------*/
+/* FAT-LFN: Find a free numbered SFN                                     */
+/*-----------------------------------------------------------------------*/
+
+static
+FRESULT dir_numname (	/* FR_OK:dp->fn is a free numbered SFN, FR_DENIED:too many collisions, !=0:error */
+	DIR* dp,			/* Pointer to the directory object, dp->fn[NSFLAG] is NS_NOLFN */
+	const BYTE* sn		/* Pointer to the SFN made from the LFN */
+)
+{
+	FRESULT res;
+	FATFS *fs = dp->obj.fs;
+	BYTE cand[NUMNAME_BATCH][11], used, c;
+	UINT seq, n, k;
+#if _FS_DIRINDEX
+	WORD hs[NUMNAME_BATCH];
+	UINT i;
+#endif
+
+
+	for (seq = 1; seq < 100; seq += n) {	/* Check a batch of numbered names in one pass */
+		n = (100 - seq < NUMNAME_BATCH) ? 100 - seq : NUMNAME_BATCH;
+		for (k = 0; k < n; k++) gen_numname(cand[k], sn, fs->lfnbuf, seq + k);
+		used = 0;
+#if _FS_DIRINDEX
+		if (fs->di_on && DI_HELD(fs, dp)) {	/* A name whose hash is not in the index is free */
+			for (k = 0; k < n; k++) hs[k] = di_sfn_hash(cand[k]);
+			for (i = 0; i < fs->di_cnt; i++) {
+				for (k = 0; k < n; k++) {
+					if ((WORD)fs->di_hash[i] == hs[k]) used |= (BYTE)(1 << k);
+				}
+			}
+			for (k = 0; k < n; k++) {
+				mem_cpy(dp->fn, cand[k], 11);
+				if (!(used & (1 << k))) return FR_OK;
+				res = di_find(dp);			/* Hash matched, compare the entries */
+				if (res != FR_OK) return (res == FR_NO_FILE) ? FR_OK : res;
+			}
+			continue;
 		}
-		return res;
-	}
-#endif
-	/* On the FAT12/16/32 volume */
-#if _USE_LFN != 0
-	ord = sum = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 #endif
-	do {
-		res = move_window(fs, dp->sect);
-		if (res != FR_OK) break;
-		c = dp->dir[DIR_Name];
-		if (c == 0) { res = FR_NO_FILE; break; }	/* Reached to end of table */
-#if _USE_LFN != 0	/* LFN configuration */
-		dp->obj.attr = a = dp->dir[DIR_Attr] & AM_MASK;
-		if (c == DDEM || ((a & AM_VOL) && a != AM_LFN)) {	/* An entry without valid data */
-			ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
-		} else {
-			if (a == AM_LFN) {			/* An LFN entry is found */
-				if (!(dp->fn[NSFLAG] & NS_NOLFN)) {
-					if (c & LLEF) {		/* Is it start of LFN sequence? */
-						sum = dp->dir[LDIR_Chksum];
-						c &= (BYTE)~LLEF; ord = c;	/* LFN start order */
-						dp->blk_ofs = dp->dptr;	/* Start offset of LFN */
-					}
-					/* Check validity of the LFN entry and compare it with given name */
-					ord = (c == ord && sum == dp->dir[LDIR_Chksum] && cmp_lfn(fs->lfnbuf, dp->dir)) ? ord - 1 : 0xFF;
+		res = dir_sdi(dp, 0);
+		while (res == FR_OK) {
+			res = move_window(fs, dp->sect);
+			if (res != FR_OK) break;
+			c = dp->dir[DIR_Name];
+			if (c == 0) break;			/* End of table */
+			if (c != DDEM && !(dp->dir[DIR_Attr] & AM_VOL)) {	/* SFN entry (not deleted, LFN or label) */
+				for (k = 0; k < n; k++) {
+					if (!mem_cmp(dp->dir, cand[k], 11)) used |= (BYTE)(1 << k);
 				}
-			} else {					/* An SFN entry is found */
-				if (!ord && sum == sum_sfn(dp->dir)) break;	/* LFN matched? */
-				if (!(dp->fn[NSFLAG] & NS_LOSS) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* SFN matched? */
-				ord = 0xFF; dp->blk_ofs = 0xFFFFFFFF;	/* Reset LFN sequence */
 			}
+			res = dir_next(dp, 0);
 		}
-#else		/* Non LFN configuration */
-		dp->obj.attr = dp->dir[DIR_Attr] & AM_MASK;
-		if (!(dp->dir[DIR_Attr] & AM_VOL) && !mem_cmp(dp->dir, dp->fn, 11)) break;	/* Is it a valid entry? */
-#endif
-		res = dir_next(dp, 0);	/* Next entry */
-	} while (res == FR_OK);
-
-	return res;
+		if (res != FR_OK && res != FR_NO_FILE) return res;
+		for (k = 0; k < n; k++) {
+			if (!(used & (1 << k))) {	/* First name not in the directory */
+				mem_cpy(dp->fn, cand[k], 11);
+				return FR_OK;
+			}
+		}
+	}
+	return FR_DENIED;
 }
 
+#endif	/* !_FS_READONLY && _USE_LFN != 0 */
+
 
 
 
@@ -2296,7 +2962,7 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 	FRESULT res;
 	FATFS *fs = dp->obj.fs;
 #if _USE_LFN != 0	/* LFN configuration */
-	UINT n, nlen, nent;
+	UINT nlen, nent;
 	BYTE sn[12], sum;
 
 
@@ -2335,13 +3001,8 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 	mem_cpy(sn, dp->fn, 12);
 	if (sn[NSFLAG] & NS_LOSS) {			/* When LFN is out of 8.3 format, generate a numbered name */
 		dp->fn[NSFLAG] = NS_NOLFN;		/* Find only SFN */
-		for (n = 1; n < 100; n++) {
-			gen_numname(dp->fn, sn, fs->lfnbuf, n);	/* Generate a numbered name */
-			res = dir_find(dp);				/* Check if the name collides with existing SFN */
-			if (res != FR_OK) break;
-		}
-		if (n == 100) return FR_DENIED;		/* Abort if too many collisions */
-		if (res != FR_NO_FILE) return res;	/* Abort if the result is other than 'not collided' */
+		res = dir_numname(dp, sn);		/* Numbered name that does not collide with existing SFN */
+		if (res != FR_OK) return res;
 		dp->fn[NSFLAG] = sn[NSFLAG];
 	}
 
@@ -2377,6 +3038,11 @@ FRESULT dir_register (	/* FR_OK:succeeded, FR_DENIED:no free entry or too many S
 			dp->dir[DIR_NTres] = dp->fn[NSFLAG] & (NS_BODY | NS_EXT);	/* Put NT flag */
 #endif
 			fs->wflag = 1;
+#if _FS_DIRINDEX
+			if (DI_HELD(fs, dp)) {
+				di_add(dp, (sn[NSFLAG] & NS_LFN) ? (nlen + 12) / 13 + 1 : 1, sn[NSFLAG] & NS_LFN);
+			}
+#endif
 		}
 	}
 
@@ -2419,6 +3085,9 @@ FRESULT dir_remove (	/* FR_OK:Succeeded, FR_DISK_ERR:A disk error */
 		} while (res == FR_OK);
 		if (res == FR_NO_FILE) res = FR_INT_ERR;
 	}
+#if _FS_DIRINDEX
+	if (res == FR_OK && DI_HELD(fs, dp)) di_remove(dp);
+#endif
 #else			/* Non LFN configuration */
 
 	res = move_window(fs, dp->sect);
@@ -3032,6 +3701,17 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 	/* Following code attempts to mount the volume. (analyze BPB and initialize the fs object) */
 
 	fs->fs_type = 0;					/* Clear the file system object */
+#if !_FS_READONLY
+	fs->fsc_clst = 0;					/* Free cluster scan is not started */
+#if _FS_CLNSHUT
+	fs->clnshut = 0;
+#endif
+#endif
+#if _FS_FATCACHE
+	clear_fatcache(fs);					/* Discard FAT sectors of the previous volume */
+	fs->fc_slots = _FS_FATCACHE_SLOTS;
+	fs->fc_hit = fs->fc_miss = fs->n_io = 0;
+#endif
 	fs->drv = LD2PD(vol);				/* Bind the logical drive and a physical drive */
 	stat = disk_initialize(fs->drv);	/* Initialize the physical drive */
 	if (stat & STA_NOINIT) { 			/* Check if the initialization succeeded */
@@ -3185,11 +3865,36 @@ FRESULT find_volume (	/* FR_OK(0): successful, !=0: any error occurred */
 			}
 		}
 #endif	/* (_FS_NOFSINFO & 3) != 3 */
+		if (fs->free_clst > fs->n_fatent - 2) fs->free_clst = 0xFFFFFFFF;	/* Validate FSInfo values */
+		if (fs->last_clst < 2 || fs->last_clst >= fs->n_fatent) fs->last_clst = 0xFFFFFFFF;
+#if _FS_CLNSHUT
+		if (fmt == FS_FAT32) {	/* Trust the free count only if the volume was left clean */
+			BYTE *fat = fat_sector(fs, fs->fatbase);
+
+			if (fat == 0) return FR_DISK_ERR;
+			if (ld_dword(fat + 4) & 0x08000000) {
+				fs->clnshut = 1;
+			} else {
+				fs->clnshut = 2;				/* Already cleared on the disk */
+				fs->free_clst = 0xFFFFFFFF;
+			}
+		}
+#endif
 #endif	/* !_FS_READONLY */
 	}
 
 	fs->fs_type = fmt;		/* FAT sub-type */
 	fs->id = ++Fsid;		/* File system mount ID */
+#if _FS_FATBITMAP
+	mem_set(fs->fbm, 0, _FS_FATBITMAP);	/* Nothing is known to be full until the FAT is scanned */
+	for (fs->fbm_shift = 0; ((fs->n_fatent - 1) >> fs->fbm_shift) >= _FS_FATBITMAP * 8; fs->fbm_shift++) ;
+	fs->fbm_on = (fmt != FS_EXFAT);		/* exFAT has its own allocation bitmap */
+#endif
+#if _FS_DIRINDEX
+	fs->di_on = 1;
+	fs->di_valid = 0;
+	fs->di_over = 0xFFFFFFFF;
+#endif
 #if _USE_LFN == 1
 	fs->lfnbuf = LfnBuf;	/* Static LFN working buffer */
 #if _FS_EXFAT
@@ -3458,6 +4163,9 @@ FRESULT f_open (
 			}
 #if _USE_FASTSEEK
 			fp->cltbl = 0;			/* Disable fast seek mode */
+#if _FS_AUTOCLMT
+			fp->clmt = 0;
+#endif
 #endif
 			fp->obj.fs = fs;	 	/* Validate the file object */
 			fp->obj.id = fs->id;
@@ -3527,6 +4235,7 @@ FRESULT f_read (
 	res = validate(&fp->obj, &fs);				/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_READ)) LEAVE_FF(fs, FR_DENIED); /* Check access mode */
+	SD_TRACE(SD_TRACE_F_READ, fp->fptr, btr);
 	remain = fp->obj.objsize - fp->fptr;
 	if (btr > remain) btr = (UINT)remain;		/* Truncate btr by remaining bytes */
 
@@ -3597,6 +4306,7 @@ FRESULT f_read (
 #endif
 	}
 
+	SD_TRACE(SD_TRACE_F_READ_END, *br, 0);
 	LEAVE_FF(fs, FR_OK);
 }
 
@@ -3626,6 +4336,7 @@ FRESULT f_write (
 	res = validate(&fp->obj, &fs);			/* Check validity of the file object */
 	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);	/* Check validity */
 	if (!(fp->flag & FA_WRITE)) LEAVE_FF(fs, FR_DENIED);	/* Check access mode */
+	SD_TRACE(SD_TRACE_F_WRITE, fp->fptr, btw);
 
 	/* Check fptr wrap-around (file size cannot reach 4GiB on FATxx) */
 	if ((!_FS_EXFAT || fs->fs_type != FS_EXFAT) && (DWORD)(fp->fptr + btw) < (DWORD)fp->fptr) {
@@ -3719,6 +4430,7 @@ FRESULT f_write (
 
 	fp->flag |= FA_MODIFIED;				/* Set file change flag */
 
+	SD_TRACE(SD_TRACE_F_WRITE_END, *bw, 0);
 	LEAVE_FF(fs, FR_OK);
 }
 
@@ -3816,6 +4528,9 @@ FRESULT f_close (
 {
 	FRESULT res;
 	FATFS *fs;
+#if _FS_AUTOCLMT
+	UINT i;
+#endif
 
 #if !_FS_READONLY
 	res = f_sync(fp);					/* Flush cached data */
@@ -3829,6 +4544,12 @@ FRESULT f_close (
 			if (res == FR_OK)
 #endif
 			{
+#if _FS_AUTOCLMT
+				for (i = 0; i < _FS_AUTOCLMT; i++) {	/* Release the automatic link map */
+					if (ClmtOwner[i].fp == fp && fp->cltbl == ClmtPool[i]
+						&& ClmtOwner[i].fs == fs && ClmtOwner[i].sclust == fp->obj.sclust) ClmtOwner[i].fp = 0;
+				}
+#endif
 				fp->obj.fs = 0;			/* Invalidate file object */
 			}
 #if _FS_REENTRANT
@@ -4008,7 +4729,7 @@ FRESULT f_lseek (
 	DWORD clst, bcs, nsect;
 	FSIZE_t ifptr;
 #if _USE_FASTSEEK
-	DWORD cl, pcl, ncl, tcl, dsc, tlen, ulen, *tbl;
+	DWORD dsc;
 #endif
 
 	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
@@ -4020,33 +4741,19 @@ FRESULT f_lseek (
 #endif
 	if (res != FR_OK) LEAVE_FF(fs, res);
 
+#if _FS_AUTOCLMT
+	if (!fp->cltbl && !fp->clmt && !(fp->flag & FA_WRITE) && ofs != CREATE_LINKMAP
+		&& ofs > (FSIZE_t)fs->csize * SS(fs)) {	/* First seek past the top cluster of a read-only file */
+		res = clmt_alloc(fp);
+		if (res != FR_OK) ABORT(fs, res);
+	}
+#endif
+
 #if _USE_FASTSEEK
 	if (fp->cltbl) {	/* Fast seek */
 		if (ofs == CREATE_LINKMAP) {	/* Create CLMT */
-			tbl = fp->cltbl;
-			tlen = *tbl++; ulen = 2;	/* Given table size and required table size */
-			cl = fp->obj.sclust;		/* Origin of the chain */
-			if (cl) {
-				do {
-					/* Get a fragment */
-					tcl = cl; ncl = 0; ulen += 2;	/* Top, length and used items */
-					do {
-						pcl = cl; ncl++;
-						cl = get_fat(&fp->obj, cl);
-						if (cl <= 1) ABORT(fs, FR_INT_ERR);
-						if (cl == 0xFFFFFFFF) ABORT(fs, FR_DISK_ERR);
-					} while (cl == pcl + 1);
-					if (ulen <= tlen) {		/* Store the length and top of the fragment */
-						*tbl++ = ncl; *tbl++ = tcl;
-					}
-				} while (cl < fs->n_fatent);	/* Repeat until end of chain */
-			}
-			*fp->cltbl = ulen;	/* Number of items used */
-			if (ulen <= tlen) {
-				*tbl = 0;		/* Terminate table */
-			} else {
-				res = FR_NOT_ENOUGH_CORE;	/* Given table size is smaller than required */
-			}
+			res = create_clmt(fp);
+			if (res == FR_INT_ERR || res == FR_DISK_ERR) ABORT(fs, res);
 		} else {						/* Fast seek */
 			if (ofs > fp->obj.objsize) ofs = fp->obj.objsize;	/* Clip offset at the file size */
 			fp->fptr = ofs;				/* Set file pointer */
@@ -4381,6 +5088,113 @@ FRESULT f_stat (
 
 
 #if !_FS_READONLY
+/*-----------------------------------------------------------------------*/
+/* Count Free Clusters (resumable FAT / allocation bitmap scan)          */
+/*-----------------------------------------------------------------------*/
+/* The scan runs once per mount from fs->fsc_clst. Allocations below the */
+/* cursor adjust fs->fsc_free, so the count is exact when it completes.  */
+
+static
+FRESULT scan_free (	/* FR_OK(0):succeeded, !=0:error */
+	FATFS* fs,		/* File system object */
+	UINT nsect		/* Number of FAT (exFAT: bitmap) sectors to scan at least */
+)
+{
+	FRESULT res = FR_OK;
+	DWORD clst, sect, stat, nfree;
+	UINT i, n;
+	BYTE *p;
+	_FDID obj;
+#if _FS_FATBITMAP
+	BYTE gfree = 0;		/* A free cluster is seen in the current group */
+#endif
+
+
+	if (fs->fsc_clst == 1) return FR_OK;	/* Scan is complete */
+	if (fs->fsc_clst < 2) {					/* Start a new scan */
+		fs->fsc_clst = 2; fs->fsc_free = 0;
+	}
+	clst = fs->fsc_clst; nfree = fs->fsc_free; n = 0;
+
+	if (fs->fs_type == FS_FAT12) {	/* FAT12: Sector unalighed FAT entries (small volume, one pass) */
+		obj.fs = fs;
+		do {
+			stat = get_fat(&obj, clst);
+			if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
+			if (stat == 1) { res = FR_INT_ERR; break; }
+			if (stat == 0) nfree++;
+#if _FS_FATBITMAP
+			if (stat == 0) gfree = 1;
+			if ((clst & FBM_MASK(fs)) == FBM_MASK(fs) || clst == fs->n_fatent - 1) {	/* End of a group */
+				if (gfree) FBM_CLR(fs, clst); else FBM_SET(fs, clst);
+				gfree = 0;
+			}
+#endif
+		} while (++clst < fs->n_fatent);
+	} else {
+#if _FS_EXFAT
+		if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan bitmap table */
+			BYTE bm;
+			UINT b;
+
+			sect = fs->database + (clst - 2) / 8 / SS(fs);
+			i = (clst - 2) / 8 % SS(fs);
+			do {
+				if ((res = move_window(fs, sect)) != FR_OK) break;	/* The bitmap is in the data area */
+				for ( ; i < SS(fs) && clst < fs->n_fatent; i++) {
+					for (b = 8, bm = fs->win[i]; b && clst < fs->n_fatent; b--, clst++) {
+						if (!(bm & 1)) nfree++;
+						bm >>= 1;
+					}
+				}
+				sect++; i = 0;
+			} while (clst < fs->n_fatent && ++n < nsect);
+		} else
+#endif
+		{	/* FAT16/32: Sector alighed FAT entries */
+			UINT eps = SS(fs) / (fs->fs_type == FS_FAT16 ? 2 : 4);	/* Entries per sector */
+
+			sect = fs->fatbase + clst / eps;
+			for (;;) {
+				if ((p = fat_sector(fs, sect++)) == 0) { res = FR_DISK_ERR; break; }
+				for (i = clst % eps; i < eps && clst < fs->n_fatent; i++, clst++) {
+					stat = (fs->fs_type == FS_FAT16) ? ld_word(p + i * 2) : ld_dword(p + i * 4) & 0x0FFFFFFF;
+					if (stat == 0) nfree++;
+#if _FS_FATBITMAP
+					if (stat == 0) gfree = 1;
+					if ((clst & FBM_MASK(fs)) == FBM_MASK(fs) || clst == fs->n_fatent - 1) {	/* End of a group */
+						if (gfree) FBM_CLR(fs, clst); else FBM_SET(fs, clst);
+						gfree = 0;
+					}
+#endif
+				}
+				if (clst >= fs->n_fatent) break;
+#if _FS_FATBITMAP
+				if (++n >= nsect && (clst & FBM_MASK(fs)) == 0) break;	/* Stop on a group boundary */
+#else
+				if (++n >= nsect) break;
+#endif
+			}
+		}
+	}
+
+	if (res == FR_OK) {
+		fs->fsc_free = nfree;
+		fs->fsc_clst = clst;
+		if (clst >= fs->n_fatent) {		/* Scan is complete */
+			if (fs->free_clst != nfree) {
+				fs->free_clst = nfree;	/* Now free_clst is valid */
+				fs->fsi_flag |= 1;		/* FSInfo is to be updated */
+			}
+			fs->fsc_clst = 1;
+		}
+	}
+	return res;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Get Number of Free Clusters                                           */
 /*-----------------------------------------------------------------------*/
@@ -4393,10 +5207,6 @@ FRESULT f_getfree (
 {
 	FRESULT res;
 	FATFS *fs;
-	DWORD nfree, clst, sect, stat;
-	UINT i;
-	BYTE *p;
-	_FDID obj;
 
 
 	/* Get logical drive */
@@ -4404,62 +5214,174 @@ FRESULT f_getfree (
 	if (res == FR_OK) {
 		*fatfs = fs;				/* Return ptr to the fs object */
 		/* If free_clst is valid, return it without full cluster scan */
-		if (fs->free_clst <= fs->n_fatent - 2) {
-			*nclst = fs->free_clst;
-		} else {
-			/* Get number of free clusters */
-			nfree = 0;
-			if (fs->fs_type == FS_FAT12) {	/* FAT12: Sector unalighed FAT entries */
-				clst = 2; obj.fs = fs;
-				do {
-					stat = get_fat(&obj, clst);
-					if (stat == 0xFFFFFFFF) { res = FR_DISK_ERR; break; }
-					if (stat == 1) { res = FR_INT_ERR; break; }
-					if (stat == 0) nfree++;
-				} while (++clst < fs->n_fatent);
-			} else {
-#if _FS_EXFAT
-				if (fs->fs_type == FS_EXFAT) {	/* exFAT: Scan bitmap table */
-					BYTE bm;
-					UINT b;
+		if (fs->free_clst > fs->n_fatent - 2) {
+			if (fs->fsc_clst == 1) fs->fsc_clst = 0;	/* Count was dropped: scan again */
+			res = scan_free(fs, 0xFFFFFFFF);	/* Scan the rest of the FAT */
+		}
+		*nclst = fs->free_clst;
+	}
 
-					clst = fs->n_fatent - 2;
-					sect = fs->database;
-					i = 0;
-					do {
-						if (i == 0 && (res = move_window(fs, sect++)) != FR_OK) break;
-						for (b = 8, bm = fs->win[i]; b && clst; b--, clst--) {
-							if (!(bm & 1)) nfree++;
-							bm >>= 1;
-						}
-						i = (i + 1) % SS(fs);
-					} while (clst);
-				} else
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Count Free Clusters in Steps                                          */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_scanfree (
+	const TCHAR* path,	/* Path name of the logical drive number */
+	UINT nsect,			/* Number of FAT sectors to scan in this call */
+	DWORD* nclst		/* Number of free clusters, 0xFFFFFFFF while it is not known yet */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = find_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+		if (fs->free_clst > fs->n_fatent - 2) {	/* Scan only while free_clst is not valid */
+			if (fs->fsc_clst == 1) fs->fsc_clst = 0;	/* Count was dropped: scan again */
+			res = scan_free(fs, nsect);
+		}
+		*nclst = (fs->free_clst <= fs->n_fatent - 2) ? fs->free_clst : 0xFFFFFFFF;
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Synchronize the Volume and Mark it Clean                              */
+/*-----------------------------------------------------------------------*/
+/* Call before unmounting or at a point the volume is meant to be left   */
+/* consistent. With _FS_CLNSHUT, FSInfo is rewritten and the clean bit   */
+/* set behind it, so the next mount trusts the free cluster count.       */
+
+FRESULT f_syncvol (
+	const TCHAR* path	/* Path name of the logical drive number */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = find_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+#if _FS_CLNSHUT
+		if (fs->clnshut == 2) {		/* Modified since the mount or the last f_syncvol */
+			if (fs->fsi_flag == 0) fs->fsi_flag = 1;	/* The clean bit vouches for FSInfo: rewrite it first */
+			res = sync_fs(fs);
+			if (res == FR_OK) res = set_clnshut(fs, 1);	/* FAT and FSInfo are on the disk: mark the volume clean */
+			if (res == FR_OK && disk_ioctl(fs->drv, CTRL_SYNC, 0) != RES_OK) res = FR_DISK_ERR;
+		} else
 #endif
-				{	/* FAT16/32: Sector alighed FAT entries */
-					clst = fs->n_fatent; sect = fs->fatbase;
-					i = 0; p = 0;
-					do {
-						if (i == 0) {
-							res = move_window(fs, sect++);
-							if (res != FR_OK) break;
-							p = fs->win;
-							i = SS(fs);
-						}
-						if (fs->fs_type == FS_FAT16) {
-							if (ld_word(p) == 0) nfree++;
-							p += 2; i -= 2;
-						} else {
-							if ((ld_dword(p) & 0x0FFFFFFF) == 0) nfree++;
-							p += 4; i -= 4;
-						}
-					} while (--clst);
-				}
-			}
-			*nclst = nfree;			/* Return the free clusters */
-			fs->free_clst = nfree;	/* Now free_clst is valid */
-			fs->fsi_flag |= 1;		/* FSInfo is to be updated */
+		{
+			res = sync_fs(fs);
+		}
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Get File System Statistics                                            */
+/*-----------------------------------------------------------------------*/
+
+FRESULT f_getstats (
+	const TCHAR* path,	/* Path name of the logical drive number */
+	FSSTATS* st			/* Pointer to the statistics structure to fill */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = find_volume(&path, &fs, 0);
+	if (res == FR_OK) {
+		st->fs_type = fs->fs_type;
+		st->csize = fs->csize;
+		st->n_clst = fs->n_fatent - 2;
+		st->free_clst = (fs->free_clst <= fs->n_fatent - 2) ? fs->free_clst : 0xFFFFFFFF;
+#if _FS_FATCACHE
+		st->n_io = fs->n_io;
+		st->fc_hit = fs->fc_hit;
+		st->fc_miss = fs->fc_miss;
+#else
+		st->n_io = st->fc_hit = st->fc_miss = 0;
+#endif
+	}
+
+	LEAVE_FF(fs, res);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Set a Run-time Option of the Volume                                   */
+/*-----------------------------------------------------------------------*/
+/* For comparing the extensions of this FatFs with the original code and */
+/* for simulating a power loss. The options last until the next mount.   */
+
+FRESULT f_setopt (
+	const TCHAR* path,	/* Path name of the logical drive number */
+	BYTE opt,			/* Option to set (FO_*) */
+	DWORD val			/* Value of the option */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = find_volume(&path, &fs, 0);
+	if (res != FR_OK) LEAVE_FF(fs, res);
+
+	switch (opt) {
+#if _FS_FATCACHE
+	case FO_FATCACHE :	/* Write back and empty the cache, then resize it */
+		if (val > _FS_FATCACHE_SLOTS) { res = FR_INVALID_PARAMETER; break; }
+		res = sync_window(fs);
+		if (res == FR_OK) res = sync_fatcache(fs);
+		if (res == FR_OK) {
+			clear_fatcache(fs);
+			if (fs->fc_slots != (UINT)val) fs->winsect = 0xFFFFFFFF;	/* The cache may have changed FAT sectors behind win[] */
+			fs->fc_slots = (UINT)val;
 		}
+		break;
+#endif
+#if _FS_FATBITMAP
+	case FO_FATBITMAP :
+		fs->fbm_on = (val && fs->fs_type != FS_EXFAT) ? 1 : 0;	/* exFAT has its own allocation bitmap */
+		break;
+#endif
+#if _FS_DIRINDEX
+	case FO_DIRINDEX :
+		fs->di_on = val ? 1 : 0;
+		fs->di_valid = 0;
+		fs->di_over = 0xFFFFFFFF;
+		break;
+#endif
+	case FO_FREECNT :	/* As if the count was not trusted at mount */
+		fs->free_clst = 0xFFFFFFFF;
+		if (fs->fsc_clst == 1) fs->fsc_clst = 0;
+		break;
+
+	case FO_LASTCLST :
+		if (val < 2 || val >= fs->n_fatent) { res = FR_INVALID_PARAMETER; break; }
+		fs->last_clst = val;
+		break;
+
+	default :
+		res = FR_INVALID_PARAMETER;
 	}
 
 	LEAVE_FF(fs, res);
@@ -4594,6 +5516,12 @@ FRESULT f_unlink (
 			}
 			if (res == FR_OK) {
 				res = dir_remove(&dj);			/* Remove the directory entry */
+#if _FS_DIRINDEX
+				if (dj.obj.attr & AM_DIR) {
+					if (fs->di_sclust == dclst) fs->di_valid = 0;	/* The indexed directory is removed */
+					if (fs->di_over == dclst) fs->di_over = 0xFFFFFFFF;	/* Its cluster may start a new directory */
+				}
+#endif
 				if (res == FR_OK && dclst) {	/* Remove the cluster chain if exist */
 #if _FS_EXFAT
 					res = remove_chain(&obj, dclst, 0);
@@ -5177,6 +6105,16 @@ FRESULT f_expand (
 	{
 		scl = clst = stcl; ncl = 0;
 		for (;;) {	/* Find a contiguous cluster block */
+#if _FS_FATBITMAP
+			if (fs->fbm_on && FBM_FULL(fs, clst)) {	/* Skip the group without reading its FAT entries */
+				n = clst | FBM_MASK(fs);		/* Last cluster of the group */
+				if (stcl > clst && stcl <= n) { res = FR_DENIED; break; }	/* No contiguous cluster? */
+				clst = (n + 1 >= fs->n_fatent) ? 2 : n + 1;
+				scl = clst; ncl = 0;
+				if (clst == stcl) { res = FR_DENIED; break; }
+				continue;
+			}
+#endif
 			n = get_fat(&fp->obj, clst);
 			if (++clst >= fs->n_fatent) clst = 2;
 			if (n == 1) { res = FR_INT_ERR; break; }
@@ -5212,12 +6150,41 @@ FRESULT f_expand (
 				fs->free_clst -= tcl;
 				fs->fsi_flag |= 1;
 			}
+			if (scl < fs->fsc_clst) {	/* Allocated behind the free cluster scan */
+				fs->fsc_free -= (fs->fsc_clst - scl < tcl) ? fs->fsc_clst - scl : tcl;
+			}
 		}
 	}
 
 	LEAVE_FF(fs, res);
 }
 
+
+
+/*-----------------------------------------------------------------------*/
+/* Set File Size of a Preallocated File                                  */
+/*-----------------------------------------------------------------------*/
+/* For data written to the clusters of f_expand() around FatFs. The new  */
+/* size goes to the directory entry at the next f_sync() or f_close().   */
+
+FRESULT f_setsize (
+	FIL* fp,		/* Pointer to the file object */
+	FSIZE_t fsz		/* New file size, must be within the clusters allocated to the file */
+)
+{
+	FRESULT res;
+	FATFS *fs;
+
+
+	res = validate(&fp->obj, &fs);		/* Check validity of the file object */
+	if (res != FR_OK || (res = (FRESULT)fp->err) != FR_OK) LEAVE_FF(fs, res);
+	if (!(fp->flag & FA_WRITE) || (fsz != 0 && fp->obj.sclust == 0) || fp->fptr > fsz) LEAVE_FF(fs, FR_DENIED);
+	fp->obj.objsize = fsz;
+	fp->flag |= FA_MODIFIED;
+
+	LEAVE_FF(fs, FR_OK);
+}
+
 #endif /* _USE_EXPAND && !_FS_READONLY */
 
 
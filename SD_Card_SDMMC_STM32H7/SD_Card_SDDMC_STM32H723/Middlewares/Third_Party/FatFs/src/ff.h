@@ -80,6 +80,14 @@ typedef DWORD FSIZE_t;
 
 
 
+/* Number of FAT sector cache slots */
+
+#if _FS_FATCACHE
+#define _FS_FATCACHE_SLOTS	(_FS_FATCACHE / _MAX_SS)
+#endif
+
+
+
 /* File system object structure (FATFS) */
 
 typedef struct {
@@ -106,6 +114,26 @@ typedef struct {
 #if !_FS_READONLY
 	DWORD	last_clst;		/* Last allocated cluster */
 	DWORD	free_clst;		/* Number of free clusters */
+	DWORD	fsc_clst;		/* Free cluster scan cursor (0:not started, 1:complete) */
+	DWORD	fsc_free;		/* Free clusters found below fsc_clst */
+#if _FS_CLNSHUT
+	BYTE	clnshut;		/* FAT32 clean shutdown bit (0:not used, 1:clean, 2:cleared on the disk) */
+#endif
+#endif
+#if _FS_FATBITMAP
+	BYTE	fbm_on;			/* Free cluster bitmap in use (0:scan the FAT as in the original FatFs) */
+	BYTE	fbm_shift;		/* Clusters per bitmap group (1 << fbm_shift) */
+	BYTE	fbm[_FS_FATBITMAP];	/* 1 bit per cluster group, 1:every cluster in use, 0:unknown or has free */
+#endif
+#if _FS_DIRINDEX
+	BYTE	di_on;			/* Directory index in use (0:linear search as in the original FatFs) */
+	BYTE	di_valid;		/* Index holds the directory di_sclust */
+	DWORD	di_sclust;		/* Indexed directory start cluster (0:root) */
+	DWORD	di_over;		/* Start cluster of the last directory too large for the index (0xFFFFFFFF:none) */
+	UINT	di_cnt;			/* Items in the index */
+	UINT	di_hole;		/* Lowest entry that may be free (entries below are in use) */
+	DWORD	di_hash[_FS_DIRINDEX];	/* b31-16:LFN hash, b15-0:SFN hash of each item */
+	WORD	di_ent[_FS_DIRINDEX];	/* First directory entry of each item */
 #endif
 #if _FS_RPATH != 0
 	DWORD	cdir;			/* Current directory start cluster (0:root) */
@@ -122,7 +150,21 @@ typedef struct {
 	DWORD	dirbase;		/* Root directory base sector/cluster */
 	DWORD	database;		/* Data base sector */
 	DWORD	winsect;		/* Current sector appearing in the win[] */
+#if _FS_FATCACHE
+	UINT	fc_slots;		/* Number of FAT cache slots in use (0:FAT goes through win[]) */
+	UINT	fc_cur;			/* Slot returned by the last FAT sector lookup */
+	DWORD	fc_tick;		/* LRU clock */
+	DWORD	fc_hit;			/* FAT sector lookups served without disk read */
+	DWORD	fc_miss;		/* FAT sector lookups that needed a disk read */
+	DWORD	n_io;			/* Sector reads/writes issued for win[] and the FAT cache */
+	DWORD	fc_sect[_FS_FATCACHE_SLOTS];	/* Sector held in each slot (0xFFFFFFFF:empty) */
+	DWORD	fc_used[_FS_FATCACHE_SLOTS];	/* LRU stamp of each slot (0:empty) */
+	BYTE	fc_buf[_FS_FATCACHE_SLOTS][_MAX_SS];	/* FAT sector buffers */
+#endif
 	BYTE	win[_MAX_SS];	/* Disk access window for Directory, FAT (and file data at tiny cfg) */
+#if _FS_FATCACHE
+	BYTE	fc_dirty[_FS_FATCACHE_SLOTS];	/* Slot has changed since it was loaded */
+#endif
 } FATFS;
 
 
@@ -165,6 +207,9 @@ typedef struct {
 #endif
 #if _USE_FASTSEEK
 	DWORD*	cltbl;			/* Pointer to the cluster link map table (nulled on open, set by application) */
+#if _FS_AUTOCLMT
+	BYTE	clmt;			/* Automatic link map tried since open (0:No, 1:Yes) */
+#endif
 #endif
 #if !_FS_TINY
 	BYTE	buf[_MAX_SS];	/* File private data read/write window */
@@ -209,6 +254,20 @@ typedef struct {
 
 
 
+/* File system statistics structure (FSSTATS) */
+
+typedef struct {
+	BYTE	fs_type;		/* Filesystem type (FS_FAT12..FS_EXFAT) */
+	WORD	csize;			/* Cluster size [sectors] */
+	DWORD	n_clst;			/* Number of clusters */
+	DWORD	free_clst;		/* Number of free clusters (0xFFFFFFFF:not known) */
+	DWORD	n_io;			/* Sector reads/writes for win[] and the FAT cache since mount */
+	DWORD	fc_hit;			/* FAT sector lookups served without disk read */
+	DWORD	fc_miss;		/* FAT sector lookups that needed a disk read */
+} FSSTATS;
+
+
+
 /* File function return code (FRESULT) */
 
 typedef enum {
@@ -261,10 +320,15 @@ FRESULT f_chdir (const TCHAR* path);								/* Change current directory */
 FRESULT f_chdrive (const TCHAR* path);								/* Change current drive */
 FRESULT f_getcwd (TCHAR* buff, UINT len);							/* Get current directory */
 FRESULT f_getfree (const TCHAR* path, DWORD* nclst, FATFS** fatfs);	/* Get number of free clusters on the drive */
+FRESULT f_scanfree (const TCHAR* path, UINT nsect, DWORD* nclst);	/* Count free clusters a few FAT sectors at a time */
+FRESULT f_syncvol (const TCHAR* path);								/* Synchronize the volume and mark it clean */
+FRESULT f_getstats (const TCHAR* path, FSSTATS* st);				/* Get file system statistics */
+FRESULT f_setopt (const TCHAR* path, BYTE opt, DWORD val);			/* Set a run-time option of the volume */
 FRESULT f_getlabel (const TCHAR* path, TCHAR* label, DWORD* vsn);	/* Get volume label */
 FRESULT f_setlabel (const TCHAR* label);							/* Set volume label */
 FRESULT f_forward (FIL* fp, UINT(*func)(const BYTE*,UINT), UINT btf, UINT* bf);	/* Forward data to the stream */
 FRESULT f_expand (FIL* fp, FSIZE_t szf, BYTE opt);					/* Allocate a contiguous block to the file */
+FRESULT f_setsize (FIL* fp, FSIZE_t fsz);							/* Set the size of a preallocated file */
 FRESULT f_mount (FATFS* fs, const TCHAR* path, BYTE opt);			/* Mount/Unmount a logical drive */
 FRESULT f_mkfs (const TCHAR* path, BYTE opt, DWORD au, void* work, UINT len);	/* Create a FAT volume */
 FRESULT f_fdisk (BYTE pdrv, const DWORD* szt, void* work);			/* Divide a physical drive into some partitions */
@@ -340,6 +404,13 @@ int ff_del_syncobj (_SYNC_t sobj);				/* Delete a sync object */
 #define FM_ANY		0x07
 #define FM_SFD		0x08
 
+/* Run-time options (2nd argument of f_setopt) */
+#define FO_FATCACHE		1	/* FAT cache slots in use (0:FAT through win[]) */
+#define FO_FATBITMAP	2	/* Free cluster bitmap (0:off, 1:on) */
+#define FO_DIRINDEX		3	/* Directory index (0:off, 1:on), the index is rebuilt */
+#define FO_FREECNT		4	/* Forget the free cluster count (val is ignored) */
+#define FO_LASTCLST		5	/* Cluster the next allocation search starts after */
+
 /* Filesystem type (FATFS.fs_type) */
 #define FS_FAT12	1
 #define FS_FAT16	2
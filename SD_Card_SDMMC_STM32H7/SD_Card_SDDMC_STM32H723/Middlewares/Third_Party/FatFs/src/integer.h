@@ -11,6 +11,18 @@
 #include <tchar.h>
 typedef unsigned __int64 QWORD;
 
+#elif defined(SD_HOST_IMAGE)	/* Host build of the FatFs tree (64-bit Linux) */
+
+#include <stdint.h>
+typedef int				INT;
+typedef unsigned int	UINT;
+typedef unsigned char	BYTE;
+typedef short			SHORT;
+typedef unsigned short	WORD;
+typedef unsigned short	WCHAR;
+typedef int32_t			LONG;
+typedef uint32_t		DWORD;
+typedef uint64_t		QWORD;
 
 #else			/* Embedded platform */
 
@@ -0,0 +1,238 @@
+/*
+ * Host driver for the SD benchmarks: formats a disk image, mounts it through
+ * the SD_HOST_IMAGE backend of sd_diskio.c and runs the benchmarks of
+ * Core/Src/sd_benchmark_*.c on it with a board timing profile.
+ *
+ *   sd_host [-p f407|h723] [-s size_mb] [-f fat32|exfat] [-o image] [name...]
+ *
+ * Without names the whole sd_benchmark() sequence runs. The figures quoted
+ * in the commit messages come from this program, see tools/host/Makefile.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "main.h"
+#include "bsp_driver_sd.h"
+#include "fatfs.h"
+#include "sd_functions.h"
+#include "sd_benchmark.h"
+#include "sd_dlog.h"
+
+#define HOST_IMAGE           "sd_host.img"
+#define HOST_SIZE_MB         1024
+#define HOST_BENCH_FILE      (8 * 1024 * 1024)
+#define HOST_DLOG_CALLS      1000000
+
+uint32_t SystemCoreClock;
+Host_CoreDebug_TypeDef Host_CoreDebug;
+
+static Host_DWT_TypeDef host_dwt;
+static uint32_t card_blocks;
+
+/***************************************************************
+ * CMSIS / HAL stand-ins declared in shim/main.h
+ ***************************************************************/
+
+Host_DWT_TypeDef *Host_DWT(void) {
+    host_dwt.CYCCNT = (uint32_t)(SD_Host_GetTimeUs() * (SystemCoreClock / 1000000U));
+    return &host_dwt;
+}
+
+uint32_t HAL_GetTick(void) {
+    return (uint32_t)(SD_Host_GetTimeUs() / 1000U);
+}
+
+void SysTick_SetHook(SysTick_HookTypeDef hook) {
+    (void)hook;
+}
+
+void BSP_SD_GetCardInfo(BSP_SD_CardInfo *info) {
+    memset(info, 0, sizeof(*info));
+    info->CardType = 1;              // SDHC/SDXC
+    info->CardVersion = 1;           // V2.x
+    info->Class = 0x5B5;
+    info->BlockNbr = card_blocks;
+    info->BlockSize = 512;
+    info->LogBlockNbr = card_blocks;
+    info->LogBlockSize = 512;
+}
+
+/***************************************************************
+ * Deferred log against snprintf of the same line: host CPU
+ * time, the only case measured with the wall clock
+ ***************************************************************/
+
+static double host_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void host_bench_dlog(void) {
+    static char line[128];
+    double t0, t_dlog, t_snprintf;
+    uint32_t i, sum = 0;
+
+    t0 = host_ns();
+    for (i = 0; i < HOST_DLOG_CALLS; i++) {
+        SD_DLOG_INFO(SD_MSG_APPEND, i & 0xFFFF, "bench_log.txt");
+    }
+    t_dlog = host_ns() - t0;
+
+    t0 = host_ns();
+    for (i = 0; i < HOST_DLOG_CALLS; i++) {
+        sum += snprintf(line, sizeof(line), "Appended %u bytes to %s", (unsigned)(i & 0xFFFF), "bench_log.txt");
+    }
+    t_snprintf = host_ns() - t0;
+
+    printf("BENCH_INFO,dlog,calls,%u,dlog_ns,%.1f,snprintf_ns,%.1f,chars,%u\r\n",
+           HOST_DLOG_CALLS, t_dlog / HOST_DLOG_CALLS, t_snprintf / HOST_DLOG_CALLS, (unsigned)sum);
+}
+
+/***************************************************************
+ * Benchmarks by name, with the arguments sd_benchmark() uses
+ ***************************************************************/
+
+static void run_suite(void)     { sd_benchmark_suite(NULL); }
+static void run_small(void)     { sd_benchmark_small_write("bench_small.txt", 1024 * 1024, 48); }
+static void run_erase(void)     { sd_benchmark_pre_erase("bench_erase.bin", HOST_BENCH_FILE); }
+static void run_stream(void)    { sd_benchmark_stream("bench_stream.bin", HOST_BENCH_FILE); }
+static void run_cpu(void)       { sd_benchmark_cpu_free("bench_cpu.bin", HOST_BENCH_FILE); }
+static void run_unaligned(void) { sd_benchmark_unaligned("bench_unaligned.bin", HOST_BENCH_FILE); }
+static void run_log(void)       { sd_benchmark_log("bench_log.txt", 500); }
+static void run_trace(void)     { sd_benchmark_trace("bench_trace.bin"); }
+static void run_fatcache(void)  { sd_benchmark_fatcache(200); }
+static void run_alloc(void)     { sd_benchmark_alloc(64); }
+static void run_boot(void)      { sd_benchmark_boot(); }
+static void run_record(void)    { sd_benchmark_record("bench_record.bin", HOST_BENCH_FILE); }
+static void run_seek(void)      { sd_benchmark_seek(); }
+static void run_dirindex(void)  { sd_benchmark_dirindex(); }
+static void run_create(void)    { sd_benchmark_create(10000); }
+static void run_queue(void)     { sd_benchmark_queue("bench_queue.bin", HOST_BENCH_FILE); }
+static void run_csv(void)       { sd_benchmark_csv("bench_csv.csv", 1024 * 1024); }
+static void run_csvw(void)      { sd_benchmark_csv_write("bench_csvw.csv", 20000); }
+static void run_text(void)      { sd_benchmark_text("bench_text.txt", 512 * 1024); }
+static void run_tslog(void)     { sd_benchmark_tslog("bench_ts.tsl", "bench_ts.csv", 100000); }
+static void run_pack(void)      { sd_benchmark_pack("bench_pack.bin"); }
+
+static const struct {
+    const char *name;
+    void (*run)(void);
+} benches[] = {
+    { "suite", run_suite },         { "small", run_small },       { "erase", run_erase },
+    { "stream", run_stream },       { "cpu", run_cpu },           { "unaligned", run_unaligned },
+    { "log", run_log },             { "trace", run_trace },       { "fatcache", run_fatcache },
+    { "alloc", run_alloc },         { "boot", run_boot },         { "record", run_record },
+    { "seek", run_seek },           { "dirindex", run_dirindex }, { "create", run_create },
+    { "queue", run_queue },         { "csv", run_csv },           { "csvw", run_csvw },
+    { "text", run_text },           { "tslog", run_tslog },       { "pack", run_pack },
+    { "dlog", host_bench_dlog },
+};
+
+static void usage(void) {
+    fprintf(stderr, "usage: sd_host [-p f407|h723] [-s size_mb] [-f fat32|exfat] [-o image] [name...]\n"
+                    "names:");
+    for (size_t i = 0; i < sizeof(benches) / sizeof(benches[0]); i++) fprintf(stderr, " %s", benches[i].name);
+    fprintf(stderr, "\nno name runs sd_benchmark()\n");
+    exit(2);
+}
+
+/***************************************************************
+ * Create a zeroed (sparse) image and format it
+ ***************************************************************/
+
+static int host_format(const char *path, uint32_t size_mb, BYTE fmt, const SD_HostProfileTypeDef *profile) {
+    static BYTE work[4096];
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    FRESULT res;
+
+    if (fd < 0 || ftruncate(fd, (off_t)size_mb * 1024 * 1024) != 0) {
+        perror(path);
+        if (fd >= 0) close(fd);
+        return -1;
+    }
+    close(fd);
+    card_blocks = size_mb * 2048U;
+
+    if (SD_Host_Open(path, profile) != 0) {
+        fprintf(stderr, "%s: can not map the image\n", path);
+        return -1;
+    }
+    MX_FATFS_Init();
+    res = f_mkfs(SDPath, fmt, 0, work, sizeof(work));
+    if (res != FR_OK) {
+        fprintf(stderr, "f_mkfs failed: %d\n", res);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const SD_HostProfileTypeDef *profile = &SD_HostProfile_F407_SDIO;
+    const char *image = HOST_IMAGE;
+    uint32_t size_mb = HOST_SIZE_MB;
+    BYTE fmt = FM_FAT32;
+    int opt;
+
+#if defined(HOST_BOARD_H723)
+    profile = &SD_HostProfile_H723_SDMMC1;
+#endif
+    while ((opt = getopt(argc, argv, "p:s:f:o:")) != -1) {
+        switch (opt) {
+        case 'p':
+            if (strcmp(optarg, "f407") == 0) profile = &SD_HostProfile_F407_SDIO;
+            else if (strcmp(optarg, "h723") == 0) profile = &SD_HostProfile_H723_SDMMC1;
+            else usage();
+            break;
+        case 's':
+            size_mb = (uint32_t)strtoul(optarg, NULL, 0);
+            if (size_mb < 64) usage();
+            break;
+        case 'f':
+            if (strcmp(optarg, "fat32") == 0) fmt = FM_FAT32;
+            else if (strcmp(optarg, "exfat") == 0) fmt = FM_EXFAT;
+            else usage();
+#if !_FS_EXFAT
+            if (fmt == FM_EXFAT) {
+                fprintf(stderr, "exfat: _FS_EXFAT is off in this board's ffconf.h\n");
+                return 2;
+            }
+#endif
+            break;
+        case 'o':
+            image = optarg;
+            break;
+        default:
+            usage();
+        }
+    }
+    SystemCoreClock = (profile == &SD_HostProfile_H723_SDMMC1) ? 550000000U : 168000000U;
+
+    if (host_format(image, size_mb, fmt, profile) != 0) return 1;
+    printf("BENCH_INFO,host,profile,%s,image_mb,%u,format,%s\r\n",
+           profile->name, (unsigned)size_mb, fmt == FM_EXFAT ? "exfat" : "fat32");
+
+    if (optind == argc) {
+        sd_benchmark();
+        SD_Host_Close();
+        return 0;
+    }
+
+    if (sd_mount() != FR_OK) return 1;
+    for (int i = optind; i < argc; i++) {
+        size_t b;
+        for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++) {
+            if (strcmp(argv[i], benches[b].name) == 0) break;
+        }
+        if (b == sizeof(benches) / sizeof(benches[0])) usage();
+        benches[b].run();
+    }
+    sd_unmount();
+    sd_dlog_dump();
+    SD_Host_Close();
+    return 0;
+}
@@ -0,0 +1,23 @@
+/*
+ * Host build: the card information the Core modules read from the BSP,
+ * filled by sd_host from the disk image
+ */
+#ifndef __BSP_DRIVER_SD_H
+#define __BSP_DRIVER_SD_H
+
+#include "main.h"
+
+typedef struct {
+    uint32_t CardType;
+    uint32_t CardVersion;
+    uint32_t Class;
+    uint32_t RelCardAdd;
+    uint32_t BlockNbr;
+    uint32_t BlockSize;
+    uint32_t LogBlockNbr;
+    uint32_t LogBlockSize;
+} BSP_SD_CardInfo;
+
+void BSP_SD_GetCardInfo(BSP_SD_CardInfo *info);
+
+#endif /* __BSP_DRIVER_SD_H */
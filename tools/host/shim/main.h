@@ -0,0 +1,53 @@
+/*
+ * Host build of the Core modules: stands in for main.h and the CMSIS / HAL
+ * parts they use. Time is the simulated clock of the disk image backend
+ * (SD_Host_GetTimeUs), so HAL_GetTick() and DWT->CYCCNT only move while the
+ * "card" works and every run prints the same numbers.
+ */
+#ifndef __MAIN_H
+#define __MAIN_H
+
+#include <stdint.h>
+#include "sd_diskio.h"
+
+// Core clock of the board being modelled, set by sd_host from the profile
+extern uint32_t SystemCoreClock;
+
+typedef struct {
+    uint32_t CTRL;
+    uint32_t CYCCNT;
+} Host_DWT_TypeDef;
+
+typedef struct {
+    uint32_t DEMCR;
+} Host_CoreDebug_TypeDef;
+
+// DWT->CYCCNT reads the simulated clock in core cycles
+Host_DWT_TypeDef *Host_DWT(void);
+extern Host_CoreDebug_TypeDef Host_CoreDebug;
+
+#define DWT                          (Host_DWT())
+#define CoreDebug                    (&Host_CoreDebug)
+#define CoreDebug_DEMCR_TRCENA_Msk   (1UL << 24)
+#define DWT_CTRL_CYCCNTENA_Msk       1UL
+
+uint32_t HAL_GetTick(void);
+
+// Single-threaded host: exclusive access always succeeds
+#define __DMB()                      __sync_synchronize()
+#define __CLREX()                    ((void)0)
+
+static inline uint32_t __LDREXW(volatile uint32_t *addr) {
+    return *addr;
+}
+
+static inline uint32_t __STREXW(uint32_t value, volatile uint32_t *addr) {
+    *addr = value;
+    return 0;
+}
+
+// No SysTick on the host: the hook is kept but never called
+typedef void (*SysTick_HookTypeDef)(void);
+void SysTick_SetHook(SysTick_HookTypeDef hook);
+
+#endif /* __MAIN_H */
@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Decode the deferred log printed by sd_dlog_dump() over the UART.
+
+Reads a captured console log (file or stdin), keeps the lines between
+DLOG_BEGIN and DLOG_END and prints every record as the text the firmware
+would have printed:
+
+  [    1234 ms] INFO  Appended 48 bytes to log.txt
+
+The message table is read from SD_DLOG_MESSAGES in Core/Inc/sd_dlog.h, so
+point -m at the header of the firmware that produced the log.
+
+usage: sd_dlog_decode.py [-m sd_dlog.h] [-l level] [log]
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+DEFAULT_HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..",
+                              "SD_Card_DMA_POC_STM32F407", "Core", "Inc", "sd_dlog.h")
+LEVELS = {1: "ERROR", 2: "WARN", 3: "INFO", 4: "DEBUG"}
+MESSAGE = re.compile(r'X\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)')
+CONVERSION = re.compile(r"%([-+ #0-9.]*)[hlz]*([diouxXcs%])")
+
+
+def load_messages(path):
+    """Returns {id: format} in SdDlogMsg order, IDs start at 1."""
+    with open(path) as f:
+        text = f.read()
+    start = text.find("#define SD_DLOG_MESSAGES")
+    if start < 0:
+        sys.exit("SD_DLOG_MESSAGES not found in %s" % path)
+    end = text.find("\n\n", start)
+    table = MESSAGE.findall(text[start:end if end > 0 else len(text)])
+    return {i + 1: fmt.encode().decode("unicode_escape") for i, (_, fmt) in enumerate(table)}
+
+
+def parse(lines):
+    """Yields ('dump', records, lost) and ('rec', tick, id, level, truncated, data) in log order."""
+    for line in lines:
+        line = line.strip()
+        if line.startswith("DLOG_BEGIN,"):
+            _, n, lost = line.split(",")
+            yield ("dump", int(n), int(lost))
+        elif line.startswith("DLOG,"):
+            _, tick, msg, level, trunc, hexdata = line.split(",")
+            data = b"".join(struct.pack("<I", int(hexdata[i:i + 8], 16))
+                            for i in range(0, len(hexdata) - 7, 8))
+            yield ("rec", int(tick, 16), int(msg), int(level), int(trunc), data)
+
+
+def render(fmt, data, truncated):
+    """Formats the raw arguments the way sd_dlog() stored them."""
+    pos = 0
+    out = []
+    last = 0
+    for m in CONVERSION.finditer(fmt):
+        out.append(fmt[last:m.start()])
+        last = m.end()
+        flags, conv = m.group(1), m.group(2)
+        if conv == "%":
+            out.append("%")
+            continue
+        if conv == "s":
+            nul = data.find(b"\0", pos)
+            if pos >= len(data) or nul < 0:
+                out.append("...")
+                pos = len(data)
+                continue
+            s = data[pos:nul].decode("utf-8", "replace")
+            if truncated and nul == len(data) - 1:
+                s += "..."
+            out.append(("%" + flags + "s") % s)
+            pos = (nul + 1 + 3) & ~3
+        else:
+            if pos + 4 > len(data):
+                out.append("?")
+                continue
+            (v,) = struct.unpack_from("<I", data, pos)
+            pos += 4
+            if conv in "di" and v & 0x80000000:
+                v -= 1 << 32
+            out.append(("%" + flags + conv) % (chr(v & 0xFF) if conv == "c" else v))
+    out.append(fmt[last:])
+    return "".join(out)
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Decode sd_dlog_dump() output")
+    ap.add_argument("-m", "--messages", default=DEFAULT_HEADER, help="sd_dlog.h with SD_DLOG_MESSAGES")
+    ap.add_argument("-l", "--level", type=int, default=4, help="highest level printed (1 error .. 4 debug)")
+    ap.add_argument("log", nargs="?", help="console capture (default: stdin)")
+    args = ap.parse_args()
+
+    messages = load_messages(args.messages)
+    src = open(args.log, errors="replace") if args.log else sys.stdin
+    with src:
+        for item in parse(src):
+            if item[0] == "dump":
+                if item[2]:
+                    print("-- %d older records overwritten" % item[2])
+                continue
+            _, tick, msg, level, trunc, data = item
+            if level > args.level:
+                continue
+            fmt = messages.get(msg)
+            text = render(fmt, data, trunc) if fmt else "unknown message %d" % msg
+            print("[%8d ms] %-5s %s" % (tick, LEVELS.get(level, str(level)), text))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Unpack a file written through sd_pack (e.g. an SdStream with a packer).
+
+The file is a sequence of frames, one per packed buffer, as described in
+Core/Inc/sd_pack.h:
+
+  SdPackHeader  magic "SDPK", raw_size, packed_size, method, delta
+  data          stored bytes or an LZ4 block, then the delta filter undone
+
+Every frame decodes on its own. A damaged frame is reported on stderr and
+the decoder moves on to the next frame magic.
+
+usage: sd_pack_decode.py [-o out] [-s] packed
+  -s   only print the frame statistics
+"""
+
+import argparse
+import struct
+import sys
+
+MAGIC = 0x4B504453          # "SDPK"
+STORED, LZ4 = 0, 1
+HEADER = struct.Struct("<IIIBBH")   # keep in sync with SdPackHeader
+
+
+def lz4_block(src, raw_size):
+    """Decodes one LZ4 block, raises ValueError when it is damaged."""
+    out = bytearray()
+    ip = 0
+    while ip < len(src):
+        token = src[ip]
+        ip += 1
+        lit = token >> 4
+        if lit == 15:
+            while True:
+                b = src[ip]
+                ip += 1
+                lit += b
+                if b != 255:
+                    break
+        if ip + lit > len(src):
+            raise ValueError("literals past the block")
+        out += src[ip:ip + lit]
+        ip += lit
+        if ip == len(src):
+            break
+        off = src[ip] | (src[ip + 1] << 8)
+        ip += 2
+        if off == 0 or off > len(out):
+            raise ValueError("bad match offset")
+        mlen = token & 15
+        if mlen == 15:
+            while True:
+                b = src[ip]
+                ip += 1
+                mlen += b
+                if b != 255:
+                    break
+        mlen += 4
+        start = len(out) - off
+        if off >= mlen:
+            out += out[start:start + mlen]
+        else:
+            for i in range(mlen):       # overlapping: repeats the last off bytes
+                out.append(out[start + i])
+    if len(out) != raw_size:
+        raise ValueError("size %d, header says %d" % (len(out), raw_size))
+    return out
+
+
+def undelta(buf, stride):
+    for i in range(stride, len(buf)):
+        buf[i] = (buf[i] + buf[i - stride]) & 0xFF
+    return buf
+
+
+def frames(data):
+    """Yields (offset, header tuple, raw bytes or None when damaged)."""
+    pos = 0
+    while pos + HEADER.size <= len(data):
+        magic, raw_size, packed_size, method, delta, _ = HEADER.unpack_from(data, pos)
+        body = data[pos + HEADER.size:pos + HEADER.size + packed_size]
+        raw = None
+        if magic == MAGIC and len(body) == packed_size:
+            try:
+                if method == STORED and packed_size == raw_size:
+                    raw = bytearray(body)
+                elif method == LZ4:
+                    raw = lz4_block(body, raw_size)
+                if raw is not None and delta:
+                    raw = undelta(raw, delta)
+            except (ValueError, IndexError) as e:
+                print("frame at %d: %s" % (pos, e), file=sys.stderr)
+        if raw is None:
+            nxt = data.find(struct.pack("<I", MAGIC), pos + 1)
+            print("frame at %d damaged, resuming at %d" % (pos, nxt), file=sys.stderr)
+            yield pos, (magic, raw_size, packed_size, method, delta), None
+            if nxt < 0:
+                return
+            pos = nxt
+            continue
+        yield pos, (magic, raw_size, packed_size, method, delta), raw
+        pos += HEADER.size + packed_size
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Unpack sd_pack frames")
+    ap.add_argument("-o", "--output", help="raw output (default: stdout)")
+    ap.add_argument("-s", "--stats", action="store_true", help="statistics only")
+    ap.add_argument("packed")
+    args = ap.parse_args()
+
+    with open(args.packed, "rb") as f:
+        data = f.read()
+
+    n = stored = damaged = raw_bytes = 0
+    out = None if args.stats else (open(args.output, "wb") if args.output else sys.stdout.buffer)
+    for _, (_, _, _, method, _), raw in frames(data):
+        n += 1
+        if raw is None:
+            damaged += 1
+            continue
+        stored += method == STORED
+        raw_bytes += len(raw)
+        if out:
+            out.write(raw)
+    if out and out is not sys.stdout.buffer:
+        out.close()
+
+    ratio = raw_bytes / len(data) if data else 0
+    print("%d frames (%d stored, %d damaged), %d bytes -> %d bytes, ratio %.2f"
+          % (n, stored, damaged, len(data), raw_bytes, ratio), file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()
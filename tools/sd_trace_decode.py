@@ -0,0 +1,158 @@
+#!/usr/bin/env python3
+"""Decode the SD trace ring printed by sd_trace_dump() over the UART.
+
+Reads a captured console log (file or stdin), keeps the lines between
+TRACE_BEGIN and TRACE_END and prints, for every f_read/f_write call, where
+the time went:
+
+  dma    issue of BSP_SD_*Blocks_DMA up to the Rx/Tx complete interrupt
+  busy   waiting for the card to leave the programming state
+  fatfs  everything else (FatFs, diskio write cache, memcpy, caller)
+
+usage: sd_trace_decode.py [-t] [log]
+  -t   also print the raw timeline
+"""
+
+import argparse
+import sys
+
+# keep in sync with SdTraceEvent in FATFS/Target/sd_trace_points.h
+EVENTS = {
+    1: "f_read",
+    2: "f_read_end",
+    3: "f_write",
+    4: "f_write_end",
+    5: "move_window",
+    6: "sync_window",
+    7: "dma_read",
+    8: "dma_write",
+    9: "rx_cplt",
+    10: "tx_cplt",
+    11: "card_ready",
+}
+CALL_START = {1: 2, 3: 4}   # start event -> end event
+DMA_DONE = (9, 10)
+CARD_READY = 11
+WINDOW = (5, 6)
+
+
+def parse(lines):
+    """Returns (cycles_per_us, lost, [(time_us, event, arg, count)]) of the last dump."""
+    dump, last = None, None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE_BEGIN,"):
+            _, cpu, _, lost = line.split(",")
+            dump = (int(cpu), int(lost), [])
+        elif line.startswith("TRACE,") and dump is not None:
+            _, cyc, ev, arg, cnt = line.split(",")
+            dump[2].append((int(cyc, 16), int(ev), int(arg, 16), int(cnt)))
+        elif line.startswith("TRACE_END") and dump is not None:
+            last = dump
+            dump = None
+    if dump is not None:
+        last = dump         # truncated capture, decode what arrived
+    if last is None:
+        sys.exit("no TRACE_BEGIN found")
+    cpu, lost, raw = last
+
+    # unwrap the 32-bit cycle counter
+    events, base, prev = [], 0, None
+    for cyc, ev, arg, cnt in raw:
+        if prev is not None and cyc < prev:
+            base += 1 << 32
+        prev = cyc
+        events.append(((base + cyc) / max(cpu, 1), ev, arg, cnt))
+    if events:
+        t0 = events[0][0]
+        events = [(t - t0, ev, arg, cnt) for t, ev, arg, cnt in events]
+    return cpu, lost, events
+
+
+def timeline(events):
+    prev = 0.0
+    for t, ev, arg, cnt in events:
+        name = EVENTS.get(ev, "event%d" % ev)
+        print("%12.2f %+10.2f  %-12s arg=%-10d count=%d" % (t, t - prev, name, arg, cnt))
+        prev = t
+
+
+def calls(events):
+    """Splits the trace into FatFs calls and attributes each interval by its end event."""
+    out, cur, prev_t = [], None, None
+    for t, ev, arg, cnt in events:
+        if cur is not None and prev_t is not None:
+            span = t - prev_t
+            if ev in DMA_DONE:
+                cur["dma"] += span
+            elif ev == CARD_READY:
+                cur["busy"] += span
+            else:
+                cur["fatfs"] += span
+        prev_t = t
+
+        if ev in CALL_START:
+            cur = {"name": EVENTS[ev], "end": CALL_START[ev], "start": t, "offset": arg,
+                   "bytes": cnt, "dma": 0.0, "busy": 0.0, "fatfs": 0.0,
+                   "cmds": 0, "sectors": 0, "windows": 0}
+        elif cur is None:
+            continue
+        elif ev == cur["end"]:
+            cur["total"] = t - cur["start"]
+            out.append(cur)
+            cur = None
+        elif ev in (7, 8):
+            cur["cmds"] += 1
+            cur["sectors"] += cnt
+        elif ev in WINDOW:
+            cur["windows"] += 1
+    return out
+
+
+def percentile(values, pct):
+    values = sorted(values)
+    if not values:
+        return 0.0
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Decode sd_trace_dump() output")
+    ap.add_argument("-t", "--timeline", action="store_true", help="print every event")
+    ap.add_argument("log", nargs="?", help="console capture (default: stdin)")
+    args = ap.parse_args()
+
+    src = open(args.log, errors="replace") if args.log else sys.stdin
+    with src:
+        cpu, lost, events = parse(src)
+
+    print("%d events, %d cycles/us, %d older events overwritten" % (len(events), cpu, lost))
+    if args.timeline:
+        timeline(events)
+        print()
+
+    result = calls(events)
+    print("%-11s %10s %8s %10s %10s %10s %5s %7s %4s"
+          % ("call", "offset", "bytes", "total_us", "dma_us", "busy_us", "cmds", "sectors", "win"))
+    for c in result:
+        print("%-11s %10d %8d %10.1f %10.1f %10.1f %5d %7d %4d"
+              % (c["name"], c["offset"], c["bytes"], c["total"], c["dma"], c["busy"],
+                 c["cmds"], c["sectors"], c["windows"]))
+
+    print()
+    for name in ("f_read", "f_write"):
+        sel = [c for c in result if c["name"] == name]
+        if not sel:
+            continue
+        total = sum(c["total"] for c in sel) or 1.0
+        print("%s: %d calls, p50 %.1f us, p99 %.1f us, max %.1f us, "
+              "dma %.0f%%, busy %.0f%%, fatfs %.0f%%"
+              % (name, len(sel), percentile([c["total"] for c in sel], 50),
+                 percentile([c["total"] for c in sel], 99), max(c["total"] for c in sel),
+                 100 * sum(c["dma"] for c in sel) / total,
+                 100 * sum(c["busy"] for c in sel) / total,
+                 100 * sum(c["fatfs"] for c in sel) / total))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Convert a binary time-series log written by sd_tslog to CSV.
+
+The file layout is described in Core/Inc/sd_tslog.h: a header block, data
+blocks of fixed-size records (timestamp + payload given by the format
+string in the header) and a sparse index behind the last data block. The
+output matches sd_tslog_to_csv() on the device:
+
+  time_ms,v0,v1,...
+  1038,10,2.500,-10
+
+Blocks failing their CRC are reported on stderr and skipped. A log that
+was not closed has no index, its blocks are counted from the file size.
+
+usage: sd_tslog_to_csv.py [--from MS] [--to MS] [-d DECIMALS] [-o out.csv] [-i] log
+  -i   print the header and the index instead of the records
+"""
+
+import argparse
+import struct
+import sys
+import zlib
+
+FILE_MAGIC = 0x474C5354     # "TSLG"
+BLOCK_MAGIC = 0x4B425354    # "TSBK"
+VERSION = 1
+
+# keep in sync with SdTslogFileHeader / SdTslogBlockHeader in sd_tslog.h
+FILE_HEADER = struct.Struct("<IHHIHH16sIIIIIIIII")
+BLOCK_HEADER = struct.Struct("<IIIIHHI")
+FILE_FIELDS = ("magic", "version", "header_size", "block_size", "record_size",
+               "records_per_block", "format", "blocks", "records", "t_first", "t_last",
+               "index_block", "index_entries", "index_stride", "index_crc", "crc")
+
+
+def read_header(data):
+    if len(data) < FILE_HEADER.size:
+        sys.exit("file too short")
+    hdr = dict(zip(FILE_FIELDS, FILE_HEADER.unpack_from(data)))
+    if hdr["magic"] != FILE_MAGIC or hdr["version"] != VERSION:
+        sys.exit("not a sd_tslog file")
+    if zlib.crc32(data[:FILE_HEADER.size - 4]) != hdr["crc"]:
+        sys.exit("file header CRC error")
+    hdr["format"] = hdr["format"].split(b"\0")[0].decode()
+    if struct.calcsize("<" + hdr["format"]) + 4 != hdr["record_size"]:
+        sys.exit("format %r does not match record size %d" % (hdr["format"], hdr["record_size"]))
+    return hdr
+
+
+def read_index(data, hdr):
+    """Returns [(t_first, block)], empty when the log was not closed."""
+    if not hdr["index_block"]:
+        hdr["blocks"] = max(len(data) // hdr["block_size"] - 1, 0)
+        return []
+    start = hdr["index_block"] * hdr["block_size"]
+    raw = data[start:start + 8 * hdr["index_entries"]]
+    if zlib.crc32(raw) != hdr["index_crc"]:
+        print("index CRC error, scanning every block", file=sys.stderr)
+        hdr["blocks"] = max(len(data) // hdr["block_size"] - 1, 0)
+        return []
+    return list(struct.iter_unpack("<II", raw))
+
+
+def first_block(index, t_from):
+    """Data block to start from: the last indexed block starting before t_from."""
+    block = 0
+    for t_first, b in index:
+        if t_first >= t_from:
+            break
+        block = b
+    return block
+
+
+def records(data, hdr, start, t_from, t_to):
+    """Yields (t, values) for t_from <= t <= t_to."""
+    bs = hdr["block_size"]
+    rec = struct.Struct("<I" + hdr["format"])
+    for b in range(start, hdr["blocks"]):
+        block = data[(b + 1) * bs:(b + 2) * bs]
+        magic, seq, t_first, t_last, count, size, crc = BLOCK_HEADER.unpack_from(block)
+        body = block[BLOCK_HEADER.size:BLOCK_HEADER.size + count * size]
+        if (magic != BLOCK_MAGIC or size != hdr["record_size"] or count > hdr["records_per_block"]
+                or zlib.crc32(body, zlib.crc32(block[:BLOCK_HEADER.size - 4])) != crc):
+            print("block %d: bad header or CRC, skipped" % b, file=sys.stderr)
+            continue
+        if t_last < t_from:
+            continue
+        if t_first > t_to:
+            return
+        for fields in rec.iter_unpack(body):
+            if fields[0] > t_to:
+                return
+            if fields[0] >= t_from:
+                yield fields[0], fields[1:]
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Convert a sd_tslog file to CSV")
+    ap.add_argument("--from", dest="t_from", type=int, default=0, help="first timestamp (ms)")
+    ap.add_argument("--to", dest="t_to", type=int, default=0xFFFFFFFF, help="last timestamp (ms)")
+    ap.add_argument("-d", "--decimals", type=int, default=3, help="float decimals (device: 3)")
+    ap.add_argument("-o", "--output", help="CSV file (default: stdout)")
+    ap.add_argument("-i", "--info", action="store_true", help="print header and index only")
+    ap.add_argument("log")
+    args = ap.parse_args()
+
+    with open(args.log, "rb") as f:
+        data = f.read()
+    hdr = read_header(data)
+    index = read_index(data, hdr)
+
+    if args.info:
+        for key in FILE_FIELDS:
+            print("%-18s %s" % (key, hdr[key]))
+        for t_first, b in index:
+            print("index %10d block %d" % (t_first, b))
+        return
+
+    out = open(args.output, "w", newline="") if args.output else sys.stdout
+    with out:
+        out.write(",".join(["time_ms"] + ["v%d" % i for i in range(len(hdr["format"]))]) + "\r\n")
+        for t, values in records(data, hdr, first_block(index, args.t_from), args.t_from, args.t_to):
+            cols = [str(t)]
+            for kind, v in zip(hdr["format"], values):
+                cols.append("%.*f" % (args.decimals, v) if kind == "f" else str(v))
+            out.write(",".join(cols) + "\r\n")
+
+
+if __name__ == "__main__":
+    main()